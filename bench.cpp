@@ -0,0 +1,1041 @@
+// Benchmarks for the dictionary hot paths in myDic.cpp.
+// Build: g++ -O2 -std=c++17 -pthread bench.cpp -o bench   (MinGW: add -lpsapi)
+//        (add -DUSE_RADIX_TRIE to measure the radix write buffer)
+// Usage: bench [number_of_words] [all|batch|autocomplete|fuzzy|reverse|load|wal|churn|keys|stream|allocs|cache]
+//        bench [number_of_words] core [synthetic|real]
+//        bench [number_of_words] serve [address of a running --serve]
+// "core" prints JSON lines for regression checks between builds; "real"
+// stretches the a.txt..z.txt word lists to the requested size.
+#define MYDIC_NO_MAIN
+#include "myDic.cpp"
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// ======================= HELPERS =======================
+
+// counts heap allocations while countAllocations is set
+atomic<bool> countAllocations{false};
+atomic<size_t> allocationCount{0};
+
+void* operator new(size_t size) {
+    if (countAllocations.load(memory_order_relaxed)) allocationCount.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+// GCC pairs inlined new-expressions with these and warns about free()
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+string randomWord(mt19937 &rng) {
+    int len = 3 + rng() % 10;
+    string w;
+    for (int i = 0; i < len; i++) w.push_back('a' + rng() % 26);
+    return w;
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// fills the dictionary with n random words, returns them; weights are
+// heavy-tailed like real lookup counts
+vector<string> buildSyntheticDictionary(size_t n, mt19937 &rng) {
+    vector<string> words;
+    vector<TrieEntry> entries;
+    words.reserve(n);
+    entries.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        words.push_back(randomWord(rng));
+        uint32_t weight = (uint32_t)(1000000.0 / (1 + rng() % 100000));
+        entries.push_back({words.back(), "meaning of " + words.back(), weight});
+    }
+    replaceDictionary(buildDictState(move(entries)));
+    return words;
+}
+
+double percentile(vector<double> &v, double p) {
+    if (v.empty()) return 0;
+    size_t idx = min(v.size() - 1, (size_t)(p * v.size()));
+    nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+// ======================= BATCH LOOKUP =======================
+
+// searchInTrie without fetching the meaning, as a baseline for the walk alone
+bool containsWord(const string &wordRaw) {
+    string word = normalizeWord(wordRaw);
+    if (word.empty()) return false;
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+    if (TrieNode* node = findInBuffer(st->buffer, word)) return !node->erased;
+    FrozenTrie* ft = st->parts[partOf(word)];
+    return ft && frozenFind(ft, word.data() + 1, word.size() - 1) >= 0;
+}
+
+void printRate(const string &label, size_t ops, double sec, size_t hits) {
+    cout << left << setw(32) << label << right << setw(12) << fixed << setprecision(0)
+         << ops / sec << " lookups/s  (" << hits << " hits)\n";
+}
+
+void benchBatchLookup(size_t n) {
+    mt19937 rng(42);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+
+    // every stored word once, plus 10% misses, in random order
+    vector<string> queries = words;
+    for (size_t i = 0; i < n / 10; i++) queries.push_back(randomWord(rng) + "q");
+    shuffle(queries.begin(), queries.end(), rng);
+    cout << "words " << frozenWordCount() << ", queries " << queries.size() << "\n";
+
+    const size_t BATCH = 4096;
+    vector<string> meanings;
+    vector<char> found;
+    string meaning;
+
+    for (int withMeanings = 0; withMeanings < 2; withMeanings++) {
+        size_t hits = 0;
+        auto start = chrono::steady_clock::now();
+        for (const string &q : queries) {
+            hits += withMeanings ? searchInTrie(q, meaning) : containsWord(q);
+        }
+        double loopSec = secondsSince(start);
+        printRate(withMeanings ? "searchInTrie loop" : "exact-match loop", queries.size(), loopSec, hits);
+
+        hits = 0;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < queries.size(); i += BATCH) {
+            size_t count = min(BATCH, queries.size() - i);
+            searchInTrieBatch(queries.data() + i, count, found, withMeanings ? &meanings : nullptr);
+            for (char f : found) hits += f;
+        }
+        double batchSec = secondsSince(start);
+        printRate(withMeanings ? "searchInTrieBatch" : "searchInTrieBatch (no meaning)", queries.size(), batchSec, hits);
+        cout << "speedup " << setprecision(2) << loopSec / batchSec << "x\n";
+    }
+}
+
+// ======================= LOOKUP CACHE =======================
+
+// Zipf-distributed queries (s = 1) over the dictionary plus 5% misses, each
+// call timed, with the cache off and at two sizes
+void benchCache(size_t n) {
+    mt19937 rng(31);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+    shuffle(words.begin(), words.end(), rng);
+    size_t ranks = min<size_t>(words.size(), 1000000);
+    vector<double> cdf(ranks);
+    double total = 0;
+    for (size_t r = 0; r < ranks; r++) cdf[r] = total += 1.0 / (r + 1);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<string> queries;
+    for (size_t i = 0; i < 2000000; i++) {
+        if (i % 20 == 0) {
+            queries.push_back(randomWord(rng) + "q");
+            continue;
+        }
+        size_t r = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        queries.push_back(words[min(r, ranks - 1)]);
+    }
+    cout << "words " << frozenWordCount() << ", zipf queries " << queries.size() << "\n";
+
+    string meaning;
+    vector<double> nanos(queries.size());
+    for (size_t capacity : {(size_t)0, (size_t)4096, (size_t)65536}) {
+        configureLookupCache(capacity);
+        // one warm-up pass fills the cache
+        for (size_t i = 0; i < queries.size() / 4; i++) searchInTrie(queries[i], meaning);
+        size_t hits = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < queries.size(); i++) {
+            auto t = chrono::steady_clock::now();
+            hits += searchInTrie(queries[i], meaning);
+            nanos[i] = chrono::duration<double, nano>(chrono::steady_clock::now() - t).count();
+        }
+        double sec = secondsSince(start);
+        LookupCacheStats stats = readLookupCacheStats();
+        string label = capacity ? "cache " + to_string(capacity) : "no cache";
+        cout << left << setw(16) << label << right << setw(12) << fixed << setprecision(0)
+             << queries.size() / sec << " lookups/s  p50 " << percentile(nanos, 0.5) << " ns  p99 "
+             << percentile(nanos, 0.99) << " ns  (" << hits << " hits";
+        if (capacity) {
+            cout << ", " << setprecision(1) << 100.0 * stats.hits / max<uint64_t>(1, stats.hits + stats.misses)
+                 << "% cache hit rate";
+        }
+        cout << ")\n";
+    }
+    configureLookupCache(0);
+}
+
+// ======================= AUTOCOMPLETE =======================
+
+void benchAutocomplete(size_t n) {
+    mt19937 rng(7);
+    buildSyntheticDictionary(n, rng);
+    cout << "words " << frozenWordCount() << ", top-10 completions\n";
+
+    for (int len = 1; len <= 3; len++) {
+        vector<double> micros;
+        size_t results = 0;
+        for (int i = 0; i < 20000; i++) {
+            string prefix;
+            for (int j = 0; j < len; j++) prefix.push_back('a' + rng() % 26);
+            auto start = chrono::steady_clock::now();
+            results += autocomplete(prefix, 10).size();
+            micros.push_back(secondsSince(start) * 1e6);
+        }
+        cout << "prefix length " << len << ": p50 " << fixed << setprecision(1) << percentile(micros, 0.5)
+             << " us, p99 " << percentile(micros, 0.99) << " us, max " << percentile(micros, 1.0)
+             << " us (" << results << " results)\n";
+    }
+}
+
+// ======================= FUZZY LOOKUP =======================
+
+// one random insertion, deletion or substitution
+string misspell(const string &w, mt19937 &rng) {
+    string s = w;
+    size_t pos = rng() % (s.size() + 1);
+    char c = 'a' + rng() % 26;
+    int kind = rng() % 3;
+    if (kind == 0) s.insert(s.begin() + pos, c);
+    else if (pos < s.size() && kind == 1) s.erase(s.begin() + pos);
+    else if (pos < s.size()) s[pos] = c;
+    return s;
+}
+
+void benchFuzzy(size_t n) {
+    mt19937 rng(11);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+    cout << "words " << frozenWordCount() << ", misspelled queries\n";
+
+    for (int k = 1; k <= 2; k++) {
+        int queries = k == 1 ? 2000 : 300;
+        vector<double> micros;
+        size_t results = 0;
+        for (int i = 0; i < queries; i++) {
+            string q = misspell(words[rng() % words.size()], rng);
+            auto start = chrono::steady_clock::now();
+            results += fuzzySearch(q, k, 10).size();
+            micros.push_back(secondsSince(start) * 1e6);
+        }
+        cout << "k=" << k << ": p50 " << fixed << setprecision(1) << percentile(micros, 0.5)
+             << " us, p99 " << percentile(micros, 0.99) << " us (" << queries << " queries, "
+             << results << " results)\n";
+    }
+}
+
+// ======================= REVERSE LOOKUP =======================
+
+// meanings of 5 to 12 words drawn from a Zipf-distributed vocabulary, like
+// real definitions, and queries of 1 to 3 terms drawn the same way (so they
+// mix common and rare terms); a full scan of the meanings for comparison
+void benchReverse(size_t n) {
+    mt19937 rng(23);
+    vector<string> vocab(20000);
+    for (auto &w : vocab) w = randomWord(rng);
+    vector<double> cdf(vocab.size());
+    double total = 0;
+    for (size_t r = 0; r < vocab.size(); r++) cdf[r] = total += 1.0 / (r + 1);
+    uniform_real_distribution<double> uniform(0, total);
+    auto term = [&]() -> const string & {
+        size_t r = lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        return vocab[min(r, vocab.size() - 1)];
+    };
+
+    string text;
+    for (size_t i = 0; i < n; i++) {
+        text += randomWord(rng) + " -";
+        for (int k = 5 + rng() % 8; k > 0; k--) text += " " + term();
+        text += ".\n";
+    }
+    auto start = chrono::steady_clock::now();
+    replaceDictionary(buildStateFromText(text));
+    double loadSec = secondsSince(start);
+    size_t indexBytes = 0, words = frozenWordCount();
+    {
+        ReadGuard guard;
+        const DictState* st = dictState.load();
+        for (FrozenTrie* ft : st->parts) if (ft) indexBytes += ft->indexBytes();
+    }
+    cout << "words " << words << ", loaded and indexed in " << fixed << setprecision(2) << loadSec
+         << " s, index " << indexBytes / 1024 << " KB (" << setprecision(1)
+         << (double)indexBytes / max<size_t>(1, words) << " bytes per word)\n";
+
+    for (int terms = 1; terms <= 3; terms++) {
+        vector<double> micros;
+        size_t matches = 0;
+        for (int i = 0; i < 2000; i++) {
+            string query;
+            for (int k = 0; k < terms; k++) query += term() + " ";
+            size_t found;
+            auto t = chrono::steady_clock::now();
+            reverseLookup(query, 20, &found);
+            micros.push_back(secondsSince(t) * 1e6);
+            matches += found;
+        }
+        cout << terms << " term" << (terms > 1 ? "s" : " ") << ": p50 " << setprecision(1)
+             << percentile(micros, 0.5) << " us, p99 " << percentile(micros, 0.99) << " us, max "
+             << percentile(micros, 1.0) << " us (" << matches / 2000 << " matches on average)\n";
+    }
+
+    vector<pair<string,string>> all;
+    collectAllWords(all);
+    vector<string> want = termsOf(term() + " " + term());
+    start = chrono::steady_clock::now();
+    size_t scanned = 0;
+    for (auto &e : all) {
+        vector<string> has = termsOf(e.second);
+        scanned += includes(has.begin(), has.end(), want.begin(), want.end());
+    }
+    cout << "scanning every meaning for 2 terms: " << setprecision(1) << secondsSince(start) * 1e3
+         << " ms (" << scanned << " matches)\n";
+}
+
+// ======================= BULK LOADER =======================
+
+void benchLoad(size_t n) {
+    mt19937 rng(5);
+    string text;
+    for (size_t i = 0; i < n; i++) {
+        string w = randomWord(rng);
+        w[0] = toupper(w[0]);
+        text += w + " - Meaning of " + w + ".\n";
+    }
+    cout << "lines " << n << ", " << text.size() / (1 << 20) << " MB of text\n";
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    double oneSec = 0;
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        auto start = chrono::steady_clock::now();
+        replaceDictionary(buildStateFromBuffers({string_view(text)}, threads));
+        double sec = secondsSince(start);
+        if (threads == 1) oneSec = sec;
+        cout << "threads " << setw(3) << threads << ": " << fixed << setprecision(0) << n / sec
+             << " lines/s, " << frozenWordCount() << " words, speedup " << setprecision(2)
+             << oneSec / sec << "x\n";
+        if (threads * 2 > cores && threads != cores) threads = cores / 2;
+    }
+}
+
+// ======================= WRITE-AHEAD LOG =======================
+
+// logged inserts from several writers; fsync batching decides the rate
+void benchWal(size_t n) {
+    const string walPath = "bench.wal";
+    walOptions.imagePath = "bench.img";
+    size_t inserts = min<size_t>(n, 20000);
+    for (size_t syncEvery : {1, 64, 0}) {
+        for (unsigned writers : {1, 8}) {
+            remove(walPath.c_str());
+            clearDictionary();
+            walOptions.syncEvery = syncEvery;
+            openWriteAheadLog(walPath);
+            auto start = chrono::steady_clock::now();
+            runWorkers(writers, [&](unsigned t) {
+                mt19937 rng(t);
+                for (size_t i = t; i < inserts; i += writers) insertIntoTrie(randomWord(rng), "logged meaning");
+            });
+            double sec = secondsSince(start);
+            closeWriteAheadLog();
+            cout << "sync every " << setw(2) << syncEvery << ", " << writers << " writers: " << fixed
+                 << setprecision(0) << inserts / sec << " inserts/s\n";
+        }
+    }
+
+    // replaying the last log into an empty dictionary that has seen none of it
+    replaceDictionary(new DictState(), false);
+    auto start = chrono::steady_clock::now();
+    long replayed = openWriteAheadLog(walPath);
+    cout << "replay: " << fixed << setprecision(0) << replayed / secondsSince(start) << " records/s\n";
+    closeWriteAheadLog();
+    remove(walPath.c_str());
+    remove(walOptions.imagePath.c_str());
+}
+
+// ======================= CHURN =======================
+
+// a long-running writer: each round deletes a tenth of the words and inserts
+// as many new ones, then times lookups. Memory and lookup rate should level
+// off rather than drift as deletes are frozen and the buffer is compacted.
+void benchChurn(size_t n) {
+    mt19937 rng(17);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+    size_t perRound = max<size_t>(1, words.size() / 10);
+    string meaning;
+    for (int round = 0; round <= 10; round++) {
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; round && i < perRound; i++) {
+            string &victim = words[rng() % words.size()];
+            deleteFromTrie(victim);
+            victim = randomWord(rng);
+            insertIntoTrie(victim, "churned meaning of " + victim);
+        }
+        double writeSec = secondsSince(start);
+        size_t lookups = 200000, hits = 0;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < lookups; i++) hits += searchInTrie(words[rng() % words.size()], meaning);
+        double readSec = secondsSince(start);
+        DictGauges g = readGauges();
+        cout << "round " << setw(2) << round << ": " << fixed << setprecision(0);
+        if (round) cout << 2 * perRound / writeSec << " writes/s, ";
+        cout << lookups / readSec << " lookups/s (" << hits << " hits), frozen "
+             << g.frozenBytes / 1024 << " KB, buffer " << g.bufferBytes / 1024 << " KB ("
+             << g.bufferWaste / 1024 << " KB waste, " << g.bufferedDeletes << " deletes pending)\n";
+    }
+}
+
+// ======================= KEY LAYOUT =======================
+
+// the old a-z only node: 26 direct child pointers
+struct LegacyNode {
+    LegacyNode* child[26] = {};
+    bool isEnd = false;
+};
+
+void freeLegacy(LegacyNode* n) {
+    for (LegacyNode* c : n->child) if (c) freeLegacy(c);
+    delete n;
+}
+
+// exact-match walks on ASCII words: the old 26-way trie against the
+// write-buffer layout this was built with and the byte-indexed frozen trie
+void benchKeys(size_t n) {
+    mt19937 rng(13);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+    LegacyNode* legacy = new LegacyNode();
+    for (const string &w : words) {
+        LegacyNode* cur = legacy;
+        for (char c : w) {
+            if (!cur->child[c - 'a']) cur->child[c - 'a'] = new LegacyNode();
+            cur = cur->child[c - 'a'];
+        }
+        cur->isEnd = true;
+    }
+
+    BufferArena arena;
+    TrieNode* buffer = nullptr;
+    vector<TrieNode*> replaced;
+    bool isNew;
+    auto start = chrono::steady_clock::now();
+    for (const string &w : words) {
+        buffer = insertIntoBuffer(arena, buffer, w, "", 0, replaced, isNew);
+        for (TrieNode* r : replaced) freeBufferNode(arena, r);
+        replaced.clear();
+    }
+    double insertSec = secondsSince(start);
+    cout << BUFFER_LAYOUT << " buffer: " << countTrieNodes(buffer) << " nodes, " << fixed << setprecision(0)
+         << words.size() / insertSec << " path-copying inserts/s\n";
+
+    vector<string> queries = words;
+    for (size_t i = 0; i < n / 10; i++) queries.push_back(randomWord(rng) + "q");
+    shuffle(queries.begin(), queries.end(), rng);
+    cout << "words " << frozenWordCount() << ", queries " << queries.size() << "\n";
+
+    size_t hits = 0;
+    start = chrono::steady_clock::now();
+    for (const string &q : queries) {
+        LegacyNode* cur = legacy;
+        for (size_t i = 0; cur && i < q.size(); i++) cur = cur->child[q[i] - 'a'];
+        hits += cur && cur->isEnd;
+    }
+    printRate("legacy 26-way trie", queries.size(), secondsSince(start), hits);
+
+    hits = 0;
+    start = chrono::steady_clock::now();
+    for (const string &q : queries) hits += findInBuffer(buffer, q) != nullptr;
+    printRate(string(BUFFER_LAYOUT) + " buffer trie", queries.size(), secondsSince(start), hits);
+
+    vector<TrieEntry> all;
+    string current;
+    start = chrono::steady_clock::now();
+    collectTrieWords(buffer, current, all);
+    cout << "ordered walk of the buffer: " << setprecision(1) << secondsSince(start) * 1e3 << " ms\n";
+
+    hits = 0;
+    const DictState* st = dictState.load();
+    start = chrono::steady_clock::now();
+    for (const string &q : queries) {
+        FrozenTrie* ft = st->parts[partOf(q)];
+        hits += ft && frozenFind(ft, q.data() + 1, q.size() - 1) >= 0;
+    }
+    printRate("frozen double-array trie", queries.size(), secondsSince(start), hits);
+
+    size_t bytes = 0;
+    start = chrono::steady_clock::now();
+    for (const string &q : queries) bytes += normalizeWord(q).size();
+    printRate("normalizeWord alone", queries.size(), secondsSince(start), bytes);
+    hits = 0;
+    start = chrono::steady_clock::now();
+    for (const string &q : queries) hits += containsWord(q);
+    printRate("normalize + frozen lookup", queries.size(), secondsSince(start), hits);
+
+    freeLegacy(legacy);
+}
+
+// ======================= QUERY SERVER =======================
+
+#ifndef _WIN32
+int connectTo(const string &address) {
+    bool tcp = isPortNumber(address);
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int rc;
+    if (tcp) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)stoul(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        rc = connect(fd, (sockaddr*)&addr, sizeof(addr));
+    } else {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path) - 1);
+        rc = connect(fd, (sockaddr*)&addr, sizeof(addr));
+    }
+    if (rc != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// `clients` connections, each sending rounds of `depth` pipelined GETs and
+// waiting for all replies before the next round; latency is per round
+void loadgen(const string &address, const vector<string> &words, unsigned clients, size_t depth, size_t requests) {
+    atomic<size_t> hits{0}, failed{0};
+    vector<vector<double>> rounds(clients);
+    auto start = chrono::steady_clock::now();
+    runWorkers(clients, [&](unsigned t) {
+        int fd = connectTo(address);
+        if (fd < 0) {
+            failed++;
+            return;
+        }
+        mt19937 rng(t);
+        string req, reply;
+        char buf[64 << 10];
+        for (size_t done = 0; done < requests / clients; done += depth) {
+            req.clear();
+            for (size_t i = 0; i < depth; i++) req += "GET " + words[rng() % words.size()] + "\n";
+            auto roundStart = chrono::steady_clock::now();
+            for (size_t sent = 0; sent < req.size();) {
+                ssize_t n = write(fd, req.data() + sent, req.size() - sent);
+                if (n <= 0) break;
+                sent += n;
+            }
+            size_t lines = 0;
+            while (lines < depth) {
+                ssize_t n = read(fd, buf, sizeof(buf));
+                if (n <= 0) break;
+                lines += count(buf, buf + n, '\n');
+                reply.append(buf, n);
+            }
+            rounds[t].push_back(secondsSince(roundStart) * 1e6);
+            size_t ok = 0;
+            for (size_t at = 0; at < reply.size(); at = reply.find('\n', at) + 1) ok += reply.compare(at, 2, "OK") == 0;
+            hits += ok;
+            reply.clear();
+            if (lines < depth) {
+                failed++;
+                break;
+            }
+        }
+        close(fd);
+    });
+    double sec = secondsSince(start);
+    vector<double> all;
+    for (auto &r : rounds) all.insert(all.end(), r.begin(), r.end());
+    size_t total = all.size() * depth;
+    cout << setw(3) << clients << " clients, depth " << setw(4) << depth << ": " << fixed << setprecision(0)
+         << setw(9) << total / sec << " GETs/s, round p50 " << setprecision(1) << percentile(all, 0.5)
+         << " us, p99 " << percentile(all, 0.99) << " us (" << hits << " hits"
+         << (failed ? ", " + to_string(failed) + " clients failed" : string()) << ")\n";
+}
+#endif
+
+// an in-process server on a Unix socket, or a running one at `address`
+void benchServer(size_t n, const string &address) {
+#ifdef _WIN32
+    (void)n;
+    (void)address;
+    cout << "server benchmark needs POSIX sockets\n";
+#else
+    mt19937 rng(19);
+    vector<string> words;
+    string target = address;
+    thread server;
+    if (target.empty()) {
+        words = buildSyntheticDictionary(n, rng);
+        target = "bench.sock";
+        server = thread([&] {
+            string error;
+            if (!runServer(target, 0, error)) cout << "cannot serve: " << error << "\n";
+        });
+        for (int i = 0; i < 100; i++) {
+            int fd = connectTo(target);
+            if (fd >= 0) {
+                close(fd);
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        cout << "words " << frozenWordCount() << ", server on " << target << "\n";
+    } else {
+        for (size_t i = 0; i < n; i++) words.push_back(randomWord(rng));
+        cout << "random words against " << target << "\n";
+    }
+    size_t requests = max<size_t>(n, 200000);
+    for (unsigned clients : {1, 4, 16}) {
+        for (size_t depth : {1, 32, 256}) loadgen(target, words, clients, depth, clients == 1 && depth == 1 ? requests / 10 : requests);
+    }
+    if (server.joinable()) {
+        serverStop = true;
+        server.join();
+    }
+#endif
+}
+
+// ======================= CORE HOT PATHS =======================
+// Machine-readable: one JSON object per line, so runs from two builds can be
+// diffed or compared by a script, e.g. bench 200000 core real > before.jsonl
+
+// peak resident set of the whole process so far
+size_t peakRssBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return pmc.PeakWorkingSetSize;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss;
+#else
+    return (size_t)ru.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// printed when the temporary dies at the end of the statement that built it;
+// keys and string values are plain identifiers, so nothing needs escaping
+struct JsonRecord {
+    string body;
+    JsonRecord &field(const string &key, const string &value) {
+        if (!body.empty()) body += ",";
+        body += "\"" + key + "\":" + value;
+        return *this;
+    }
+    JsonRecord &str(const string &key, const string &value) { return field(key, "\"" + value + "\""); }
+    JsonRecord &num(const string &key, double value) {
+        ostringstream s;
+        if (value == floor(value) && fabs(value) < 1e15) s << (long long)value;
+        else s << fixed << setprecision(4) << value;
+        return field(key, s.str());
+    }
+    JsonRecord &latency(vector<double> &nanos) {
+        return num("p50_ns", percentile(nanos, 0.5)).num("p90_ns", percentile(nanos, 0.9))
+              .num("p99_ns", percentile(nanos, 0.99)).num("p999_ns", percentile(nanos, 0.999))
+              .num("max_ns", percentile(nanos, 1.0));
+    }
+    ~JsonRecord() { cout << "{" << body << "}\n"; }
+};
+
+double nanosSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// repeats f until a fifth of a second has passed, returns seconds per call
+template <class F>
+double secondsPerCall(F f) {
+    size_t calls = 0;
+    auto start = chrono::steady_clock::now();
+    do {
+        f();
+        calls++;
+    } while (secondsSince(start) < 0.2);
+    return secondsSince(start) / calls;
+}
+
+// n (word, meaning) pairs: random words, or the a.txt..z.txt lists stretched
+// to n entries by appending a letter suffix to each further round of them
+bool coreDataset(const string &source, size_t n, mt19937 &rng, vector<pair<string,string>> &out) {
+    out.clear();
+    out.reserve(n);
+    if (source == "synthetic") {
+        for (size_t i = 0; i < n; i++) {
+            string w = randomWord(rng);
+            out.push_back({w, "meaning of " + w});
+        }
+        return true;
+    }
+    vector<pair<string,string>> real;
+    for (char c = 'a'; c <= 'z'; c++) {
+        ifstream fin(string(1, c) + ".txt");
+        string line;
+        string_view word, meaning;
+        while (getline(fin, line)) {
+            if (parseLine(line, word, meaning)) real.push_back({string(word), string(meaning)});
+        }
+    }
+    if (real.empty()) return false;
+    for (size_t i = 0; i < n; i++) {
+        const pair<string,string> &p = real[i % real.size()];
+        string suffix;
+        for (size_t round = i / real.size(); round > 0; round = (round - 1) / 26) {
+            suffix.push_back('a' + (round - 1) % 26);
+        }
+        out.push_back({p.first + suffix, p.second});
+    }
+    return true;
+}
+
+size_t frozenBytesUsed() {
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+    size_t bytes = 0;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (st->parts[p]) bytes += st->parts[p]->bytesUsed();
+    }
+    return bytes;
+}
+
+size_t fileSize(const string &path) {
+    ifstream fin(path, ios::binary | ios::ate);
+    return fin ? (size_t)fin.tellg() : 0;
+}
+
+// the write paths run without a write-ahead log, so inserts are measured in memory
+void benchCore(size_t n, const string &source) {
+    mt19937 rng(17);
+    vector<pair<string,string>> data;
+    JsonRecord().str("bench", "config").str("data", source).num("n", n).str("buffer", BUFFER_LAYOUT)
+#ifdef __OPTIMIZE__
+        .num("optimized", 1);
+#else
+        .num("optimized", 0);
+#endif
+    if (!coreDataset(source, n, rng, data)) {
+        JsonRecord().str("bench", "config").str("error", "no word lists (a.txt..z.txt) found");
+        return;
+    }
+    shuffle(data.begin(), data.end(), rng);
+    size_t inserted = max<size_t>(1, data.size() / 10);
+    size_t bulk = data.size() - inserted;
+
+    // 1) bulk build of the first 90%
+    vector<TrieEntry> entries;
+    entries.reserve(bulk);
+    for (size_t i = 0; i < bulk; i++) entries.push_back({normalizeWord(data[i].first), data[i].second, 0});
+    auto start = chrono::steady_clock::now();
+    replaceDictionary(buildDictState(move(entries)));
+    double sec = secondsSince(start);
+    size_t words = frozenWordCount();
+    JsonRecord().str("bench", "build").str("data", source).num("n", bulk).num("ops_per_sec", bulk / sec)
+        .num("entries", words).num("bytes_per_entry", words ? (double)frozenBytesUsed() / words : 0);
+
+    // 2) the rest one at a time; freezes show up in the tail
+    vector<double> nanos;
+    nanos.reserve(inserted);
+    start = chrono::steady_clock::now();
+    for (size_t i = bulk; i < data.size(); i++) {
+        auto t = chrono::steady_clock::now();
+        insertIntoTrie(data[i].first, data[i].second);
+        nanos.push_back(nanosSince(t));
+    }
+    sec = secondsSince(start);
+    JsonRecord().str("bench", "insertIntoTrie").str("data", source).num("n", inserted)
+        .num("ops_per_sec", inserted / sec).latency(nanos);
+
+    // 3) lookups: every word once, then as many words that are not stored
+    vector<string> hits, misses;
+    hits.reserve(data.size());
+    for (auto &p : data) hits.push_back(p.first);
+    shuffle(hits.begin(), hits.end(), rng);
+    for (size_t i = 0; i < hits.size(); i++) misses.push_back(hits[i] + "qz" + randomWord(rng));
+    string meaning;
+    for (int miss = 0; miss < 2; miss++) {
+        const vector<string> &queries = miss ? misses : hits;
+        size_t found = 0;
+        nanos.clear();
+        start = chrono::steady_clock::now();
+        for (const string &q : queries) {
+            auto t = chrono::steady_clock::now();
+            found += searchInTrie(q, meaning);
+            nanos.push_back(nanosSince(t));
+        }
+        sec = secondsSince(start);
+        JsonRecord().str("bench", miss ? "searchInTrie_miss" : "searchInTrie_hit").str("data", source)
+            .num("n", queries.size()).num("ops_per_sec", queries.size() / sec).num("found", found).latency(nanos);
+    }
+
+    // 4) ordered walks: a write buffer holding every word, then the whole dictionary
+    unique_ptr<BufferArena> arena(new BufferArena());
+    TrieNode* buffer = nullptr;
+    vector<TrieNode*> replaced;
+    bool isNew;
+    for (auto &p : data) {
+        buffer = insertIntoBuffer(*arena, buffer, normalizeWord(p.first), p.second, 0, replaced, isNew);
+        for (TrieNode* r : replaced) freeBufferNode(*arena, r);
+        replaced.clear();
+    }
+    vector<TrieEntry> walked;
+    sec = secondsPerCall([&] {
+        string current;
+        walked.clear();
+        collectTrieWords(buffer, current, walked);
+    });
+    JsonRecord().str("bench", "collectTrieWords").str("data", source).num("n", walked.size())
+        .num("ops_per_sec", walked.size() / sec).num("nodes", countTrieNodes(buffer));
+    size_t arenaBytes = arena->reserved;
+    start = chrono::steady_clock::now();
+    arena.reset();
+    JsonRecord().str("bench", "buffer_teardown").str("data", source).num("n", walked.size())
+        .num("arena_bytes", arenaBytes).num("ns", nanosSince(start));
+
+    vector<pair<string,string>> all;
+    sec = secondsPerCall([&] {
+        all.clear();
+        collectAllWords(all);
+    });
+    JsonRecord().str("bench", "collectAllWords").str("data", source).num("n", all.size())
+        .num("ops_per_sec", all.size() / sec);
+
+    words = all.size();
+
+    // 5) Huffman over the text a snapshot is made of
+    string text;
+    for (auto &p : all) text += p.first + " - " + p.second + "\n";
+    HuffmanCode hc;
+    sec = secondsPerCall([&] { hc = buildHuffmanCode(text); });
+    double mb = text.size() / 1e6;
+    JsonRecord().str("bench", "buildHuffmanCode").str("data", source).num("bytes", text.size())
+        .num("mb_per_sec", mb / sec);
+    string packed, decoded;
+    sec = secondsPerCall([&] {
+        packed.clear();
+        huffmanEncode(hc, text.data(), text.size(), packed);
+    });
+    JsonRecord().str("bench", "huffmanEncode").str("data", source).num("bytes", text.size())
+        .num("mb_per_sec", mb / sec).num("ratio", (double)packed.size() / text.size());
+    bool ok = true;
+    sec = secondsPerCall([&] {
+        decoded.clear();
+        ok = ok && huffmanDecode(hc, packed.data(), packed.size(), text.size(), decoded);
+    });
+    JsonRecord().str("bench", "huffmanDecode").str("data", source).num("bytes", text.size())
+        .num("mb_per_sec", mb / sec).num("roundtrip", ok && decoded == text);
+    // the chunked stream a partition file holds, on 1, 2, 4 .. all cores
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        string stream;
+        sec = secondsPerCall([&] { stream = encodeHuffStream(text, threads); });
+        JsonRecord().str("bench", "huff_stream_encode").str("data", source).num("bytes", text.size())
+            .num("threads", threads).num("mb_per_sec", mb / sec);
+        sec = secondsPerCall([&] { ok = ok && decodeHuffStream(stream, decoded, threads); });
+        JsonRecord().str("bench", "huff_stream_decode").str("data", source).num("bytes", text.size())
+            .num("threads", threads).num("mb_per_sec", mb / sec).num("roundtrip", ok && decoded == text);
+        if (threads * 2 > cores && threads != cores) threads = cores / 2;
+    }
+
+    // 6) full save/load cycles, to files of their own
+    const string huffPath = "bench.huff", imagePath = "bench.img";
+    string error;
+    sec = secondsPerCall([&] { ok = writeCompressedDictionary(huffPath, error, true); });
+    HuffManifest manifest;
+    string raw;
+    size_t bytes = fileSize(huffPath);
+    if (readWholeFile(huffPath, raw) && parseHuffManifest(raw, manifest)) {
+        for (auto &part : manifest.parts) bytes += part.bytes;
+    }
+    JsonRecord().str("bench", "huff_save").str("data", source).num("n", words).num("ops_per_sec", 1 / sec)
+        .num("file_bytes", bytes).num("bytes_per_entry", words ? (double)bytes / words : 0).num("ok", ok);
+    // a one-word edit only re-encodes the partition holding that word
+    size_t edits = 0;
+    sec = secondsPerCall([&] {
+        insertIntoTrie(data[edits++ % data.size()].first, "edited");
+        ok = ok && writeCompressedDictionary(huffPath, error);
+    });
+    JsonRecord().str("bench", "huff_save_one_edit").str("data", source).num("n", words)
+        .num("ops_per_sec", 1 / sec).num("ok", ok);
+    sec = secondsPerCall([&] { ok = readCompressedDictionary(huffPath, error); });
+    JsonRecord().str("bench", "huff_load").str("data", source).num("n", frozenWordCount())
+        .num("ops_per_sec", 1 / sec).num("ok", ok);
+    sec = secondsPerCall([&] { ok = writeDictionaryImage(imagePath); });
+    bytes = fileSize(imagePath);
+    JsonRecord().str("bench", "image_save").str("data", source).num("n", words).num("ops_per_sec", 1 / sec)
+        .num("file_bytes", bytes).num("bytes_per_entry", words ? (double)bytes / words : 0).num("ok", ok);
+    sec = secondsPerCall([&] { ok = mapDictionaryImage(imagePath, true, error); });
+    JsonRecord().str("bench", "image_load").str("data", source).num("n", frozenWordCount())
+        .num("ops_per_sec", 1 / sec).num("ok", ok);
+    // what a -DDICT_EMBEDDED build does at startup: adopt an image already in memory
+    string embedded;
+    encodeDictionaryImage(embedded);
+    sec = secondsPerCall([&] {
+        auto mf = make_shared<MappedFile>();
+        mf->data = embedded.data();
+        mf->size = embedded.size();
+        mf->borrowed = true;
+        ok = adoptDictionaryImage(mf, false, error);
+    });
+    JsonRecord().str("bench", "image_adopt_embedded").str("data", source).num("n", frozenWordCount())
+        .num("ops_per_sec", 1 / sec).num("ok", ok);
+    // lazy open: cold start reads the manifest only, the first lookup decodes one partition
+    sec = secondsPerCall([&] { ok = ok && openCompressedDictionary(huffPath, error); });
+    start = chrono::steady_clock::now();
+    searchInTrie(data[0].first, meaning);
+    JsonRecord().str("bench", "huff_open_lazy").str("data", source).num("n", frozenWordCount())
+        .num("ops_per_sec", 1 / sec).num("first_lookup_ns", nanosSince(start)).num("ok", ok);
+
+    if (readWholeFile(huffPath, raw) && parseHuffManifest(raw, manifest)) {
+        for (int p = 0; p < FROZEN_PARTS; p++) {
+            if (manifest.parts[p].generation) remove(huffPartPath(huffPath, p, manifest.parts[p].generation).c_str());
+        }
+    }
+    remove(huffPath.c_str());
+    remove(imagePath.c_str());
+
+    // peak of the whole run, so run core on its own to attribute it
+    size_t rss = peakRssBytes();
+    JsonRecord().str("bench", "memory").str("data", source).num("n", words).num("peak_rss_bytes", rss)
+        .num("rss_bytes_per_entry", words ? (double)rss / words : 0);
+}
+
+// ======================= STREAMING =======================
+
+// a token file of dictionary words and 10% misses, annotated the old way
+// (getline, searchInTrie, iostream per word) and through streamLookups
+void benchStream(size_t n) {
+    mt19937 rng(23);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+    const string tokensPath = "bench.tokens", outPath = "bench.out";
+    size_t tokens = max<size_t>(n * 5, 1000000);
+    {
+        string text;
+        for (size_t i = 0; i < tokens; i++) {
+            text += i % 10 == 9 ? randomWord(rng) + "q" : words[rng() % words.size()];
+            text += i % 4 == 3 ? '\t' : '\n';
+        }
+        ofstream(tokensPath, ios::binary) << text;
+    }
+    double mb = fileSize(tokensPath) / 1e6;
+    cout << "words " << frozenWordCount() << ", " << tokens << " tokens, " << fixed << setprecision(1) << mb << " MB\n";
+
+    auto start = chrono::steady_clock::now();
+    {
+        ifstream fin(tokensPath);
+        ofstream fout(outPath);
+        string line, meaning;
+        while (getline(fin, line)) {
+            stringstream ss(line);
+            for (string w; getline(ss, w, '\t');) {
+                if (searchInTrie(w, meaning)) fout << w << "\t" << meaning << "\n";
+                else fout << w << "\t\n";
+            }
+        }
+    }
+    double sec = secondsSince(start);
+    cout << left << setw(32) << "per-word iostream loop" << right << setw(8) << setprecision(1) << mb / sec
+         << " MB/s " << setw(12) << setprecision(0) << tokens / sec << " tokens/s\n";
+    size_t baseline = fileSize(outPath);
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        FILE* in = fopen(tokensPath.c_str(), "rb");
+        FILE* out = fopen(outPath.c_str(), "wb");
+        start = chrono::steady_clock::now();
+        bool ok = in && out && streamLookups(in, out, threads);
+        if (in) fclose(in);
+        if (out) fclose(out);
+        sec = secondsSince(start);
+        cout << left << setw(32) << "streamLookups, " + to_string(threads) + " threads" << right << setw(8)
+             << setprecision(1) << mb / sec << " MB/s " << setw(12) << setprecision(0) << tokens / sec
+             << " tokens/s" << (ok && fileSize(outPath) == baseline ? "" : "  (output differs)") << "\n";
+        if (threads * 2 > cores && threads != cores) threads = cores / 2;
+    }
+    remove(tokensPath.c_str());
+    remove(outPath.c_str());
+}
+
+// ======================= ALLOCATIONS =======================
+
+// lookups must not touch the heap once the per-thread buffers have grown;
+// returns false (and bench exits with 1) if any of them does
+bool benchAllocations(size_t n) {
+    mt19937 rng(29);
+    vector<string> words = buildSyntheticDictionary(n, rng);
+    // some words in the write buffer too, so both halves of a lookup run
+    for (size_t i = 0; i < min<size_t>(n / 10, 1000); i++) insertIntoTrie(words[i] + "x", "buffered meaning");
+    vector<string> queries = words;
+    for (size_t i = 0; i < min<size_t>(n / 10, 1000); i++) queries.push_back(words[i] + "x");
+    for (size_t i = 0; i < n / 10; i++) queries.push_back(randomWord(rng) + "q");
+    shuffle(queries.begin(), queries.end(), rng);
+    vector<string_view> views(queries.begin(), queries.end());
+
+    const size_t BATCH = 4096;
+    string meaning;
+    vector<char> found;
+    vector<string> meanings;
+    size_t hits = 0;
+    bool ok = true;
+    auto run = [&](const char* label, auto lookups) {
+        lookups();   // warm-up: grows the reused buffers to their working size
+        allocationCount = 0;
+        countAllocations = true;
+        auto start = chrono::steady_clock::now();
+        lookups();
+        double sec = secondsSince(start);
+        countAllocations = false;
+        size_t allocs = allocationCount;
+        cout << left << setw(32) << label << right << setw(12) << fixed << setprecision(0) << queries.size() / sec
+             << " lookups/s, " << allocs << " allocations (" << setprecision(3)
+             << (double)allocs / queries.size() << " per lookup)\n";
+        if (allocs) ok = false;
+    };
+    run("searchInTrie", [&] {
+        for (string_view q : views) hits += searchInTrie(q, meaning);
+    });
+    run("searchInTrieBatch", [&] {
+        for (size_t i = 0; i < views.size(); i += BATCH) {
+            searchInTrieBatch(views.data() + i, min(BATCH, views.size() - i), found, &meanings);
+        }
+    });
+    run("searchInTrieBatch (no meaning)", [&] {
+        for (size_t i = 0; i < views.size(); i += BATCH) {
+            searchInTrieBatch(views.data() + i, min(BATCH, views.size() - i), found, nullptr);
+        }
+    });
+    cout << (ok ? "PASS" : "FAIL") << ": lookups are allocation-free (" << hits / 2 << " hits per pass)\n";
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = argc > 1 ? stoul(argv[1]) : 1000000;
+    string which = argc > 2 ? argv[2] : "all";
+    string source = argc > 3 ? argv[3] : "synthetic";
+    if (which == "all" || which == "batch") benchBatchLookup(n);
+    if (which == "all" || which == "cache") benchCache(n);
+    if (which == "all" || which == "autocomplete") benchAutocomplete(n);
+    if (which == "all" || which == "fuzzy") benchFuzzy(n);
+    if (which == "all" || which == "reverse") benchReverse(n);
+    if (which == "all" || which == "load") benchLoad(n);
+    if (which == "all" || which == "wal") benchWal(n);
+    if (which == "all" || which == "churn") benchChurn(n);
+    if (which == "all" || which == "keys") benchKeys(n);
+    if (which == "core") benchCore(n, source);
+    if (which == "all" || which == "stream") benchStream(n);
+    bool allocationFree = true;
+    if (which == "all" || which == "allocs") allocationFree = benchAllocations(n);
+    if (which == "serve") benchServer(n, argc > 3 ? argv[3] : "");
+    clearDictionary();
+    return allocationFree ? 0 : 1;
+}
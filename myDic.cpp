@@ -1,178 +1,3778 @@
 #include <bits/stdc++.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 using namespace std;
 
+// ======================= METRICS SECTION =======================
+// Counters and latency histograms for the hot paths. Every thread bumps its
+// own block with plain relaxed loads and stores (no locked instruction, no
+// shared cache line) and a reader sums the blocks of live threads plus what
+// exited threads left behind. Lookups are timed one in METRIC_SAMPLE_RATE,
+// everything slower every time. Histogram bucket b counts durations below
+// 2^b ns. Building with -DMYDIC_NO_METRICS compiles the instrumentation out.
+
+enum MetricCounter : uint8_t {
+    MC_LOOKUPS, MC_LOOKUP_HITS, MC_BATCH_WORDS, MC_BATCH_HITS, MC_INSERTS, MC_FREEZES,
+    MC_HUFF_ENCODED_BYTES, MC_HUFF_DECODED_BYTES, MC_PARTITION_DECODES, MC_PARTITION_EVICTIONS,
+    MC_DELETES, MC_UPDATES, MC_COMPACTIONS, MC_REVERSE_LOOKUPS, MC_CACHE_HITS, MC_CACHE_MISSES,
+    METRIC_COUNTERS
+};
+
+enum MetricHistogram : uint8_t {
+    MH_LOOKUP, MH_INSERT, MH_FREEZE, MH_HUFF_ENCODE, MH_HUFF_DECODE, MH_PARTITION_DECODE,
+    MH_SNAPSHOT_SAVE, MH_SNAPSHOT_LOAD, MH_IMAGE_SAVE, MH_IMAGE_LOAD, MH_DELETE, MH_COMPACT,
+    MH_REVERSE_LOOKUP,
+    METRIC_HISTOGRAMS
+};
+
+// Prometheus names, without the dict_ prefix
+const char* const COUNTER_NAMES[METRIC_COUNTERS] = {
+    "lookups_total", "lookup_hits_total", "batch_words_total", "batch_hits_total", "inserts_total",
+    "freezes_total", "huffman_encoded_bytes_total", "huffman_decoded_bytes_total",
+    "partition_decodes_total", "partition_evictions_total", "deletes_total", "updates_total",
+    "buffer_compactions_total", "reverse_lookups_total", "lookup_cache_hits_total",
+    "lookup_cache_misses_total",
+};
+const char* const HISTOGRAM_NAMES[METRIC_HISTOGRAMS] = {
+    "lookup_seconds", "insert_seconds", "freeze_seconds", "huffman_encode_seconds",
+    "huffman_decode_seconds", "partition_decode_seconds", "snapshot_save_seconds",
+    "snapshot_load_seconds", "image_save_seconds", "image_load_seconds", "delete_seconds",
+    "buffer_compaction_seconds", "reverse_lookup_seconds",
+};
+
+const int HIST_BUCKETS = 36;          // the last one also holds everything above 2^35 ns
+const uint32_t METRIC_SAMPLE_RATE = 16;
+
+struct MetricsBlock {
+    atomic<uint64_t> counters[METRIC_COUNTERS];
+    atomic<uint64_t> buckets[METRIC_HISTOGRAMS][HIST_BUCKETS];
+    atomic<uint64_t> sumNs[METRIC_HISTOGRAMS];
+    uint32_t sampleTick;          // owner only
+};
+
+// a point-in-time sum over all threads
+struct MetricsSnapshot {
+    uint64_t counters[METRIC_COUNTERS] = {};
+    uint64_t buckets[METRIC_HISTOGRAMS][HIST_BUCKETS] = {};
+    uint64_t sumNs[METRIC_HISTOGRAMS] = {};
+
+    void add(const MetricsBlock &b) {
+        for (int c = 0; c < METRIC_COUNTERS; c++) counters[c] += b.counters[c].load(memory_order_relaxed);
+        for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+            for (int i = 0; i < HIST_BUCKETS; i++) buckets[h][i] += b.buckets[h][i].load(memory_order_relaxed);
+            sumNs[h] += b.sumNs[h].load(memory_order_relaxed);
+        }
+    }
+
+    uint64_t count(MetricHistogram h) const {
+        uint64_t n = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++) n += buckets[h][i];
+        return n;
+    }
+
+    // upper bound in ns of the bucket holding quantile q, 0 if nothing was timed
+    uint64_t quantileNs(MetricHistogram h, double q) const {
+        uint64_t n = count(h), seen = 0;
+        for (int i = 0; i < HIST_BUCKETS && n; i++) {
+            seen += buckets[h][i];
+            if (seen >= q * n) return 1ULL << i;
+        }
+        return 0;
+    }
+};
+
+mutex metricsMutex;
+vector<MetricsBlock*> liveMetrics;    // guarded by metricsMutex
+MetricsSnapshot exitedMetrics;        // guarded by metricsMutex
+
+// registers the calling thread's block on first use and folds it into
+// exitedMetrics when the thread ends
+struct ThreadMetrics {
+    MetricsBlock* block = nullptr;
+
+    ~ThreadMetrics() {
+        if (!block) return;
+        lock_guard<mutex> lock(metricsMutex);
+        exitedMetrics.add(*block);
+        liveMetrics.erase(find(liveMetrics.begin(), liveMetrics.end(), block));
+        delete block;
+    }
+};
+
+thread_local ThreadMetrics threadMetrics;
+// a plain pointer, so the hot path skips the guard a thread_local with a
+// destructor costs on every access
+thread_local MetricsBlock* threadMetricsBlock = nullptr;
+
+MetricsBlock* registerThreadMetrics() {
+    MetricsBlock* b = new MetricsBlock();
+    {
+        lock_guard<mutex> lock(metricsMutex);
+        liveMetrics.push_back(b);
+    }
+    threadMetrics.block = b;
+    threadMetricsBlock = b;
+    return b;
+}
+
+inline MetricsBlock* metricsBlock() {
+    MetricsBlock* b = threadMetricsBlock;
+    return b ? b : registerThreadMetrics();
+}
+
+MetricsSnapshot readMetrics() {
+    lock_guard<mutex> lock(metricsMutex);
+    MetricsSnapshot s = exitedMetrics;
+    for (MetricsBlock* b : liveMetrics) s.add(*b);
+    return s;
+}
+
+#ifndef MYDIC_NO_METRICS
+const bool METRICS_ENABLED = true;
+
+// only the owning thread writes a block, so no read-modify-write is needed
+inline void bumpMetric(atomic<uint64_t> &a, uint64_t n) {
+    a.store(a.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+inline void countMetric(MetricCounter c, uint64_t n = 1) {
+    bumpMetric(metricsBlock()->counters[c], n);
+}
+
+inline void recordLatency(MetricHistogram h, uint64_t ns) {
+    MetricsBlock* b = metricsBlock();
+    int bucket = min(ns ? 64 - __builtin_clzll(ns) : 0, HIST_BUCKETS - 1);
+    bumpMetric(b->buckets[h][bucket], 1);
+    bumpMetric(b->sumNs[h], ns);
+}
+
+// times its scope into h; a sampled timer times one scope in METRIC_SAMPLE_RATE
+struct MetricTimer {
+    MetricHistogram histogram;
+    bool on;
+    chrono::steady_clock::time_point start;
+
+    MetricTimer(MetricHistogram h, bool sampled = false)
+        : histogram(h), on(!sampled || ++metricsBlock()->sampleTick % METRIC_SAMPLE_RATE == 0) {
+        if (on) start = chrono::steady_clock::now();
+    }
+    ~MetricTimer() {
+        if (!on) return;
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        recordLatency(histogram, (uint64_t)ns);
+    }
+};
+#else
+const bool METRICS_ENABLED = false;
+
+inline void countMetric(MetricCounter, uint64_t = 1) {}
+
+struct MetricTimer {
+    MetricTimer(MetricHistogram, bool = false) {}
+};
+#endif
+
 // ======================= TRIE SECTION =======================
+// Keys are case-folded UTF-8 byte strings, so a node can have up to 255
+// children. The trie here is the write buffer for recent inserts; the bulk
+// of the dictionary lives in the frozen tries below.
 
-struct TrieNode {
-    TrieNode* child[26];
-    bool isEnd;
+// one word as it moves between the buffer, the frozen trie and files
+struct TrieEntry {
+    string key;
     string meaning;
+    uint32_t weight;
+    bool erased = false;        // a buffered delete, hiding the word's frozen copy
+};
+
+// ----- key normalization -----
+// Letters and digits of any script are kept, case folded. A run of spaces,
+// hyphens or apostrophes between two of them is kept as one character (a
+// space if the run has one), so "co-op" and "coop" stay different words.
+// Everything else, including malformed UTF-8, is dropped.
 
-    TrieNode() {
-        isEnd = false;
-        meaning = "";
-        for (int i = 0; i < 26; i++) child[i] = nullptr;
+// simple (one to one) case folding for Latin, Greek, Cyrillic and Armenian
+uint32_t foldCase(uint32_t cp) {
+    if (cp < 0x80) return (cp >= 'A' && cp <= 'Z') ? cp + 32 : cp;
+    if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) return cp + 32;
+    if (cp >= 0x100 && cp <= 0x17F) {
+        if (cp == 0x130 || cp == 0x131 || cp == 0x138 || cp == 0x149) return cp;
+        if (cp == 0x178) return 0xFF;
+        if (cp == 0x17F) return 's';
+        bool oddUpper = (cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E);
+        return (cp % 2 == (oddUpper ? 1u : 0u)) ? cp + 1 : cp;
     }
-};
+    if (cp == 0x386) return 0x3AC;
+    if (cp >= 0x388 && cp <= 0x38A) return cp + 37;
+    if (cp == 0x38C) return 0x3CC;
+    if (cp == 0x38E || cp == 0x38F) return cp + 63;
+    if (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) return cp + 32;
+    if (cp == 0x3C2) return 0x3C3;
+    if (cp >= 0x400 && cp <= 0x40F) return cp + 80;
+    if (cp >= 0x410 && cp <= 0x42F) return cp + 32;
+    if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF)) return cp | 1;
+    if (cp >= 0x531 && cp <= 0x556) return cp + 48;
+    if ((cp >= 0x1E00 && cp <= 0x1E95) || (cp >= 0x1EA0 && cp <= 0x1EFF)) return cp | 1;
+    if (cp >= 0xFF21 && cp <= 0xFF3A) return cp + 32;
+    return cp;
+}
+
+// 0 if cp is dropped, ' ' / '-' / '\'' if it joins two parts of a word,
+// 1 if it is part of the word itself
+int wordCharClass(uint32_t cp) {
+    if (cp < 0x80) {
+        if (isalnum((int)cp)) return 1;
+        if (cp == '-' || cp == '\'') return (int)cp;
+        return isspace((int)cp) ? ' ' : 0;
+    }
+    if (cp == 0xA0 || cp == 0x3000) return ' ';
+    if (cp >= 0x2010 && cp <= 0x2015) return '-';
+    if (cp == 0x2018 || cp == 0x2019) return '\'';
+    // Latin-1 and general punctuation, symbols
+    if ((cp >= 0x80 && cp <= 0xBF) || cp == 0xD7 || cp == 0xF7) return 0;
+    if (cp >= 0x2000 && cp <= 0x206F) return 0;
+    return 1;
+}
+
+// decodes one code point at p (advancing it); returns false for a bad sequence
+bool nextCodePoint(const unsigned char* &p, const unsigned char* end, uint32_t &cp) {
+    unsigned char b = *p++;
+    if (b < 0x80) {
+        cp = b;
+        return true;
+    }
+    int extra = b >= 0xF0 && b <= 0xF4 ? 3 : b >= 0xE0 ? 2 : b >= 0xC2 && b < 0xE0 ? 1 : -1;
+    if (extra < 0 || end - p < extra) return false;
+    cp = b & (0x3F >> extra);
+    for (int i = 0; i < extra; i++) {
+        if ((p[i] & 0xC0) != 0x80) return false;
+        cp = cp << 6 | (p[i] & 0x3F);
+    }
+    static const uint32_t minimum[4] = {0, 0x80, 0x800, 0x10000};
+    if (cp < minimum[extra] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return false;
+    p += extra;
+    return true;
+}
 
-TrieNode* trieRoot = new TrieNode();
+template<class Out>
+void appendUtf8(uint32_t cp, Out &out) {
+    if (cp < 0x80) {
+        out.push_back((char)cp);
+    } else if (cp < 0x800) {
+        out.push_back((char)(0xC0 | cp >> 6));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char)(0xE0 | cp >> 12));
+        out.push_back((char)(0x80 | (cp >> 6 & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char)(0xF0 | cp >> 18));
+        out.push_back((char)(0x80 | (cp >> 12 & 0x3F)));
+        out.push_back((char)(0x80 | (cp >> 6 & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+}
 
-// convert word to lowercase and keep only a-z
-string normalizeWord(const string &w) {
-    string res;
-    for (char c : w) {
-        if (isalpha((unsigned char)c)) {
-            res.push_back(tolower(c));
+// appends the normalized key of w to out (a string or a KeyBuffer)
+template<class Out>
+void appendNormalized(string_view w, Out &out) {
+    size_t start = out.size();
+    char joiner = 0;
+    const unsigned char* p = (const unsigned char*)w.data();
+    const unsigned char* end = p + w.size();
+    while (p < end) {
+        uint32_t cp;
+        if (!nextCodePoint(p, end, cp)) continue;
+        int cls = wordCharClass(cp);
+        if (cls == 0) continue;
+        if (cls != 1) {
+            if (cls == ' ' || !joiner) joiner = (char)cls;
+            continue;
         }
+        if (joiner && out.size() > start) out.push_back(joiner);
+        joiner = 0;
+        if (cp < 0x80) out.push_back((char)foldCase(cp));
+        else appendUtf8(foldCase(cp), out);
     }
+}
+
+string normalizeWord(string_view w) {
+    string res;
+    appendNormalized(w, res);
     return res;
 }
 
-void insertIntoTrie(const string &wordRaw, const string &meaning) {
-    string word = normalizeWord(wordRaw);
-    if (word.empty()) return;
-    TrieNode* curr = trieRoot;
-    for (char c : word) {
-        int idx = c - 'a';
-        if (!curr->child[idx]) curr->child[idx] = new TrieNode();
-        curr = curr->child[idx];
+// ----- meaning terms -----
+// Reverse lookups match the words of meanings: runs of letters and digits,
+// case folded like keys. Anything else (spaces, hyphens, punctuation) ends
+// a term, so "well-being" is the two terms "well" and "being".
+
+// folded ASCII letters and digits, 0 for every other ASCII byte
+struct AsciiTermTable {
+    char fold[128];
+    AsciiTermTable() {
+        for (uint32_t c = 0; c < 128; c++) fold[c] = wordCharClass(c) == 1 ? (char)foldCase(c) : 0;
+    }
+};
+
+// calls f(term) for every term of text, in order; term is a view into text
+// or scratch, valid until the next call
+template<class F>
+void forEachTerm(string_view text, string &scratch, F f) {
+    static const AsciiTermTable ascii;
+    scratch.clear();
+    const unsigned char* p = (const unsigned char*)text.data();
+    const unsigned char* end = p + text.size();
+    while (p < end) {
+        if (*p < 0x80) {
+            const unsigned char* run = p;
+            bool folded = true;
+            while (p < end && *p < 0x80 && ascii.fold[*p]) {
+                folded &= ascii.fold[*p] == (char)*p;
+                p++;
+            }
+            if (p > run) {
+                // a whole term already in folded form is passed without copying
+                if (scratch.empty() && folded && (p == end || *p < 0x80)) {
+                    f(string_view((const char*)run, p - run));
+                } else {
+                    for (; run < p; run++) scratch.push_back(ascii.fold[*run]);
+                }
+                continue;
+            }
+            p++;
+        } else {
+            uint32_t cp;
+            if (!nextCodePoint(p, end, cp)) continue;
+            if (wordCharClass(cp) == 1) {
+                appendUtf8(foldCase(cp), scratch);
+                continue;
+            }
+        }
+        if (!scratch.empty()) {
+            f(string_view(scratch));
+            scratch.clear();
+        }
+    }
+    if (!scratch.empty()) f(string_view(scratch));
+}
+
+// the distinct terms of text, sorted
+vector<string> termsOf(string_view text) {
+    vector<string> terms;
+    string scratch;
+    forEachTerm(text, scratch, [&](string_view t) { terms.emplace_back(t); });
+    sort(terms.begin(), terms.end());
+    terms.erase(unique(terms.begin(), terms.end()), terms.end());
+    return terms;
+}
+
+// ----- senses -----
+// A word can have several senses. They are kept in its one meaning string,
+// in the order they were added, separated by SENSE_SEPARATOR (the ASCII unit
+// separator), so tries, snapshots, images and the log store them as they
+// store any meaning. A "Word - Meaning." file gives a word more senses by
+// listing it again.
+
+const char SENSE_SEPARATOR = '\x1f';
+
+vector<string_view> splitSenses(string_view meaning) {
+    vector<string_view> senses;
+    while (true) {
+        size_t cut = meaning.find(SENSE_SEPARATOR);
+        senses.push_back(meaning.substr(0, cut));
+        if (cut == string_view::npos) return senses;
+        meaning.remove_prefix(cut + 1);
+    }
+}
+
+// appends the senses of `more` that meaning does not have yet; returns
+// false if there were none
+bool mergeSenses(string &meaning, string_view more) {
+    vector<string_view> have = splitSenses(meaning);
+    vector<string_view> fresh;
+    for (string_view sense : splitSenses(more)) {
+        if (sense.empty() || find(have.begin(), have.end(), sense) != have.end() ||
+            find(fresh.begin(), fresh.end(), sense) != fresh.end()) {
+            continue;
+        }
+        fresh.push_back(sense);
+    }
+    for (string_view sense : fresh) {
+        if (!meaning.empty()) meaning.push_back(SENSE_SEPARATOR);
+        meaning.append(sense);
+    }
+    return !fresh.empty();
+}
+
+// A normalized key held on the stack, so lookups do not allocate; only keys
+// longer than KEY_INLINE bytes move to the heap.
+const size_t KEY_INLINE = 256;
+
+struct KeyBuffer {
+    char bytes[KEY_INLINE];
+    size_t len = 0;
+    string spill;   // used instead of bytes once the key outgrows them
+
+    KeyBuffer() {}
+    explicit KeyBuffer(string_view raw) { appendNormalized(raw, *this); }
+
+    void push_back(char c) {
+        if (len < KEY_INLINE) {
+            bytes[len++] = c;
+            return;
+        }
+        if (spill.empty()) spill.assign(bytes, len);
+        spill.push_back(c);
+        len++;
+    }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    string_view view() const { return len <= KEY_INLINE ? string_view(bytes, len) : string_view(spill); }
+};
+
+// ----- write buffer memory -----
+// Every node of one buffer generation, and the meanings and key bytes they
+// point to, come from that generation's BufferArena: bump-allocated from
+// large blocks, with a free list per size class so nodes retired by path
+// copying are reused by later inserts. Nothing is freed one by one; the
+// arena goes away in one step when the last state using it is retired
+// (after the buffer is frozen or compacted, or the dictionary replaced). The
+// arena is only used under writerMutex, which is also where retired nodes
+// come back. Meanings overwritten or deleted are never reused; they and the
+// free lists are the arena's waste, which compaction drops.
+
+const size_t ARENA_BLOCK_BYTES = 64 << 10;
+const size_t ARENA_SIZE_CLASSES = 256;   // 16-byte steps up to 4 KB
+
+struct BufferArena {
+    vector<char*> blocks;
+    char* cur = nullptr;
+    size_t left = 0;
+    void* freeList[ARENA_SIZE_CLASSES] = {};
+    size_t reserved = 0;                      // bytes taken from the heap
+    size_t freeBytes = 0;                     // on the free lists
+    size_t garbage = 0;                       // meanings no node points to any more
+
+    size_t waste() const { return freeBytes + garbage; }
+
+    BufferArena() {}
+    BufferArena(const BufferArena&) = delete;
+    BufferArena &operator=(const BufferArena&) = delete;
+    ~BufferArena() {
+        for (char* b : blocks) ::operator delete(b);
+    }
+
+    static size_t roundUp(size_t size) { return (max<size_t>(size, 1) + 15) & ~(size_t)15; }
+
+    // 16-byte aligned
+    void* allocate(size_t size) {
+        size = roundUp(size);
+        size_t cls = size / 16 - 1;
+        if (cls < ARENA_SIZE_CLASSES && freeList[cls]) {
+            void* p = freeList[cls];
+            freeList[cls] = *(void**)p;
+            freeBytes -= size;
+            return p;
+        }
+        if (size > left) {
+            size_t blockSize = max(ARENA_BLOCK_BYTES, size);
+            blocks.push_back((char*)::operator new(blockSize));
+            reserved += blockSize;
+            if (blockSize > ARENA_BLOCK_BYTES) return blocks.back();   // a block of its own
+            cur = blocks.back();
+            left = blockSize;
+        }
+        void* p = cur;
+        cur += size;
+        left -= size;
+        return p;
+    }
+
+    // hands back memory allocate(size) returned, for reuse
+    void release(void* p, size_t size) {
+        size_t cls = roundUp(size) / 16 - 1;
+        if (!p || cls >= ARENA_SIZE_CLASSES) return;
+        *(void**)p = freeList[cls];
+        freeList[cls] = p;
+        freeBytes += roundUp(size);
+    }
+
+    string_view copy(string_view s) {
+        if (s.empty()) return string_view();
+        char* p = (char*)allocate(s.size());
+        memcpy(p, s.data(), s.size());
+        return string_view(p, s.size());
+    }
+
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+        static_assert(is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T))) T(forward<Args>(args)...);
+    }
+};
+
+// ----- write buffer nodes -----
+// Two layouts with the same operations: findInBuffer, collectTrieWords,
+// collectBufferPrefix, insertIntoBuffer, eraseFromBuffer, compactBuffer and
+// freeBufferNode.
+// Build with -DUSE_RADIX_TRIE for the adaptive radix tree; the default is
+// one node per key byte with sparse children.
+//
+// Published tries are never modified. An insert or erase copies the nodes
+// on the word's path (sharing every other subtree) and returns the new root;
+// the nodes it replaced are handed back so they can be reused once no reader
+// can still be using them. Meanings and key bytes are shared by every copy
+// of a node, so only the nodes themselves are recycled.
+//
+// A deleted word that is also frozen stays in the buffer as a tombstone
+// (isEnd and erased both set) until the next freeze drops it from its
+// partition; findInBuffer returns tombstones, so callers check erased. A
+// word that is only buffered is unlinked, pruning nodes left without words.
+
+#ifdef USE_RADIX_TRIE
+// Adaptive radix tree (ART). Every node holds the compressed edge (prefix)
+// between its parent's label and itself, so a chain of single children is
+// one node. Children come in four sizes, grown as they fill up: Node4 and
+// Node16 keep sorted labels (Node16 matches all 16 with one SSE2 compare),
+// Node48 maps a byte to one of 48 slots and Node256 indexes directly.
+// A word may end at any node; the root's prefix is always empty.
+
+const char* const BUFFER_LAYOUT = "radix (ART)";
+
+enum TrieNodeKind : uint8_t { NODE4, NODE16, NODE48, NODE256 };
+
+struct TrieNode {
+    TrieNodeKind kind = NODE4;
+    uint16_t count = 0;        // children
+    bool isEnd = false;
+    bool erased = false;       // tombstone of a deleted frozen word
+    uint32_t weight = 0;       // ranking score for autocomplete
+    string_view prefix;        // key bytes after the parent's label
+    string_view meaning;
+};
+
+struct TrieNode4 : TrieNode {
+    uint8_t keys[4];
+    TrieNode* child[4];
+};
+
+struct TrieNode16 : TrieNode {
+    uint8_t keys[16];
+    TrieNode* child[16];
+    TrieNode16() { kind = NODE16; }
+};
+
+struct TrieNode48 : TrieNode {
+    uint8_t index[256] = {};   // slot + 1 of each byte's child, 0 if none
+    TrieNode* child[48];
+    TrieNode48() { kind = NODE48; }
+};
+
+struct TrieNode256 : TrieNode {
+    TrieNode* child[256] = {};
+    TrieNode256() { kind = NODE256; }
+};
+
+// the link to the child under byte c, or nullptr
+TrieNode** childSlot(TrieNode* n, uint8_t c) {
+    switch (n->kind) {
+    case NODE4: {
+        TrieNode4* m = static_cast<TrieNode4*>(n);
+        for (int i = 0; i < m->count; i++) {
+            if (m->keys[i] == c) return &m->child[i];
+        }
+        return nullptr;
+    }
+    case NODE16: {
+        TrieNode16* m = static_cast<TrieNode16*>(n);
+#ifdef __SSE2__
+        __m128i eq = _mm_cmpeq_epi8(_mm_set1_epi8((char)c), _mm_loadu_si128((const __m128i*)m->keys));
+        unsigned hits = (unsigned)_mm_movemask_epi8(eq) & ((1u << m->count) - 1);
+        return hits ? &m->child[__builtin_ctz(hits)] : nullptr;
+#else
+        for (int i = 0; i < m->count; i++) {
+            if (m->keys[i] == c) return &m->child[i];
+        }
+        return nullptr;
+#endif
+    }
+    case NODE48: {
+        TrieNode48* m = static_cast<TrieNode48*>(n);
+        return m->index[c] ? &m->child[m->index[c] - 1] : nullptr;
+    }
+    default: {
+        TrieNode256* m = static_cast<TrieNode256*>(n);
+        return m->child[c] ? &m->child[c] : nullptr;
+    }
+    }
+}
+
+// calls f(label, child) in label order
+template<class F>
+void forEachChild(TrieNode* n, F f) {
+    switch (n->kind) {
+    case NODE4: {
+        TrieNode4* m = static_cast<TrieNode4*>(n);
+        for (int i = 0; i < m->count; i++) f(m->keys[i], m->child[i]);
+        break;
+    }
+    case NODE16: {
+        TrieNode16* m = static_cast<TrieNode16*>(n);
+        for (int i = 0; i < m->count; i++) f(m->keys[i], m->child[i]);
+        break;
+    }
+    case NODE48: {
+        TrieNode48* m = static_cast<TrieNode48*>(n);
+        for (int c = 0; c < 256; c++) {
+            if (m->index[c]) f((uint8_t)c, m->child[m->index[c] - 1]);
+        }
+        break;
+    }
+    default: {
+        TrieNode256* m = static_cast<TrieNode256*>(n);
+        for (int c = 0; c < 256; c++) {
+            if (m->child[c]) f((uint8_t)c, m->child[c]);
+        }
+    }
+    }
+}
+
+size_t nodeBytes(TrieNodeKind kind) {
+    switch (kind) {
+    case NODE4: return sizeof(TrieNode4);
+    case NODE16: return sizeof(TrieNode16);
+    case NODE48: return sizeof(TrieNode48);
+    default: return sizeof(TrieNode256);
+    }
+}
+
+TrieNode* cloneNode(BufferArena &arena, const TrieNode* n) {
+    TrieNode* copy = (TrieNode*)arena.allocate(nodeBytes(n->kind));
+    memcpy((void*)copy, (const void*)n, nodeBytes(n->kind));
+    return copy;
+}
+
+// returns one node, not its children, to the arena
+void freeBufferNode(BufferArena &arena, TrieNode* n) {
+    arena.release(n, nodeBytes(n->kind));
+}
+
+// a bigger node with the same prefix, word and meaning; children are up to the caller
+template<class To>
+To* grownCopy(BufferArena &arena, const TrieNode* from) {
+    To* to = arena.make<To>();
+    TrieNodeKind kind = to->kind;
+    static_cast<TrieNode&>(*to) = *from;
+    to->kind = kind;
+    return to;
+}
+
+template<int N>
+void insertSorted(uint8_t (&keys)[N], TrieNode* (&child)[N], uint16_t &count, uint8_t c, TrieNode* node) {
+    int i = count;
+    while (i > 0 && keys[i - 1] > c) {
+        keys[i] = keys[i - 1];
+        child[i] = child[i - 1];
+        i--;
+    }
+    keys[i] = c;
+    child[i] = node;
+    count++;
+}
+
+// adds node under byte c to the node at *slot, which must be a private
+// copy; a full node is replaced by the next size up
+void addChild(BufferArena &arena, TrieNode** slot, uint8_t c, TrieNode* node) {
+    TrieNode* n = *slot;
+    switch (n->kind) {
+    case NODE4: {
+        TrieNode4* m = static_cast<TrieNode4*>(n);
+        if (m->count < 4) {
+            insertSorted(m->keys, m->child, m->count, c, node);
+            return;
+        }
+        TrieNode16* g = grownCopy<TrieNode16>(arena, m);
+        memcpy(g->keys, m->keys, 4);
+        memcpy(g->child, m->child, sizeof(m->child));
+        insertSorted(g->keys, g->child, g->count, c, node);
+        freeBufferNode(arena, m);
+        *slot = g;
+        return;
+    }
+    case NODE16: {
+        TrieNode16* m = static_cast<TrieNode16*>(n);
+        if (m->count < 16) {
+            insertSorted(m->keys, m->child, m->count, c, node);
+            return;
+        }
+        TrieNode48* g = grownCopy<TrieNode48>(arena, m);
+        for (int i = 0; i < 16; i++) {
+            g->index[m->keys[i]] = (uint8_t)(i + 1);
+            g->child[i] = m->child[i];
+        }
+        freeBufferNode(arena, m);
+        *slot = n = g;
+        [[fallthrough]];   // the new Node48 has room
+    }
+    case NODE48: {
+        TrieNode48* m = static_cast<TrieNode48*>(n);
+        if (m->count < 48) {
+            m->child[m->count] = node;
+            m->index[c] = (uint8_t)++m->count;
+            return;
+        }
+        TrieNode256* g = grownCopy<TrieNode256>(arena, m);
+        for (int b = 0; b < 256; b++) {
+            if (m->index[b]) g->child[b] = m->child[m->index[b] - 1];
+        }
+        freeBufferNode(arena, m);
+        *slot = n = g;
+        [[fallthrough]];
+    }
+    default: {
+        TrieNode256* m = static_cast<TrieNode256*>(n);
+        m->child[c] = node;
+        m->count++;
+    }
+    }
+}
+
+TrieNode* findInBuffer(TrieNode* root, string_view word) {
+    TrieNode* n = root;
+    size_t depth = 0;
+    while (n) {
+        string_view p = n->prefix;
+        if (word.size() - depth < p.size() || word.compare(depth, p.size(), p) != 0) return nullptr;
+        depth += p.size();
+        if (depth == word.size()) return n->isEnd ? n : nullptr;
+        TrieNode** slot = childSlot(n, (uint8_t)word[depth++]);
+        n = slot ? *slot : nullptr;
+    }
+    return nullptr;
+}
+
+// collect all (word, meaning, weight) entries below node, in key order;
+// current is the key up to node's own prefix
+void collectTrieWords(TrieNode* node, string &current, vector<TrieEntry> &out) {
+    if (!node) return;
+    size_t len = current.size();
+    current += node->prefix;
+    if (node->isEnd) {
+        out.push_back({current, string(node->meaning), node->weight, node->erased});
+    }
+    forEachChild(node, [&](uint8_t c, TrieNode* child) {
+        current.push_back((char)c);
+        collectTrieWords(child, current, out);
+        current.pop_back();
+    });
+    current.resize(len);
+}
+
+// every word starting with prefix, in key order
+void collectBufferPrefix(TrieNode* root, string_view prefix, vector<TrieEntry> &out) {
+    TrieNode* n = root;
+    size_t depth = 0;
+    while (n) {
+        string_view p = n->prefix;
+        size_t cmp = min(p.size(), prefix.size() - depth);
+        if (prefix.compare(depth, cmp, p, 0, cmp) != 0) return;
+        if (depth + p.size() >= prefix.size()) {
+            string current(prefix.substr(0, depth));
+            collectTrieWords(n, current, out);
+            return;
+        }
+        depth += p.size();
+        TrieNode** slot = childSlot(n, (uint8_t)prefix[depth++]);
+        n = slot ? *slot : nullptr;
+    }
+}
+
+size_t countTrieNodes(TrieNode* node) {
+    if (!node) return 0;
+    size_t n = 1;
+    forEachChild(node, [&](uint8_t, TrieNode* child) { n += countTrieNodes(child); });
+    return n;
+}
+
+// with tombstone set the word is stored as a delete, meaning and weight unused
+TrieNode* insertIntoBuffer(BufferArena &arena, TrieNode* root, string_view word, string_view meaning,
+                           uint32_t weight, vector<TrieNode*> &replaced, bool &isNew, bool tombstone = false) {
+    TrieNode* newRoot = root ? cloneNode(arena, root) : arena.make<TrieNode4>();
+    if (root) replaced.push_back(root);
+    TrieNode** slot = &newRoot;   // link to the (already copied) node at depth
+    size_t depth = 0;
+    while (true) {
+        TrieNode* n = *slot;
+        size_t m = 0;
+        while (m < n->prefix.size() && depth + m < word.size() && n->prefix[m] == word[depth + m]) m++;
+        if (m < n->prefix.size()) {
+            // the word ends or branches inside this edge: split it
+            TrieNode* split = arena.make<TrieNode4>();
+            split->prefix = n->prefix.substr(0, m);
+            uint8_t label = (uint8_t)n->prefix[m];
+            n->prefix.remove_prefix(m + 1);
+            addChild(arena, &split, label, n);
+            *slot = n = split;
+        }
+        depth += m;
+        if (depth == word.size()) {
+            isNew = !n->isEnd;
+            n->isEnd = true;
+            n->erased = tombstone;
+            n->meaning = arena.copy(meaning);
+            n->weight = weight;
+            return newRoot;
+        }
+        uint8_t c = (uint8_t)word[depth++];
+        TrieNode** link = childSlot(n, c);
+        if (!link) {
+            TrieNode* leaf = arena.make<TrieNode4>();
+            leaf->prefix = arena.copy(word.substr(depth));
+            leaf->isEnd = true;
+            leaf->erased = tombstone;
+            leaf->meaning = arena.copy(meaning);
+            leaf->weight = weight;
+            addChild(arena, slot, c, leaf);
+            isNew = true;
+            return newRoot;
+        }
+        replaced.push_back(*link);
+        *link = cloneNode(arena, *link);
+        slot = link;
+    }
+}
+
+template<int N>
+void eraseSorted(uint8_t (&keys)[N], TrieNode* (&child)[N], uint16_t &count, uint8_t c) {
+    int i = 0;
+    while (keys[i] != c) i++;
+    for (count--; i < count; i++) {
+        keys[i] = keys[i + 1];
+        child[i] = child[i + 1];
+    }
+}
+
+// drops the child under byte c from the node, which must be a private copy.
+// Nodes are not shrunk here; compaction rebuilds them at the size they need.
+void removeChild(TrieNode* n, uint8_t c) {
+    switch (n->kind) {
+    case NODE4: {
+        TrieNode4* m = static_cast<TrieNode4*>(n);
+        eraseSorted(m->keys, m->child, m->count, c);
+        return;
+    }
+    case NODE16: {
+        TrieNode16* m = static_cast<TrieNode16*>(n);
+        eraseSorted(m->keys, m->child, m->count, c);
+        return;
+    }
+    case NODE48: {
+        // slots stay dense: the last one moves into the hole
+        TrieNode48* m = static_cast<TrieNode48*>(n);
+        int hole = m->index[c] - 1;
+        m->index[c] = 0;
+        m->count--;
+        if (hole == m->count) return;
+        m->child[hole] = m->child[m->count];
+        for (int b = 0; b < 256; b++) {
+            if (m->index[b] == m->count + 1) {
+                m->index[b] = (uint8_t)(hole + 1);
+                break;
+            }
+        }
+        return;
+    }
+    default: {
+        TrieNode256* m = static_cast<TrieNode256*>(n);
+        m->child[c] = nullptr;
+        m->count--;
+    }
+    }
+}
+
+// a private copy of a node below the root that no longer holds a word:
+// nullptr once it has no children either, and merged into its only child
+// (one edge again) when it has one
+TrieNode* collapseNode(BufferArena &arena, TrieNode* copy, vector<TrieNode*> &replaced) {
+    if (copy->isEnd || copy->count > 1) return copy;
+    TrieNode* merged = nullptr;
+    forEachChild(copy, [&](uint8_t c, TrieNode* child) {
+        string prefix(copy->prefix);
+        prefix.push_back((char)c);
+        prefix += child->prefix;
+        merged = cloneNode(arena, child);
+        merged->prefix = arena.copy(prefix);
+        replaced.push_back(child);
+    });
+    freeBufferNode(arena, copy);
+    return merged;
+}
+
+// removes word from the buffer; returns root unchanged if it is not there
+TrieNode* eraseFromBuffer(BufferArena &arena, TrieNode* root, string_view word, vector<TrieNode*> &replaced) {
+    vector<TrieNode*> path;
+    vector<uint8_t> labels;   // labels[d] leads from path[d] to path[d + 1]
+    TrieNode* n = root;
+    size_t depth = 0;
+    while (true) {
+        if (!n) return root;
+        string_view p = n->prefix;
+        if (word.size() - depth < p.size() || word.compare(depth, p.size(), p) != 0) return root;
+        depth += p.size();
+        path.push_back(n);
+        if (depth == word.size()) break;
+        labels.push_back((uint8_t)word[depth++]);
+        TrieNode** slot = childSlot(n, labels.back());
+        n = slot ? *slot : nullptr;
+    }
+    if (!n->isEnd) return root;
+
+    // what replaces path[d] in the new trie, nullptr to drop it
+    size_t d = path.size() - 1;
+    TrieNode* repl = cloneNode(arena, n);
+    repl->isEnd = repl->erased = false;
+    repl->meaning = string_view();
+    replaced.push_back(n);
+    if (d > 0) repl = collapseNode(arena, repl, replaced);
+    while (d > 0) {
+        TrieNode* p = path[--d];
+        replaced.push_back(p);
+        TrieNode* copy = cloneNode(arena, p);
+        if (repl) {
+            *childSlot(copy, labels[d]) = repl;
+            repl = copy;
+        } else {
+            removeChild(copy, labels[d]);
+            repl = d > 0 ? collapseNode(arena, copy, replaced) : copy;
+        }
+    }
+    if (!repl->isEnd && repl->count == 0) {
+        freeBufferNode(arena, repl);
+        return nullptr;
+    }
+    return repl;
+}
+
+// a copy of n in arena at the smallest size that holds its children, with
+// its own prefix and meaning; the children are still n's
+TrieNode* compactNode(BufferArena &arena, TrieNode* n) {
+    TrieNode* to;
+    if (n->count <= 4) to = arena.make<TrieNode4>();
+    else if (n->count <= 16) to = arena.make<TrieNode16>();
+    else if (n->count <= 48) to = arena.make<TrieNode48>();
+    else to = arena.make<TrieNode256>();
+    TrieNodeKind kind = to->kind;
+    *to = *n;
+    to->kind = kind;
+    to->count = 0;
+    to->prefix = arena.copy(n->prefix);
+    to->meaning = arena.copy(n->meaning);
+    forEachChild(n, [&](uint8_t c, TrieNode* child) { addChild(arena, &to, c, child); });
+    return to;
+}
+
+// the whole buffer copied into arena breadth first, so the nodes a lookup
+// visits first sit together; nodes are resized to what they hold
+TrieNode* compactBuffer(BufferArena &arena, TrieNode* root) {
+    TrieNode* out = root;
+    deque<TrieNode**> queue;
+    if (root) queue.push_back(&out);
+    while (!queue.empty()) {
+        TrieNode** slot = queue.front();
+        queue.pop_front();
+        TrieNode* n = *slot = compactNode(arena, *slot);
+        forEachChild(n, [&](uint8_t c, TrieNode*) { queue.push_back(childSlot(n, c)); });
     }
-    curr->isEnd = true;
-    curr->meaning = meaning;
+    return out;
+}
+
+#else
+// One node per key byte. Nodes keep only the children they have, as a
+// sorted label list and a parallel pointer list of exactly `count` entries;
+// almost all nodes have a handful of children.
+
+const char* const BUFFER_LAYOUT = "sparse";
+
+struct TrieNode {
+    const char* labels = nullptr;   // key bytes of the children, ascending (unsigned)
+    TrieNode** child = nullptr;     // child[i] is reached by labels[i]
+    uint16_t count = 0;
+    bool isEnd = false;
+    bool erased = false;            // tombstone of a deleted frozen word
+    uint32_t weight = 0;            // ranking score for autocomplete
+    string_view meaning;
+};
+
+// child reached by key byte c; labels are few, so a scan beats a search
+TrieNode* childOf(const TrieNode* node, char c) {
+    if (node->count == 0) return nullptr;
+    const void* at = memchr(node->labels, c, node->count);
+    return at ? node->child[(const char*)at - node->labels] : nullptr;
 }
 
-TrieNode* searchInTrie(const string &wordRaw) {
-    string word = normalizeWord(wordRaw);
-    if (word.empty()) return nullptr;
-    TrieNode* curr = trieRoot;
+TrieNode* findInBuffer(TrieNode* root, string_view word) {
+    TrieNode* curr = root;
+    if (!curr) return nullptr;
     for (char c : word) {
-        int idx = c - 'a';
-        if (!curr->child[idx]) return nullptr;
-        curr = curr->child[idx];
+        curr = childOf(curr, c);
+        if (!curr) return nullptr;
     }
     return (curr->isEnd ? curr : nullptr);
 }
 
-// collect all (word, meaning) pairs from Trie
-void collectTrieWords(TrieNode* node, string &current, vector<pair<string,string>> &out) {
+// collect all (word, meaning, weight) entries from Trie, in key order
+void collectTrieWords(TrieNode* node, string &current, vector<TrieEntry> &out) {
     if (!node) return;
     if (node->isEnd) {
-        out.push_back({current, node->meaning});
+        out.push_back({current, string(node->meaning), node->weight, node->erased});
+    }
+    for (size_t i = 0; i < node->count; i++) {
+        current.push_back(node->labels[i]);
+        collectTrieWords(node->child[i], current, out);
+        current.pop_back();
+    }
+}
+
+// every word starting with prefix, in key order
+void collectBufferPrefix(TrieNode* root, string_view prefix, vector<TrieEntry> &out) {
+    TrieNode* node = root;
+    for (size_t i = 0; node && i < prefix.size(); i++) node = childOf(node, prefix[i]);
+    string current(prefix);
+    collectTrieWords(node, current, out);
+}
+
+// returns one node, not its children, to the arena
+void freeBufferNode(BufferArena &arena, TrieNode* node) {
+    arena.release((void*)node->labels, node->count);
+    arena.release(node->child, node->count * sizeof(TrieNode*));
+    arena.release(node, sizeof(TrieNode));
+}
+
+size_t countTrieNodes(TrieNode* node) {
+    if (!node) return 0;
+    size_t n = 1;
+    for (size_t i = 0; i < node->count; i++) n += countTrieNodes(node->child[i]);
+    return n;
+}
+
+// a private copy of node (or a new node) whose child lists have room for a
+// new child under label c at position at; at < 0 leaves them as they are
+TrieNode* copyWithChild(BufferArena &arena, const TrieNode* node, int at, char c) {
+    TrieNode* n = node ? arena.make<TrieNode>(*node) : arena.make<TrieNode>();
+    size_t count = n->count + (at >= 0);
+    if (count == 0) return n;
+    char* labels = (char*)arena.allocate(count);
+    TrieNode** child = (TrieNode**)arena.allocate(count * sizeof(TrieNode*));
+    size_t before = at < 0 ? n->count : at;   // entries ahead of the new one
+    copy(n->labels, n->labels + before, labels);
+    copy(n->child, n->child + before, child);
+    if (at >= 0) {
+        labels[at] = c;
+        child[at] = nullptr;
+        copy(n->labels + at, n->labels + n->count, labels + at + 1);
+        copy(n->child + at, n->child + n->count, child + at + 1);
+    }
+    n->labels = labels;
+    n->child = child;
+    n->count = (uint16_t)count;
+    return n;
+}
+
+// with tombstone set the word is stored as a delete, meaning and weight unused
+TrieNode* insertIntoBuffer(BufferArena &arena, TrieNode* root, string_view word, string_view meaning,
+                           uint32_t weight, vector<TrieNode*> &replaced, bool &isNew, bool tombstone = false) {
+    TrieNode* newRoot = root;
+    TrieNode** slot = &newRoot;   // link to the node at depth, still the published one
+    for (size_t depth = 0;; depth++) {
+        TrieNode* old = *slot;
+        if (old) replaced.push_back(old);
+        if (depth == word.size()) {
+            TrieNode* n = *slot = copyWithChild(arena, old, -1, 0);
+            isNew = !n->isEnd;
+            n->isEnd = true;
+            n->erased = tombstone;
+            n->meaning = arena.copy(meaning);
+            n->weight = weight;
+            return newRoot;
+        }
+        char c = word[depth];
+        int i = 0, count = old ? old->count : 0;
+        while (i < count && (unsigned char)old->labels[i] < (unsigned char)c) i++;
+        bool exists = i < count && old->labels[i] == c;
+        TrieNode* n = *slot = copyWithChild(arena, old, exists ? -1 : i, c);
+        slot = &n->child[i];
+    }
+}
+
+// a private copy of node without its child at position at
+TrieNode* copyWithoutChild(BufferArena &arena, const TrieNode* node, int at) {
+    TrieNode* n = arena.make<TrieNode>(*node);
+    n->count--;
+    n->labels = nullptr;
+    n->child = nullptr;
+    if (n->count == 0) return n;
+    char* labels = (char*)arena.allocate(n->count);
+    TrieNode** child = (TrieNode**)arena.allocate(n->count * sizeof(TrieNode*));
+    copy(node->labels, node->labels + at, labels);
+    copy(node->child, node->child + at, child);
+    copy(node->labels + at + 1, node->labels + node->count, labels + at);
+    copy(node->child + at + 1, node->child + node->count, child + at);
+    n->labels = labels;
+    n->child = child;
+    return n;
+}
+
+int labelIndex(const TrieNode* node, char c) {
+    return (int)((const char*)memchr(node->labels, c, node->count) - node->labels);
+}
+
+// removes word from the buffer; returns root unchanged if it is not there
+TrieNode* eraseFromBuffer(BufferArena &arena, TrieNode* root, string_view word, vector<TrieNode*> &replaced) {
+    vector<TrieNode*> path;   // path[d] is the node reached by the first d bytes
+    TrieNode* n = root;
+    for (char c : word) {
+        if (!n) return root;
+        path.push_back(n);
+        n = childOf(n, c);
+    }
+    if (!n || !n->isEnd) return root;
+
+    // what replaces the node at depth d in the new trie, nullptr to drop it
+    size_t d = word.size();
+    TrieNode* repl = nullptr;
+    if (n->count) {
+        repl = copyWithChild(arena, n, -1, 0);
+        repl->isEnd = repl->erased = false;
+        repl->meaning = string_view();
+    }
+    replaced.push_back(n);
+    while (d > 0) {
+        TrieNode* p = path[--d];
+        replaced.push_back(p);
+        int at = labelIndex(p, word[d]);
+        if (repl) {
+            TrieNode* copy = copyWithChild(arena, p, -1, 0);
+            copy->child[at] = repl;
+            repl = copy;
+        } else if (p->count > 1 || p->isEnd || d == 0) {
+            repl = copyWithoutChild(arena, p, at);
+        }
+    }
+    if (repl && !repl->isEnd && repl->count == 0) {
+        freeBufferNode(arena, repl);
+        return nullptr;
+    }
+    return repl;
+}
+
+// the whole buffer copied into arena breadth first, so the nodes a lookup
+// visits first sit together
+TrieNode* compactBuffer(BufferArena &arena, TrieNode* root) {
+    TrieNode* out = root;
+    deque<TrieNode**> queue;
+    if (root) queue.push_back(&out);
+    while (!queue.empty()) {
+        TrieNode** slot = queue.front();
+        queue.pop_front();
+        TrieNode* n = *slot = copyWithChild(arena, *slot, -1, 0);
+        n->meaning = arena.copy(n->meaning);
+        for (size_t i = 0; i < n->count; i++) queue.push_back(&n->child[i]);
+    }
+    return out;
+}
+#endif
+
+// ======================= HUFFMAN SECTION =======================
+
+struct HuffmanNode {
+    char ch;
+    uint64_t freq;
+    HuffmanNode *left;
+    HuffmanNode *right;
+
+    HuffmanNode(char c, uint64_t f) {
+        ch = c;
+        freq = f;
+        left = right = nullptr;
+    }
+};
+
+struct HuffmanCompare {
+    bool operator()(HuffmanNode* a, HuffmanNode* b) {
+        return a->freq > b->freq; // min-heap by freq
+    }
+};
+
+// adds the byte counts of data to freq. Four interleaved tables keep a run
+// of one byte value from serializing on a single counter.
+void countByteFrequencies(const char* data, size_t n, uint64_t freq[256]) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t lanes[4][256] = {};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        lanes[0][p[i]]++;
+        lanes[1][p[i + 1]]++;
+        lanes[2][p[i + 2]]++;
+        lanes[3][p[i + 3]]++;
+    }
+    for (; i < n; i++) lanes[0][p[i]]++;
+    for (int c = 0; c < 256; c++) freq[c] += lanes[0][c] + lanes[1][c] + lanes[2][c] + lanes[3][c];
+}
+
+array<uint64_t, 256> buildFrequencyTable(const string &text) {
+    array<uint64_t, 256> freq{};
+    countByteFrequencies(text.data(), text.size(), freq.data());
+    return freq;
+}
+
+HuffmanNode* buildHuffmanTree(const uint64_t freq[256]) {
+    priority_queue<HuffmanNode*, vector<HuffmanNode*>, HuffmanCompare> pq;
+    for (int c = 0; c < 256; c++) {
+        if (freq[c]) pq.push(new HuffmanNode((char)c, freq[c]));
+    }
+    if (pq.empty()) return nullptr;
+    while (pq.size() > 1) {
+        HuffmanNode* left = pq.top();  pq.pop();
+        HuffmanNode* right = pq.top(); pq.pop();
+        HuffmanNode* parent = new HuffmanNode('\0', left->freq + right->freq);
+        parent->left = left;
+        parent->right = right;
+        pq.push(parent);
+    }
+    return pq.top();
+}
+
+void freeHuffmanTree(HuffmanNode* root) {
+    if (!root) return;
+    freeHuffmanTree(root->left);
+    freeHuffmanTree(root->right);
+    delete root;
+}
+
+// ----- canonical, bit-packed codec -----
+// Only the code length of each byte value is stored; codes are rebuilt in
+// canonical order (shorter first, then by byte value). Lengths are capped at
+// HUFF_MAX_BITS so any code is resolved by one probe into a decode table
+// indexed by the next HUFF_MAX_BITS bits of input.
+
+const int HUFF_MAX_BITS = 12;
+
+struct HuffmanCode {
+    unsigned char len[256];     // 0 = byte value not used
+    uint32_t code[256];
+    vector<uint16_t> table;     // next HUFF_MAX_BITS bits -> byte << 4 | length
+};
+
+void collectCodeLengths(HuffmanNode* node, int depth, unsigned char len[256], int &maxLen) {
+    if (!node) return;
+    if (!node->left && !node->right) {
+        int l = max(depth, 1); // a lone symbol still needs one bit
+        len[(unsigned char)node->ch] = (unsigned char)min(l, 255);
+        maxLen = max(maxLen, l);
+        return;
+    }
+    collectCodeLengths(node->left, depth + 1, len, maxLen);
+    collectCodeLengths(node->right, depth + 1, len, maxLen);
+}
+
+// fills code[] and table from len[]; false if the lengths are not a prefix code
+bool buildCanonicalCode(HuffmanCode &hc) {
+    vector<int> order;
+    uint64_t kraft = 0;
+    for (int c = 0; c < 256; c++) {
+        if (!hc.len[c]) continue;
+        if (hc.len[c] > HUFF_MAX_BITS) return false;
+        kraft += 1ULL << (HUFF_MAX_BITS - hc.len[c]);
+        order.push_back(c);
+    }
+    if (kraft > (1ULL << HUFF_MAX_BITS)) return false;
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return hc.len[a] != hc.len[b] ? hc.len[a] < hc.len[b] : a < b;
+    });
+
+    hc.table.assign(1 << HUFF_MAX_BITS, 0);
+    uint32_t code = 0;
+    int prevLen = 0;
+    for (int c : order) {
+        code <<= (hc.len[c] - prevLen);
+        prevLen = hc.len[c];
+        hc.code[c] = code;
+        int shift = HUFF_MAX_BITS - hc.len[c];
+        uint16_t entry = (uint16_t)(c << 4 | hc.len[c]);
+        for (uint32_t i = code << shift; i < (code + 1) << shift; i++) hc.table[i] = entry;
+        code++;
+    }
+    return true;
+}
+
+HuffmanCode buildHuffmanCode(const uint64_t counts[256]) {
+    HuffmanCode hc;
+    memset(hc.len, 0, sizeof(hc.len));
+    memset(hc.code, 0, sizeof(hc.code));
+    uint64_t freq[256];
+    memcpy(freq, counts, sizeof(freq));
+    // flatten the counts until the deepest code fits the decode table
+    while (true) {
+        HuffmanNode* root = buildHuffmanTree(freq);
+        int maxLen = 0;
+        memset(hc.len, 0, sizeof(hc.len));
+        collectCodeLengths(root, 0, hc.len, maxLen);
+        freeHuffmanTree(root);
+        if (maxLen <= HUFF_MAX_BITS) break;
+        for (auto &f : freq) f = (f + 1) / 2;
+    }
+    buildCanonicalCode(hc);
+    return hc;
+}
+
+HuffmanCode buildHuffmanCode(const string &text) {
+    return buildHuffmanCode(buildFrequencyTable(text).data());
+}
+
+// appends the packed codes of data to out, MSB first, last byte zero padded
+void huffmanEncode(const HuffmanCode &hc, const char* data, size_t n, string &out) {
+    MetricTimer timer(MH_HUFF_ENCODE);
+    countMetric(MC_HUFF_ENCODED_BYTES, n);
+    uint64_t acc = 0;
+    int bits = 0;
+    out.reserve(out.size() + n);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)data[i];
+        acc = (acc << hc.len[c]) | hc.code[c];
+        bits += hc.len[c];
+        while (bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    if (bits > 0) out.push_back((char)(acc << (8 - bits)));
+}
+
+// decodes the first outLen bytes of the packed bits into dst
+bool huffmanDecode(const HuffmanCode &hc, const char* bits, size_t nbytes, char* dst, size_t outLen) {
+    MetricTimer timer(MH_HUFF_DECODE);
+    countMetric(MC_HUFF_DECODED_BYTES, outLen);
+    const unsigned char* in = (const unsigned char*)bits;
+    uint64_t acc = 0;
+    int avail = 0;
+    size_t pos = 0;
+    const uint16_t* table = hc.table.data();
+    const uint64_t mask = (1 << HUFF_MAX_BITS) - 1;
+    size_t i = 0;
+    while (i < outLen) {
+        while (avail <= 56) {
+            acc = (acc << 8) | (pos < nbytes ? in[pos] : 0);
+            pos++;
+            avail += 8;
+        }
+        // 57+ buffered bits always cover four codes of at most 12 bits
+        size_t stop = min(outLen, i + 4);
+        for (; i < stop; i++) {
+            uint16_t entry = table[(acc >> (avail - HUFF_MAX_BITS)) & mask];
+            if (!entry) return false;
+            dst[i] = (char)(entry >> 4);
+            avail -= entry & 15;
+        }
+    }
+    // running into the zero fill past the end means the input was cut short
+    return (pos * 8 - avail + 7) / 8 <= nbytes;
+}
+
+// as above, appending the decoded bytes to out
+bool huffmanDecode(const HuffmanCode &hc, const char* bits, size_t nbytes, size_t outLen, string &out) {
+    size_t start = out.size();
+    out.resize(start + outLen);
+    if (huffmanDecode(hc, bits, nbytes, &out[start], outLen)) return true;
+    out.resize(start);
+    return false;
+}
+
+// ======================= FROZEN (DOUBLE-ARRAY) TRIE SECTION =======================
+// The pointer Trie above is only a small write buffer. Once it holds
+// FREEZE_THRESHOLD words it is folded into the frozen trie, which is what
+// serves almost every lookup.
+//
+// The threshold grows with the frozen size, so bulk inserts are folded a
+// geometric number of times instead of once per FREEZE_THRESHOLD words.
+//
+// Words are split by first key byte into FROZEN_PARTS partitions. Each one
+// is a double-array trie over the rest of the key: from state s, byte c
+// (1..255) leads to t = base[s] + c if check[t] == s. State 0 is the
+// partition root. Lookups index directly, whatever the alphabet; listing
+// the children of s follows firstChild[s] and then nextSibling[] of each
+// child instead of probing all 255 labels.
+//
+// Meanings are laid out back to back and cut into blocks of about
+// MEANING_BLOCK_SIZE bytes (never splitting a meaning). Each block is Huffman
+// coded on its own with the partition's code table, so a lookup decodes one
+// block, and recently decoded blocks stay in a small per-thread cache.
+
+const int FROZEN_PARTS = 256;
+const size_t FREEZE_THRESHOLD = 4096;
+const size_t MEANING_BLOCK_SIZE = 2048;
+const int BLOCK_CACHE_SLOTS = 8;
+
+// Read-only memory map of a whole file, unmapped when the last user lets go.
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+    bool borrowed = false;      // data is linked into the program, not mapped
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    ~MappedFile() {
+        if (borrowed) return;
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap((void*)data, size);
+#endif
+    }
+};
+
+shared_ptr<MappedFile> mapFile(const string &path) {
+    auto mf = make_shared<MappedFile>();
+#ifdef _WIN32
+    // FILE_SHARE_DELETE lets replaceFile move a mapped file aside
+    mf->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mf->file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mf->file, &size) || size.QuadPart == 0) return nullptr;
+    mf->mapping = CreateFileMappingA(mf->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mf->mapping) return nullptr;
+    mf->data = (const char*)MapViewOfFile(mf->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mf->data) return nullptr;
+    mf->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    mf->data = (const char*)p;
+    mf->size = st.st_size;
+#endif
+    return mf;
+}
+
+// Arrays are read through plain pointers so a FrozenTrie can either own its
+// storage (built in memory) or point straight into a mapped image.
+struct FrozenTrie {
+    const int32_t* base = nullptr;
+    const int32_t* check = nullptr;       // parent state, -1 for a free slot
+    const int32_t* value = nullptr;       // entry index, -1 if no word ends here
+    const uint32_t* maxWeight = nullptr;  // highest entry weight in the subtree of a state
+    const uint8_t* firstChild = nullptr;  // label of a state's first child, 0 if none
+    const uint8_t* nextSibling = nullptr; // label of the next child of the same parent, 0 if none
+    const uint32_t* meaningOff = nullptr; // entry i is text[meaningOff[i], meaningOff[i+1])
+    const uint32_t* weight = nullptr;     // per entry
+    const uint32_t* blockStart = nullptr; // text offset where block k starts, blocks + 1 values
+    const uint32_t* blockBytes = nullptr; // offset of block k in packed, blocks + 1 values
+    const unsigned char* codeLens = nullptr;
+    const char* packed = nullptr;
+    const uint32_t* termOff = nullptr;    // term k is termText[termOff[k], termOff[k+1]), terms sorted
+    const uint32_t* postOff = nullptr;    // its postings are postings[postOff[k], postOff[k+1])
+    const char* termText = nullptr;
+    const uint8_t* postings = nullptr;
+    uint32_t states = 0;
+    uint32_t entries = 0;
+    uint32_t blocks = 0;
+    uint32_t terms = 0;
+    uint64_t id = 0;                      // never reused, keys the block cache
+    HuffmanCode code;
+    unique_ptr<atomic<uint32_t>[]> hits;  // sampled lookup counts, folded into weight on rebuild
+    mutable atomic<uint32_t> maxHits{0};  // highest of hits[], added to maxWeight bounds
+
+    vector<int32_t> baseStore, checkStore, valueStore;
+    vector<uint8_t> firstChildStore, nextSiblingStore;
+    vector<uint32_t> maxWeightStore, offStore, weightStore, blockStartStore, blockBytesStore;
+    string packedStore;
+    vector<uint32_t> termOffStore, postOffStore;
+    string termTextStore;
+    vector<uint8_t> postingsStore;
+    shared_ptr<MappedFile> image;
+
+    size_t entryCount() const { return entries; }
+    size_t textSize() const { return meaningOff[entries]; }
+    size_t packedSize() const { return blockBytes[blocks]; }
+    size_t indexBytes() const {
+        if (!termOff) return 0;
+        return (terms + 1) * 2 * sizeof(uint32_t) + termOff[terms] + postOff[terms];
+    }
+    size_t bytesUsed() const {
+        return (size_t)states * (4 * sizeof(int32_t) + 2)
+             + (entries * 3 + 1 + (blocks + 1) * 2) * sizeof(uint32_t)
+             + 256 + packedSize() + indexBytes();
+    }
+};
+
+atomic<uint64_t> nextFrozenTrieId{1};
+
+// sets up the decode table and hit counters once the views are in place
+bool attachFrozenCode(FrozenTrie* ft) {
+    ft->id = nextFrozenTrieId++;
+    ft->hits.reset(new atomic<uint32_t>[ft->entries]());
+    memcpy(ft->code.len, ft->codeLens, 256);
+    return buildCanonicalCode(ft->code);
+}
+
+// ----- meaning index -----
+// Each partition carries an inverted index over the terms of its meanings
+// for reverse lookups. Term k's posting list holds, in ascending order, the
+// states where the words whose meaning has term k end; each is stored as
+// the gap from the one before (the first from 0) in a base-128 varint, low
+// bits first. A state spells its word (check[] leads back to the root) and
+// gives its entry (value[]), so no separate word table is needed.
+
+void appendVarint(vector<uint8_t> &out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+// points the index views at the stores
+void attachIndexStores(FrozenTrie* ft) {
+    ft->termOff = ft->termOffStore.data();
+    ft->postOff = ft->postOffStore.data();
+    ft->termText = ft->termTextStore.data();
+    ft->postings = ft->postingsStore.data();
+    ft->terms = (uint32_t)ft->termOffStore.size() - 1;
+}
+
+// interns the terms of one partition: open addressing from term text to
+// a dense id, ids handed out in first-seen order
+struct TermInterner {
+    vector<uint32_t> slots;         // id + 1, 0 for an empty slot
+    vector<string_view> terms;      // by id, pointing into arena
+    vector<size_t> hashes;          // by id
+    string arena;
+
+    // arena must hold every distinct term without moving
+    explicit TermInterner(size_t arenaBytes) : slots(1024) { arena.reserve(arenaBytes); }
+
+    uint32_t intern(string_view t) {
+        size_t h = hash<string_view>()(t);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            uint32_t s = slots[i];
+            if (s == 0) {
+                arena.append(t);
+                terms.push_back(string_view(arena.data() + arena.size() - t.size(), t.size()));
+                hashes.push_back(h);
+                slots[i] = (uint32_t)terms.size();
+                if (terms.size() * 2 > slots.size()) grow();
+                return (uint32_t)terms.size() - 1;
+            }
+            if (hashes[s - 1] == h && terms[s - 1] == t) return s - 1;
+        }
+    }
+
+    void grow() {
+        vector<uint32_t> bigger(slots.size() * 2);
+        size_t mask = bigger.size() - 1;
+        for (uint32_t id = 0; id < terms.size(); id++) {
+            size_t i = hashes[id] & mask;
+            while (bigger[i]) i = (i + 1) & mask;
+            bigger[i] = id + 1;
+        }
+        slots.swap(bigger);
+    }
+};
+
+// builds ft's index from text, its meanings back to back (meaningOff[] and
+// value[] must already be in place)
+void buildMeaningIndex(FrozenTrie* ft, string_view text) {
+    // Folding never makes a code point longer, so the distinct terms fit in
+    // text.size() bytes. Words are visited in state order, so every term
+    // sees its states in ascending order.
+    TermInterner interner(text.size());
+    vector<uint32_t> termCount;
+    vector<pair<uint32_t, uint32_t>> occurrences;   // (term id, state) in state order
+    string scratch;
+    for (uint32_t s = 0; s < ft->states; s++) {
+        int32_t e = ft->value[s];
+        if (e < 0) continue;
+        string_view meaning = text.substr(ft->meaningOff[e], ft->meaningOff[e + 1] - ft->meaningOff[e]);
+        forEachTerm(meaning, scratch, [&](string_view t) {
+            uint32_t id = interner.intern(t);
+            if (id == termCount.size()) termCount.push_back(0);
+            termCount[id]++;
+            occurrences.push_back({id, s});
+        });
+    }
+    const vector<string_view> &termById = interner.terms;
+
+    // lay the lists out in term order with one counting pass
+    vector<uint32_t> order(termById.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return termById[a] < termById[b]; });
+    vector<size_t> listStart(termById.size());
+    size_t at = 0;
+    for (uint32_t id : order) {
+        listStart[id] = at;
+        at += termCount[id];
+    }
+    vector<uint32_t> states(occurrences.size());
+    for (auto &o : occurrences) states[listStart[o.first]++] = o.second;
+    vector<pair<uint32_t, uint32_t>>().swap(occurrences);
+
+    ft->termOffStore.clear();
+    ft->postOffStore.clear();
+    ft->termTextStore.clear();
+    ft->postingsStore.clear();
+    ft->termOffStore.reserve(order.size() + 1);
+    ft->postOffStore.reserve(order.size() + 1);
+    at = 0;
+    for (uint32_t id : order) {
+        ft->termOffStore.push_back((uint32_t)ft->termTextStore.size());
+        ft->termTextStore.append(termById[id]);
+        ft->postOffStore.push_back((uint32_t)ft->postingsStore.size());
+        // a term used twice in one meaning lists its state twice in a row
+        uint32_t prev = 0;
+        for (size_t end = at + termCount[id], first = at; at < end; at++) {
+            if (at > first && states[at] == prev) continue;
+            appendVarint(ft->postingsStore, states[at] - prev);
+            prev = states[at];
+        }
+    }
+    ft->termOffStore.push_back((uint32_t)ft->termTextStore.size());
+    ft->postOffStore.push_back((uint32_t)ft->postingsStore.size());
+    attachIndexStores(ft);
+}
+
+// keys are word suffixes after the partition letter, sorted and unique
+struct FrozenBuilder {
+    const vector<TrieEntry> &entries;
+    vector<int32_t> base, check, value;
+    vector<uint32_t> maxWeight;
+    vector<uint8_t> firstChild, nextSibling;
+    vector<size_t> freeFrom;   // i if slot i is free, else a later slot with no free slot in between
+
+    explicit FrozenBuilder(const vector<TrieEntry> &entries) : entries(entries) {}
+
+    void ensureSize(size_t n) {
+        if (n <= check.size()) return;
+        size_t newSize = max(n, check.size() * 2);
+        base.resize(newSize, 0);
+        check.resize(newSize, -1);
+        value.resize(newSize, -1);
+        maxWeight.resize(newSize, 0);
+        firstChild.resize(newSize, 0);
+        nextSibling.resize(newSize, 0);
+        for (size_t i = freeFrom.size(); i < newSize; i++) freeFrom.push_back(i);
+    }
+
+    // Slots below the smallest label in use (e.g. under 'a' for ASCII words)
+    // never fill, so scanning from the first free slot would walk the whole
+    // occupied range for every node; occupied slots are skipped in one hop.
+    size_t nextFree(size_t i) {
+        size_t root = i;
+        while (true) {
+            ensureSize(root + 256);
+            if (freeFrom[root] == root) break;
+            root = freeFrom[root];
+        }
+        while (i != root) {
+            size_t next = freeFrom[i];
+            freeFrom[i] = root;
+            i = next;
+        }
+        return root;
+    }
+
+    void occupy(size_t t, int32_t parent) {
+        check[t] = parent;
+        freeFrom[t] = t + 1;
+    }
+
+    // first base where every label in codes lands on a free slot
+    int32_t findBase(const vector<int> &codes) {
+        for (size_t pos = nextFree(codes[0]); ; pos = nextFree(pos + 1)) {
+            int32_t b = (int32_t)pos - codes[0];
+            bool ok = true;
+            for (size_t i = 1; i < codes.size() && ok; i++) {
+                if (check[b + codes[i]] != -1) ok = false;
+            }
+            if (ok) return b;
+        }
+    }
+
+    // returns the highest weight placed under s
+    uint32_t place(int32_t s, size_t lo, size_t hi, size_t depth) {
+        uint32_t best = 0;
+        if (lo < hi && entries[lo].key.size() == depth) {
+            value[s] = (int32_t)lo;
+            best = entries[lo].weight;
+            lo++;
+        }
+        if (lo == hi) return maxWeight[s] = best;
+
+        vector<int> codes;
+        vector<size_t> starts;
+        for (size_t i = lo; i < hi; i++) {
+            int c = (unsigned char)entries[i].key[depth];
+            if (codes.empty() || codes.back() != c) {
+                codes.push_back(c);
+                starts.push_back(i);
+            }
+        }
+        starts.push_back(hi);
+
+        int32_t b = findBase(codes);
+        base[s] = b;
+        for (int c : codes) occupy(b + c, s);
+        firstChild[s] = (uint8_t)codes[0];
+        for (size_t i = 0; i + 1 < codes.size(); i++) nextSibling[b + codes[i]] = (uint8_t)codes[i + 1];
+        for (size_t i = 0; i < codes.size(); i++) {
+            best = max(best, place(b + codes[i], starts[i], starts[i + 1], depth + 1));
+        }
+        return maxWeight[s] = best;
+    }
+};
+
+// without withIndex the partition has no meaning index yet; the caller
+// attaches or builds one before anyone reads it
+FrozenTrie* buildFrozenTrie(const vector<TrieEntry> &entries, bool withIndex = true) {
+    FrozenBuilder builder{entries};
+    builder.ensureSize(64);
+    builder.occupy(0, 0); // root; nothing can move into slot 0
+    builder.place(0, 0, entries.size(), 0);
+
+    size_t used = builder.check.size();
+    while (used > 1 && builder.check[used - 1] == -1) used--;
+
+    FrozenTrie* ft = new FrozenTrie();
+    ft->baseStore.assign(builder.base.begin(), builder.base.begin() + used);
+    ft->checkStore.assign(builder.check.begin(), builder.check.begin() + used);
+    ft->valueStore.assign(builder.value.begin(), builder.value.begin() + used);
+    ft->maxWeightStore.assign(builder.maxWeight.begin(), builder.maxWeight.begin() + used);
+    ft->firstChildStore.assign(builder.firstChild.begin(), builder.firstChild.begin() + used);
+    ft->nextSiblingStore.assign(builder.nextSibling.begin(), builder.nextSibling.begin() + used);
+
+    string text;
+    ft->offStore.reserve(entries.size() + 1);
+    for (auto &e : entries) {
+        ft->offStore.push_back((uint32_t)text.size());
+        ft->weightStore.push_back(e.weight);
+        text += e.meaning;
+    }
+    ft->offStore.push_back((uint32_t)text.size());
+
+    HuffmanCode hc = buildHuffmanCode(text);
+    size_t blockBegin = 0;
+    for (size_t i = 0; i <= entries.size(); i++) {
+        size_t at = ft->offStore[i];
+        bool last = (i == entries.size());
+        if (at == blockBegin || (!last && at - blockBegin < MEANING_BLOCK_SIZE)) continue;
+        ft->blockStartStore.push_back((uint32_t)blockBegin);
+        ft->blockBytesStore.push_back((uint32_t)ft->packedStore.size());
+        huffmanEncode(hc, text.data() + blockBegin, at - blockBegin, ft->packedStore);
+        blockBegin = at;
+    }
+    ft->blockStartStore.push_back((uint32_t)text.size());
+    ft->blockBytesStore.push_back((uint32_t)ft->packedStore.size());
+
+    ft->base = ft->baseStore.data();
+    ft->check = ft->checkStore.data();
+    ft->value = ft->valueStore.data();
+    ft->maxWeight = ft->maxWeightStore.data();
+    ft->firstChild = ft->firstChildStore.data();
+    ft->nextSibling = ft->nextSiblingStore.data();
+    ft->meaningOff = ft->offStore.data();
+    ft->weight = ft->weightStore.data();
+    ft->blockStart = ft->blockStartStore.data();
+    ft->blockBytes = ft->blockBytesStore.data();
+    ft->packed = ft->packedStore.data();
+    ft->codeLens = hc.len;
+    ft->states = (uint32_t)used;
+    ft->entries = (uint32_t)entries.size();
+    ft->blocks = (uint32_t)ft->blockStartStore.size() - 1;
+    attachFrozenCode(ft);
+    ft->codeLens = ft->code.len;
+    if (withIndex) buildMeaningIndex(ft, text);
+    return ft;
+}
+
+// gives a partition built with every weight 0 the (entry, weight) pairs
+// saved with it. Every maxWeight started at 0, so raising it along the path
+// of each weighted word leaves each one the maximum of its subtree.
+void setFrozenWeights(FrozenTrie* ft, const vector<pair<uint32_t, uint32_t>> &weights) {
+    for (auto [e, w] : weights) {
+        if (e < ft->entries) ft->weightStore[e] = w;
+    }
+    for (uint32_t s = 0; s < ft->states; s++) {
+        if (ft->value[s] < 0) continue;
+        uint32_t w = ft->weightStore[ft->value[s]];
+        for (int32_t t = (int32_t)s; w > ft->maxWeightStore[t]; t = ft->check[t]) {
+            ft->maxWeightStore[t] = w;
+            if (t == 0) break;
+        }
+    }
+}
+
+// the partition a (non-empty) key lives in
+inline int partOf(string_view key) { return (unsigned char)key[0]; }
+
+// the one-byte key prefix that partition p stands for
+string_view partitionKey(int p) {
+    static const struct Table {
+        char bytes[FROZEN_PARTS];
+        Table() { for (int i = 0; i < FROZEN_PARTS; i++) bytes[i] = (char)i; }
+    } table;
+    return string_view(table.bytes + p, 1);
+}
+
+// returns the state key (word without its first byte) leads to, or -1
+int32_t frozenState(const FrozenTrie* ft, const char* key, size_t len) {
+    int32_t s = 0;
+    int32_t size = (int32_t)ft->states;
+    for (size_t i = 0; i < len; i++) {
+        int32_t t = ft->base[s] + (unsigned char)key[i];
+        if (t >= size || ft->check[t] != s) return -1;
+        s = t;
+    }
+    return s;
+}
+
+// returns entry index of key, or -1
+int32_t frozenFind(const FrozenTrie* ft, const char* key, size_t len) {
+    int32_t s = frozenState(ft, key, len);
+    return s < 0 ? -1 : ft->value[s];
+}
+
+struct DecodedBlock {
+    uint64_t trieId = 0;
+    uint32_t block = 0;
+    uint64_t lastUse = 0;
+    string text;
+};
+
+struct BlockCache {
+    DecodedBlock slot[BLOCK_CACHE_SLOTS];
+    uint64_t tick = 0;
+};
+
+thread_local BlockCache blockCache;
+
+// decoded text of one block, from this thread's LRU of recent blocks; only
+// the first `need` bytes are guaranteed, the rest is decoded on demand.
+// Empty, and not cached, if the block does not decode.
+string_view frozenBlock(const FrozenTrie* ft, uint32_t block, uint32_t need) {
+    BlockCache &cache = blockCache;
+    DecodedBlock* victim = &cache.slot[0];
+    DecodedBlock* hit = nullptr;
+    for (DecodedBlock &d : cache.slot) {
+        if (d.trieId == ft->id && d.block == block) {
+            hit = &d;
+            break;
+        }
+        if (d.lastUse < victim->lastUse) victim = &d;
+    }
+    if (hit) {
+        hit->lastUse = ++cache.tick;
+        if (hit->text.size() >= need) return hit->text;
+        victim = hit;
+        need = ft->blockStart[block + 1] - ft->blockStart[block];
+    }
+    victim->trieId = ft->id;
+    victim->block = block;
+    victim->lastUse = ++cache.tick;
+    victim->text.clear();
+    // blocks rarely exceed MEANING_BLOCK_SIZE by much, so after the first
+    // use a slot no longer allocates
+    victim->text.reserve(max<size_t>(2 * MEANING_BLOCK_SIZE, ft->blockStart[block + 1] - ft->blockStart[block]));
+    uint32_t from = ft->blockBytes[block];
+    if (!huffmanDecode(ft->code, ft->packed + from, ft->blockBytes[block + 1] - from, need, victim->text)) {
+        victim->trieId = 0;
+        return string_view();
+    }
+    return victim->text;
+}
+
+// a view into this thread's block cache, valid until the thread's next
+// meaning lookup; empty if the meaning's block does not decode
+string_view frozenMeaningView(const FrozenTrie* ft, int32_t entry) {
+    uint32_t from = ft->meaningOff[entry];
+    uint32_t len = ft->meaningOff[entry + 1] - from;
+    if (len == 0) return string_view();
+    // last block starting at or before this meaning
+    uint32_t block = (uint32_t)(upper_bound(ft->blockStart, ft->blockStart + ft->blocks, from) - ft->blockStart) - 1;
+    uint32_t at = from - ft->blockStart[block];
+    string_view text = frozenBlock(ft, block, at + len);
+    if (text.size() < at + len) return string_view();
+    return text.substr(at, len);
+}
+
+string frozenMeaning(const FrozenTrie* ft, int32_t entry) {
+    return string(frozenMeaningView(ft, entry));
+}
+
+// every meaning of ft back to back, bypassing the block cache; empty if a
+// block does not decode
+string frozenText(const FrozenTrie* ft) {
+    string text;
+    text.reserve(ft->textSize());
+    for (uint32_t b = 0; b < ft->blocks; b++) {
+        uint32_t from = ft->blockBytes[b];
+        if (!huffmanDecode(ft->code, ft->packed + from, ft->blockBytes[b + 1] - from,
+                           ft->blockStart[b + 1] - ft->blockStart[b], text)) {
+            return string();
+        }
+    }
+    return text;
+}
+
+// gives a partition loaded without a meaning index (see buildFrozenTrie) its
+// index; text that does not decode is indexed as blank
+void indexFrozenTrie(FrozenTrie* ft) {
+    string text = frozenText(ft);
+    if (text.size() != ft->textSize()) text.assign(ft->textSize(), ' ');
+    buildMeaningIndex(ft, text);
+}
+
+// Lookup frequency feeds the autocomplete ranking. Only one lookup in
+// LOOKUP_SAMPLE_RATE touches the shared counter, so hot words do not
+// bounce a cache line between reader cores on every hit.
+const uint32_t LOOKUP_SAMPLE_RATE = 16;
+thread_local uint32_t lookupSampleTick = 0;
+
+void countLookup(const FrozenTrie* ft, int32_t entry) {
+    if (++lookupSampleTick % LOOKUP_SAMPLE_RATE == 0) {
+        uint32_t n = ft->hits[entry].fetch_add(LOOKUP_SAMPLE_RATE, memory_order_relaxed) + LOOKUP_SAMPLE_RATE;
+        uint32_t seen = ft->maxHits.load(memory_order_relaxed);
+        while (n > seen && !ft->maxHits.compare_exchange_weak(seen, n, memory_order_relaxed)) {}
+    }
+}
+
+// weights include the lookups counted since the partition was built
+uint32_t frozenWeight(const FrozenTrie* ft, int32_t entry) {
+    uint64_t w = (uint64_t)ft->weight[entry] + ft->hits[entry].load(memory_order_relaxed);
+    return (uint32_t)min<uint64_t>(w, UINT32_MAX);
+}
+
+void collectFrozenWords(const FrozenTrie* ft, int32_t s, string &current, vector<TrieEntry> &out) {
+    int32_t entry = ft->value[s];
+    if (entry >= 0) {
+        out.push_back({current, frozenMeaning(ft, entry), frozenWeight(ft, entry)});
+    }
+    for (int c = ft->firstChild[s]; c != 0; c = ft->nextSibling[ft->base[s] + c]) {
+        current.push_back((char)c);
+        collectFrozenWords(ft, ft->base[s] + c, current, out);
+        current.pop_back();
+    }
+}
+
+// ======================= LOOKUP CACHE SECTION =======================
+// Optional cache in front of searchInTrie for skewed traffic: raw query
+// string -> found flag + decoded meaning, so a hit skips normalization, the
+// trie walk and the meaning decode. Misses are cached too. It is sharded by
+// hash, each shard an open-addressing table (linear probing,
+// backward-shift deletion) over a fixed entry array recycled by CLOCK; a
+// new entry starts unreferenced, so one-off queries are the first to go.
+//
+// Hits take no lock. Stores hold the shard's mutex and rewrite an entry
+// between two bumps of its version (a seqlock); a reader that sees the
+// version change, or a slot move under it, just takes a miss. Entry text
+// lives in buffers that are only ever swapped for larger ones, kept until
+// the table goes, and tables are retired like a replaced DictState, so a
+// racing reader never touches freed memory. Hit and miss counts are
+// per-thread metrics rather than shared counters.
+//
+// Invalidation: every entry remembers which of CACHE_EPOCH_BUCKETS its
+// normalized word hashes to and that bucket's epoch when it was filled. An
+// insert bumps its word's bucket and a full reload bumps the generation, so
+// a stale entry fails the check on its next hit. Writers bump after
+// publishing and fillers read the epoch before loading the state, so an
+// entry can never be stamped newer than what it holds.
+
+const int CACHE_SHARDS = 64;
+const size_t CACHE_EPOCH_BUCKETS = 1 << 16;
+const size_t CACHE_MAX_KEY = 256;         // longer queries are not cached
+const size_t CACHE_MAX_MEANING = 1024;    // longer meanings are not cached
+
+// key then meaning, packed into words so a reader racing a store gets torn
+// but defined values
+struct CacheText {
+    vector<atomic<uint64_t>> words;
+
+    explicit CacheText(size_t n) : words(n) {}
+};
+
+// written only under the shard lock, between two bumps of version (odd while
+// a store is under way)
+struct CacheEntry {
+    atomic<uint32_t> version{0};
+    atomic<size_t> hash{0};
+    atomic<uint64_t> generation{0};
+    atomic<uint32_t> bucket{0};
+    atomic<uint32_t> epoch{0};
+    atomic<uint32_t> keyLen{0};
+    atomic<uint32_t> meaningLen{0};
+    atomic<bool> found{false};
+    atomic<bool> referenced{false};
+    atomic<CacheText*> text{nullptr};
+};
+
+struct CacheTable {
+    vector<CacheEntry> entries;
+    vector<atomic<int32_t>> slots;          // index into entries, -1 = empty; size a power of two
+    vector<unique_ptr<CacheText>> texts;    // every buffer an entry has used, outgrown ones too
+    size_t used = 0;
+    size_t hand = 0;
+
+    CacheTable(size_t capacity, size_t slotCount) : entries(capacity), slots(slotCount) {
+        for (auto &slot : slots) slot.store(-1, memory_order_relaxed);
+    }
+};
+
+struct alignas(64) CacheShard {
+    mutex lock;                             // for stores; hits only read
+    atomic<CacheTable*> table{nullptr};
+};
+
+CacheShard cacheShards[CACHE_SHARDS];
+atomic<bool> lookupCacheOn{false};
+atomic<uint64_t> cacheGeneration{1};
+atomic<uint32_t> cacheWordEpoch[CACHE_EPOCH_BUCKETS];
+// hit and miss metrics when the cache was last configured
+atomic<uint64_t> cacheHitsBefore{0}, cacheMissesBefore{0};
+
+struct CacheTicket {
+    uint64_t generation;
+    uint32_t bucket;
+    uint32_t epoch;
+};
+
+CacheShard &cacheShardOf(size_t hash) {
+    return cacheShards[hash % CACHE_SHARDS];
+}
+
+size_t cacheHome(const CacheTable &t, size_t hash) {
+    return (hash / CACHE_SHARDS) & (t.slots.size() - 1);
+}
+
+// copies len bytes from byte off of text; false if they lie beyond it (a torn read)
+bool cacheReadText(const CacheText* text, size_t off, size_t len, char* out) {
+    if (!text || off + len > text->words.size() * 8) return false;
+    for (size_t i = 0; i < len;) {
+        uint64_t word = text->words[(off + i) / 8].load(memory_order_relaxed);
+        size_t from = (off + i) % 8, n = min(8 - from, len - i);
+        memcpy(out + i, (const char*)&word + from, n);
+        i += n;
+    }
+    return true;
+}
+
+void cacheWriteText(CacheText &text, string_view key, string_view meaning) {
+    size_t total = key.size() + meaning.size();
+    for (size_t w = 0; w * 8 < total; w++) {
+        char bytes[8] = {};
+        for (size_t b = 0; b < 8 && w * 8 + b < total; b++) {
+            size_t i = w * 8 + b;
+            bytes[b] = i < key.size() ? key[i] : meaning[i - key.size()];
+        }
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        text.words[w].store(word, memory_order_relaxed);
+    }
+}
+
+// caller holds the shard lock; the slot holding key, or the empty slot where it would go
+size_t cacheProbe(const CacheTable &t, size_t hash, string_view key) {
+    size_t mask = t.slots.size() - 1;
+    size_t i = cacheHome(t, hash);
+    char stored[CACHE_MAX_KEY];
+    while (true) {
+        int32_t at = t.slots[i].load(memory_order_relaxed);
+        if (at < 0) break;
+        const CacheEntry &e = t.entries[at];
+        if (e.hash.load(memory_order_relaxed) == hash && e.keyLen.load(memory_order_relaxed) == key.size() &&
+            cacheReadText(e.text.load(memory_order_relaxed), 0, key.size(), stored) &&
+            memcmp(stored, key.data(), key.size()) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// caller holds the shard lock; empties slot i and shifts back the run after it
+void cacheUnlink(CacheTable &t, size_t i) {
+    size_t mask = t.slots.size() - 1;
+    for (size_t j = (i + 1) & mask; t.slots[j].load(memory_order_relaxed) >= 0; j = (j + 1) & mask) {
+        int32_t moving = t.slots[j].load(memory_order_relaxed);
+        size_t home = cacheHome(t, t.entries[moving].hash.load(memory_order_relaxed));
+        // the entry at j may move to i unless its home lies cyclically in (i, j]
+        bool stays = i < j ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        t.slots[i].store(moving, memory_order_release);
+        i = j;
+    }
+    t.slots[i].store(-1, memory_order_release);
+}
+
+bool cacheEntryValid(uint64_t generation, uint32_t bucket, uint32_t epoch) {
+    return generation == cacheGeneration.load(memory_order_acquire) && bucket < CACHE_EPOCH_BUCKETS &&
+           epoch == cacheWordEpoch[bucket].load(memory_order_acquire);
+}
+
+// 1 = cached as found (meaning filled), 0 = cached as missing, -1 = not
+// cached. Lock-free; the caller holds a ReadGuard, which keeps the table alive.
+int cacheFind(string_view key, size_t hash, string &meaning) {
+    CacheTable* t = cacheShardOf(hash).table.load(memory_order_acquire);
+    if (!t || t->entries.empty()) return -1;
+    size_t mask = t->slots.size() - 1;
+    char stored[CACHE_MAX_KEY];
+    // bounded, since stores may shift slots around during the probe
+    for (size_t i = cacheHome(*t, hash), n = 0; key.size() <= CACHE_MAX_KEY && n <= mask; i = (i + 1) & mask, n++) {
+        int32_t at = t->slots[i].load(memory_order_acquire);
+        if (at < 0) break;
+        CacheEntry &e = t->entries[at];
+        uint32_t version = e.version.load(memory_order_acquire);
+        if ((version & 1) || e.hash.load(memory_order_relaxed) != hash) continue;
+        const CacheText* text = e.text.load(memory_order_acquire);
+        size_t keyLen = e.keyLen.load(memory_order_relaxed);
+        size_t meaningLen = e.meaningLen.load(memory_order_relaxed);
+        if (keyLen != key.size() || !cacheReadText(text, 0, keyLen, stored) ||
+            memcmp(stored, key.data(), keyLen) != 0) {
+            continue;
+        }
+        bool found = e.found.load(memory_order_relaxed);
+        if (found) {
+            if (meaningLen > CACHE_MAX_MEANING) break;
+            meaning.resize(meaningLen);
+            if (!cacheReadText(text, keyLen, meaningLen, &meaning[0])) break;
+        }
+        uint64_t generation = e.generation.load(memory_order_relaxed);
+        uint32_t bucket = e.bucket.load(memory_order_relaxed);
+        uint32_t epoch = e.epoch.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        // rewritten while being read, or stale: a miss either way
+        if (e.version.load(memory_order_relaxed) != version || !cacheEntryValid(generation, bucket, epoch)) break;
+        if (!e.referenced.load(memory_order_relaxed)) e.referenced.store(true, memory_order_relaxed);
+        countMetric(MC_CACHE_HITS);
+        return found ? 1 : 0;
+    }
+    countMetric(MC_CACHE_MISSES);
+    return -1;
+}
+
+// taken before the lookup whose answer is to be cached
+CacheTicket cacheTicket(string_view normalized) {
+    uint32_t bucket = (uint32_t)(hash<string_view>()(normalized) % CACHE_EPOCH_BUCKETS);
+    return {cacheGeneration.load(memory_order_acquire), bucket,
+            cacheWordEpoch[bucket].load(memory_order_acquire)};
+}
+
+void cacheStore(string_view key, size_t hash, const CacheTicket &tk, bool found, string_view meaning) {
+    if (key.size() > CACHE_MAX_KEY || meaning.size() > CACHE_MAX_MEANING) return;
+    CacheShard &s = cacheShardOf(hash);
+    lock_guard<mutex> lock(s.lock);
+    CacheTable* t = s.table.load(memory_order_relaxed);
+    if (!t || t->entries.empty()) return;
+    size_t slot = cacheProbe(*t, hash, key);
+    int32_t at = t->slots[slot].load(memory_order_relaxed);
+    bool fresh = at < 0;
+    if (fresh) {
+        if (t->used < t->entries.size()) {
+            at = (int32_t)t->used++;
+        } else {
+            // CLOCK: a referenced entry gets another round
+            while (t->entries[t->hand].referenced.load(memory_order_relaxed)) {
+                t->entries[t->hand].referenced.store(false, memory_order_relaxed);
+                t->hand = (t->hand + 1) % t->entries.size();
+            }
+            at = (int32_t)t->hand;
+            t->hand = (t->hand + 1) % t->entries.size();
+            // find the victim's slot by index, which is cheaper than by key
+            size_t mask = t->slots.size() - 1;
+            size_t victim = cacheHome(*t, t->entries[at].hash.load(memory_order_relaxed));
+            while (t->slots[victim].load(memory_order_relaxed) != at) victim = (victim + 1) & mask;
+            cacheUnlink(*t, victim);
+            slot = cacheProbe(*t, hash, key);
+        }
+    }
+    CacheEntry &e = t->entries[at];
+    CacheText* text = e.text.load(memory_order_relaxed);
+    size_t bytes = key.size() + meaning.size();
+    if (!text || text->words.size() * 8 < bytes) {
+        // the old buffer stays in texts, as a reader may still be copying from it
+        size_t words = max<size_t>((bytes + 7) / 8, text ? text->words.size() * 2 : 4);
+        t->texts.emplace_back(new CacheText(words));
+        text = t->texts.back().get();
+    }
+    uint32_t version = e.version.load(memory_order_relaxed);
+    e.version.store(version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    cacheWriteText(*text, key, meaning);
+    e.text.store(text, memory_order_release);
+    e.hash.store(hash, memory_order_relaxed);
+    e.keyLen.store((uint32_t)key.size(), memory_order_relaxed);
+    e.meaningLen.store((uint32_t)meaning.size(), memory_order_relaxed);
+    e.generation.store(tk.generation, memory_order_relaxed);
+    e.bucket.store(tk.bucket, memory_order_relaxed);
+    e.epoch.store(tk.epoch, memory_order_relaxed);
+    e.found.store(found, memory_order_relaxed);
+    if (fresh) e.referenced.store(false, memory_order_relaxed);
+    e.version.store(version + 2, memory_order_release);
+    if (fresh) t->slots[slot].store(at, memory_order_release);
+}
+
+// called after publishing a state that changes word's meaning
+void invalidateCachedWord(string_view normalized) {
+    if (!lookupCacheOn.load(memory_order_relaxed)) return;
+    cacheWordEpoch[hash<string_view>()(normalized) % CACHE_EPOCH_BUCKETS].fetch_add(1, memory_order_release);
+}
+
+// called after publishing a state that replaces the whole dictionary
+void invalidateLookupCache() {
+    cacheGeneration.fetch_add(1, memory_order_release);
+}
+
+struct LookupCacheStats {
+    size_t entries = 0;
+    size_t capacity = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// hits and misses since the cache was last configured; 0 with MYDIC_NO_METRICS
+LookupCacheStats readLookupCacheStats() {
+    LookupCacheStats st;
+    for (CacheShard &s : cacheShards) {
+        lock_guard<mutex> lock(s.lock);
+        CacheTable* t = s.table.load(memory_order_relaxed);
+        if (!t) continue;
+        st.entries += t->used;
+        st.capacity += t->entries.size();
+    }
+    MetricsSnapshot m = readMetrics();
+    st.hits = m.counters[MC_CACHE_HITS] - cacheHitsBefore.load();
+    st.misses = m.counters[MC_CACHE_MISSES] - cacheMissesBefore.load();
+    return st;
+}
+
+// ======================= DICTIONARY STATE SECTION =======================
+// The whole dictionary (write buffer + frozen partitions) is one immutable
+// DictState reached through an atomic pointer. Lookups never lock: they pin
+// the current epoch, load the pointer and read. Writers serialize on
+// writerMutex, build the next state off to the side (copying only what
+// changes), publish it with one atomic store and retire what the new state
+// no longer uses. Retired memory is freed once every reader that could
+// have seen it has finished.
+//
+// That holds while the partitions a lookup reads are in memory. The first
+// reader of a pending partition (not decoded yet, or evicted) decodes it
+// under lazyPartMutex[p] and then takes writerMutex to attach it, so it
+// waits behind any writer or log fsync, and other readers of that partition
+// wait for it. A batch does this at most once per partition.
+
+// frozen partitions left out of memory until first use, e.g. those of a
+// Huffman snapshot opened lazily. decode builds partition p, or returns
+// nullptr if it cannot be read.
+struct LazyParts {
+    string source;                // for error messages
+    uint64_t words[FROZEN_PARTS] = {};
+    function<FrozenTrie*(int)> decode;
+};
+
+struct DictState {
+    TrieNode* buffer = nullptr;   // newest inserts, shadows the frozen parts
+    shared_ptr<BufferArena> arena; // the buffer's memory, shared until the next freeze
+    size_t bufferedWords = 0;     // including tombstones
+    size_t tombstones = 0;        // buffered deletes of frozen words
+    size_t shadowed = 0;          // buffered words that replace a frozen copy
+    FrozenTrie* parts[FROZEN_PARTS] = {};
+    size_t frozenWords = 0;       // including pending partitions
+    uint64_t walSeq = 0;          // last write-ahead log record applied
+    shared_ptr<const LazyParts> lazy;
+    bitset<FROZEN_PARTS> pending;   // parts[p] is still in lazy (never decoded, or evicted)
+    bitset<FROZEN_PARTS> evictable; // parts[p] is lazy's copy, so it can be dropped again
+    bitset<FROZEN_PARTS> failed;    // pending, but lazy could not decode it: reads as
+                                    // empty, refuses writes and is never saved over
+};
+
+atomic<DictState*> dictState{new DictState()};
+mutex writerMutex;
+
+// partitions whose words or weights changed since the last Huffman snapshot was saved
+// or loaded; guarded by writerMutex
+bitset<FROZEN_PARTS> unsavedParts;
+
+// ----- epoch-based reclamation -----
+// A reading thread stores the global epoch in its slot while it reads and
+// 0 when idle. Something retired at epoch r can be freed once no slot holds
+// an epoch <= r: later readers loaded the epoch after the new state was
+// published, so they cannot reach the old one. Slots come in blocks; when
+// every slot is taken a thread appends another block, so a reader never waits
+// for another thread to exit. Blocks live until the program ends.
+
+const int READER_SLOTS = 128;
+
+struct alignas(64) ReaderSlot {
+    atomic<uint64_t> epoch{0};
+    atomic<bool> taken{false};
+};
+
+struct ReaderBlock {
+    ReaderSlot slots[READER_SLOTS];
+    atomic<ReaderBlock*> next{nullptr};
+};
+
+ReaderBlock firstReaderBlock;
+atomic<uint64_t> globalEpoch{1};
+
+struct RetiredItem {
+    uint64_t epoch;
+    function<void()> release;
+};
+
+vector<RetiredItem> retiredItems; // guarded by writerMutex
+
+// claims a slot for the calling thread, given back when the thread exits
+struct ThreadReaderSlot {
+    ReaderSlot* slot = nullptr;
+    int depth = 0;
+
+    ReaderSlot* get() {
+        ReaderBlock* block = &firstReaderBlock;
+        while (!slot) {
+            for (ReaderSlot &r : block->slots) {
+                bool expected = false;
+                if (r.taken.compare_exchange_strong(expected, true)) {
+                    slot = &r;
+                    break;
+                }
+            }
+            if (slot) break;
+            ReaderBlock* next = block->next.load();
+            if (!next) {
+                auto* fresh = new ReaderBlock();
+                if (block->next.compare_exchange_strong(next, fresh)) {
+                    next = fresh;
+                } else {
+                    delete fresh; // another thread appended first; next is its block
+                }
+            }
+            block = next;
+        }
+        return slot;
+    }
+
+    ~ThreadReaderSlot() {
+        if (slot) slot->taken.store(false);
+    }
+};
+
+thread_local ThreadReaderSlot threadReaderSlot;
+
+// keeps whatever state the caller loads alive until it goes out of scope
+struct ReadGuard {
+    ReadGuard() {
+        if (threadReaderSlot.depth++ == 0) {
+            threadReaderSlot.get()->epoch.store(globalEpoch.load());
+        }
+    }
+    ~ReadGuard() {
+        if (--threadReaderSlot.depth == 0) {
+            threadReaderSlot.slot->epoch.store(0, memory_order_release);
+        }
+    }
+};
+
+// caller holds writerMutex
+void reclaimRetired() {
+    uint64_t oldest = UINT64_MAX;
+    for (ReaderBlock* b = &firstReaderBlock; b; b = b->next.load()) {
+        for (ReaderSlot &r : b->slots) {
+            uint64_t e = r.epoch.load();
+            if (e != 0) oldest = min(oldest, e);
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < retiredItems.size(); i++) {
+        if (retiredItems[i].epoch < oldest) {
+            retiredItems[i].release();
+        } else {
+            retiredItems[kept++] = move(retiredItems[i]);
+        }
+    }
+    retiredItems.resize(kept);
+}
+
+// caller holds writerMutex and has just unlinked what release frees
+void retireLocked(function<void()> release) {
+    uint64_t epoch = globalEpoch.fetch_add(1);
+    retiredItems.push_back({epoch, move(release)});
+    reclaimRetired();
+}
+
+// caller holds writerMutex; release frees what `next` no longer uses
+void publishState(DictState* next, function<void()> release) {
+    dictState.store(next);
+    retireLocked(move(release));
+}
+
+// frees a state that shares nothing with the published one
+void freeWholeState(DictState* st) {
+    for (FrozenTrie* ft : st->parts) delete ft;
+    delete st;
+}
+
+// swaps in a state built off to the side, e.g. by a full reload. Unless it
+// is a snapshot with its own log position, the fresh state replaces
+// everything logged so far, so a snapshot of it must not replay those records.
+void replaceDictionaryLocked(DictState* fresh, bool supersedesLog = true) {
+    DictState* old = dictState.load();
+    if (supersedesLog) fresh->walSeq = old->walSeq;
+    unsavedParts.set();
+    publishState(fresh, [old] { freeWholeState(old); });
+    invalidateLookupCache();
+}
+
+void replaceDictionary(DictState* fresh, bool supersedesLog = true) {
+    lock_guard<mutex> lock(writerMutex);
+    replaceDictionaryLocked(fresh, supersedesLog);
+}
+
+void clearDictionary() {
+    replaceDictionary(new DictState());
+}
+
+// sizes (and empties) the lookup cache; 0 turns it off. Hits read the old
+// tables without a lock, so they are retired like a replaced state.
+void configureLookupCache(size_t entries) {
+    lookupCacheOn = false;
+    size_t perShard = (entries + CACHE_SHARDS - 1) / CACHE_SHARDS;
+    size_t slotCount = 1;
+    while (slotCount < perShard * 2) slotCount <<= 1;
+    lock_guard<mutex> lock(writerMutex);
+    vector<CacheTable*> old;
+    for (CacheShard &s : cacheShards) {
+        lock_guard<mutex> shard(s.lock);
+        old.push_back(s.table.exchange(perShard ? new CacheTable(perShard, slotCount) : nullptr));
+    }
+    retireLocked([old] {
+        for (CacheTable* t : old) delete t;
+    });
+    MetricsSnapshot m = readMetrics();
+    cacheHitsBefore = m.counters[MC_CACHE_HITS];
+    cacheMissesBefore = m.counters[MC_CACHE_MISSES];
+    lookupCacheOn = entries > 0;
+}
+
+size_t frozenWordCount() {
+    ReadGuard guard;
+    return dictState.load()->frozenWords;
+}
+
+// ----- lazily decoded partitions -----
+// A state opened from a snapshot starts with its partitions pending: only
+// the snapshot's table is in memory. The first reader of a partition decodes
+// it and publishes a state that has it. With a budget set, attaching one
+// partition may drop others that were not read since the CLOCK hand last
+// passed them; they are decoded again when next needed. Partitions changed
+// since they were decoded are never dropped.
+
+atomic<size_t> lazyBudget{0};                // bytes of decoded lazy partitions to keep, 0 = no limit
+atomic<bool> partReferenced[FROZEN_PARTS];   // CLOCK reference bits
+int evictionHand = 0;                        // guarded by writerMutex
+mutex lazyPartMutex[FROZEN_PARTS];           // one decode per partition at a time
+
+size_t partitionWords(const DictState* st, int p) {
+    if (st->parts[p]) return st->parts[p]->entryCount();
+    return st->pending[p] ? st->lazy->words[p] : 0;
+}
+
+FrozenTrie* decodePartition(const LazyParts &lazy, int p) {
+    MetricTimer timer(MH_PARTITION_DECODE);
+    countMetric(MC_PARTITION_DECODES);
+    return lazy.decode(p);
+}
+
+// partition p of st without publishing anything; a pending one is decoded
+// into owner, and null with st->pending[p] still set means it could not be.
+// Safe to call with writerMutex held.
+const FrozenTrie* peekPartition(const DictState* st, int p, unique_ptr<FrozenTrie> &owner) {
+    if (!st->pending[p]) return st->parts[p];
+    owner.reset(decodePartition(*st->lazy, p));
+    return owner.get();
+}
+
+// caller holds writerMutex and partition p of the current state is pending;
+// publishes a state holding ft (its decoded copy) and evicts over budget.
+// A null ft marks p failed instead: its words stay in lazy, unreachable but
+// not lost, until the dictionary is replaced.
+FrozenTrie* attachPartitionLocked(int p, FrozenTrie* ft) {
+    DictState* old = dictState.load();
+    DictState* next = new DictState(*old);
+    if (!ft) {
+        next->failed.set(p);
+        cerr << "Cannot decode partition " << p << " of " << old->lazy->source
+             << "; its words cannot be read or changed.\n";
+        publishState(next, [old] { delete old; });
+        return nullptr;
+    }
+    next->pending.reset(p);
+    next->parts[p] = ft;
+    next->evictable.set(p);
+    next->frozenWords = next->frozenWords - old->lazy->words[p] + ft->entryCount();
+    partReferenced[p].store(true, memory_order_relaxed);
+
+    vector<FrozenTrie*> evicted;
+    size_t budget = lazyBudget.load();
+    size_t resident = 0;
+    for (int q = 0; q < FROZEN_PARTS && budget; q++) {
+        if (next->evictable[q]) resident += next->parts[q]->bytesUsed();
+    }
+    // two sweeps clear every reference bit, so this always ends
+    for (int steps = 0; budget && resident > budget && steps < 2 * FROZEN_PARTS; steps++) {
+        int q = evictionHand;
+        evictionHand = (evictionHand + 1) % FROZEN_PARTS;
+        if (q == p || !next->evictable[q]) continue;
+        if (partReferenced[q].exchange(false, memory_order_relaxed)) continue;
+        resident -= next->parts[q]->bytesUsed();
+        evicted.push_back(next->parts[q]);
+        next->parts[q] = nullptr;
+        next->evictable.reset(q);
+        next->pending.set(q);
+    }
+    countMetric(MC_PARTITION_EVICTIONS, evicted.size());
+    publishState(next, [old, evicted] {
+        for (FrozenTrie* e : evicted) delete e;
+        delete old;
+    });
+    return ft;
+}
+
+// caller holds writerMutex; partition p of the current state, decoded if needed
+FrozenTrie* loadPartitionLocked(int p) {
+    DictState* st = dictState.load();
+    if (!st->pending[p] || st->failed[p]) return st->parts[p];
+    return attachPartitionLocked(p, decodePartition(*st->lazy, p));
+}
+
+// caller holds writerMutex; false if partition p could not be decoded, since
+// a write would then freeze it into a partition without its other words
+bool partitionWritableLocked(int p) {
+    loadPartitionLocked(p);
+    return !dictState.load()->failed[p];
+}
+
+// partition p for a reader holding a ReadGuard on st. A pending partition is
+// decoded outside writerMutex and the answer then comes from the state that
+// has it, so a reader of an older state may see a newer dictionary.
+FrozenTrie* frozenPart(const DictState* st, int p) {
+    if (st->failed[p]) return nullptr;
+    if (!st->pending[p]) {
+        if (st->evictable[p] && !partReferenced[p].load(memory_order_relaxed)) {
+            partReferenced[p].store(true, memory_order_relaxed);
+        }
+        return st->parts[p];
+    }
+    lock_guard<mutex> once(lazyPartMutex[p]);
+    shared_ptr<const LazyParts> lazy;
+    {
+        DictState* cur = dictState.load();
+        if (!cur->pending[p] || cur->failed[p]) return cur->parts[p];
+        lazy = cur->lazy;
+    }
+    FrozenTrie* ft = decodePartition(*lazy, p);
+    lock_guard<mutex> lock(writerMutex);
+    DictState* cur = dictState.load();
+    if (cur->pending[p] && cur->lazy == lazy) return attachPartitionLocked(p, ft);
+    delete ft;   // a writer decoded it first, or the dictionary was replaced
+    return loadPartitionLocked(p);
+}
+
+// ----- reads and writes against a state -----
+
+// sorted (suffix, meaning) pairs of one partition, buffered words winning
+vector<TrieEntry> collectPartition(const DictState* st, int p) {
+    vector<TrieEntry> frozen, buffered, merged;
+    string current;
+    unique_ptr<FrozenTrie> decoded;
+    const FrozenTrie* ft = st->failed[p] ? nullptr : peekPartition(st, p, decoded);
+    if (ft) collectFrozenWords(ft, 0, current, frozen);
+    collectBufferPrefix(st->buffer, partitionKey(p), buffered);
+    for (TrieEntry &e : buffered) e.key.erase(0, 1);
+
+    size_t i = 0, j = 0;
+    while (i < frozen.size() || j < buffered.size()) {
+        if (j == buffered.size() || (i < frozen.size() && frozen[i].key < buffered[j].key)) {
+            merged.push_back(move(frozen[i++]));
+        } else {
+            if (i < frozen.size() && frozen[i].key == buffered[j].key) i++;
+            if (!buffered[j].erased) merged.push_back(move(buffered[j]));
+            j++;
+        }
+    }
+    return merged;
+}
+
+// caller holds writerMutex; folds the write buffer into the partitions it touches
+void freezeLocked() {
+    DictState* old = dictState.load();
+    if (old->bufferedWords == 0) return;
+    MetricTimer timer(MH_FREEZE);
+    countMetric(MC_FREEZES);
+    DictState* next = new DictState(*old);
+    vector<FrozenTrie*> replaced;
+    vector<TrieEntry> buffered;
+    string current;
+    collectTrieWords(old->buffer, current, buffered);
+    vector<bool> touched(FROZEN_PARTS);
+    for (TrieEntry &e : buffered) touched[partOf(e.key)] = true;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (!touched[p]) continue;
+        // deletes can leave a partition empty
+        vector<TrieEntry> entries = collectPartition(old, p);
+        FrozenTrie* rebuilt = entries.empty() ? nullptr : buildFrozenTrie(entries);
+        next->frozenWords -= partitionWords(old, p);
+        if (old->parts[p]) replaced.push_back(old->parts[p]);
+        next->frozenWords += entries.size();
+        next->parts[p] = rebuilt;
+        next->pending.reset(p);
+        next->evictable.reset(p);
+    }
+    next->buffer = nullptr;
+    next->arena.reset();
+    next->bufferedWords = 0;
+    next->tombstones = 0;
+    next->shadowed = 0;
+    // the old buffer's arena goes with the last state that still uses it
+    publishState(next, [old, replaced] {
+        for (FrozenTrie* ft : replaced) delete ft;
+        delete old;
+    });
+}
+
+void freezeTrie() {
+    lock_guard<mutex> lock(writerMutex);
+    freezeLocked();
+}
+
+// caller holds writerMutex and has frozen the buffer; rebuilds every
+// partition in `which` after `edit` has adjusted its entries
+void rebuildPartitionsLocked(const vector<bool> &which, const function<void(int, vector<TrieEntry>&)> &edit) {
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (which[p]) loadPartitionLocked(p);
+    }
+    DictState* old = dictState.load();
+    DictState* next = new DictState(*old);
+    vector<FrozenTrie*> replaced;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (!which[p] || !old->parts[p]) continue;
+        vector<TrieEntry> entries = collectPartition(old, p);
+        edit(p, entries);
+        next->frozenWords = next->frozenWords - partitionWords(old, p) + entries.size();
+        next->parts[p] = buildFrozenTrie(entries);
+        next->pending.reset(p);
+        next->evictable.reset(p);
+        unsavedParts.set(p);
+        replaced.push_back(old->parts[p]);
+    }
+    if (replaced.empty()) {
+        delete next;
+        return;
+    }
+    publishState(next, [old, replaced] {
+        for (FrozenTrie* ft : replaced) delete ft;
+        delete old;
+    });
+}
+
+// caller holds writerMutex; makes counted lookups part of the stored
+// weights, e.g. before saving. Leaves the buffer empty.
+void foldLookupCountsLocked() {
+    freezeLocked();
+    DictState* st = dictState.load();
+    vector<bool> which(FROZEN_PARTS, false);
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        FrozenTrie* ft = st->parts[p];
+        for (uint32_t e = 0; ft && e < ft->entries && !which[p]; e++) {
+            if (ft->hits[e].load(memory_order_relaxed)) which[p] = true;
+        }
+    }
+    // collectPartition already reports weight + hits
+    rebuildPartitionsLocked(which, [](int, vector<TrieEntry>&) {});
+}
+
+// "word score" per line; sets the weight of words already in the dictionary
+size_t importWordWeights(istream &in) {
+    vector<unordered_map<string,uint32_t>> scores(FROZEN_PARTS);
+    string word;
+    uint64_t score;
+    while (in >> word >> score) {
+        word = normalizeWord(word);
+        if (word.empty()) continue;
+        scores[partOf(word)][word.substr(1)] = (uint32_t)min<uint64_t>(score, UINT32_MAX);
+    }
+
+    lock_guard<mutex> lock(writerMutex);
+    freezeLocked();
+    vector<bool> which(FROZEN_PARTS);
+    for (int p = 0; p < FROZEN_PARTS; p++) which[p] = !scores[p].empty();
+    size_t updated = 0;
+    rebuildPartitionsLocked(which, [&](int p, vector<TrieEntry> &entries) {
+        for (TrieEntry &e : entries) {
+            auto it = scores[p].find(e.key);
+            if (it == scores[p].end()) continue;
+            e.weight = it->second;
+            updated++;
+        }
+    });
+    return updated;
+}
+
+// builds a complete state from raw (word, meaning) entries; later duplicates win
+DictState* buildDictState(vector<TrieEntry> entries) {
+    for (auto &e : entries) e.key = normalizeWord(e.key);
+    vector<size_t> order;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].key.empty()) order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return entries[a].key < entries[b].key;
+    });
+
+    DictState* st = new DictState();
+    vector<TrieEntry> part;
+    for (size_t k = 0; k < order.size(); k++) {
+        auto &e = entries[order[k]];
+        if (k + 1 < order.size() && entries[order[k + 1]].key == e.key) continue;
+        part.push_back({e.key.substr(1), move(e.meaning), e.weight});
+        bool partEnds = (k + 1 == order.size() || entries[order[k + 1]].key[0] != e.key[0]);
+        if (partEnds) {
+            st->parts[partOf(e.key)] = buildFrozenTrie(part);
+            st->frozenWords += part.size();
+            part.clear();
+        }
+    }
+    return st;
+}
+
+// all (word, meaning) pairs in sorted order, frozen and buffered
+void collectAllWords(vector<pair<string,string>> &out) {
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        for (auto &e : collectPartition(st, p)) {
+            out.push_back({string(partitionKey(p)) + e.key, move(e.meaning)});
+        }
+    }
+}
+
+// ----- buffer compaction -----
+// Path copying recycles nodes through the arena's free lists, but a meaning
+// that is overwritten or deleted stays behind, and free lists of one node
+// size do not serve another. Under churn that barely grows the buffer (a
+// word inserted and deleted over and over never reaches a freeze) the arena
+// would only grow, so once half of it is waste the live buffer is copied
+// into a fresh arena and the old one goes with the state that used it.
+
+const size_t COMPACT_MIN_WASTE = 1 << 20;
+
+// caller holds writerMutex
+void compactBufferLocked() {
+    MetricTimer timer(MH_COMPACT);
+    countMetric(MC_COMPACTIONS);
+    DictState* old = dictState.load();
+    DictState* next = new DictState(*old);
+    next->arena = make_shared<BufferArena>();
+    next->buffer = compactBuffer(*next->arena, old->buffer);
+    publishState(next, [old] { delete old; });
+}
+
+// caller holds writerMutex; after a write, folds a full buffer into the
+// frozen tries or compacts one that is mostly waste
+void maintainBufferLocked() {
+    DictState* st = dictState.load();
+    if (st->bufferedWords >= max(FREEZE_THRESHOLD, st->frozenWords / 4)) {
+        freezeLocked();
+    } else if (st->arena && st->arena->waste() > max(COMPACT_MIN_WASTE, st->arena->reserved / 2)) {
+        compactBufferLocked();
+    }
+}
+
+// caller holds writerMutex; word is normalized and non-empty. The current
+// meaning goes to *meaning when it is given.
+bool findLocked(string_view word, string* meaning) {
+    FrozenTrie* ft = loadPartitionLocked(partOf(word));
+    TrieNode* node = findInBuffer(dictState.load()->buffer, word);
+    if (node) {
+        if (node->erased) return false;
+        if (meaning) meaning->assign(node->meaning);
+        return true;
+    }
+    int32_t entry = ft ? frozenFind(ft, word.data() + 1, word.size() - 1) : -1;
+    if (entry < 0) return false;
+    if (meaning) meaning->assign(frozenMeaningView(ft, entry));
+    return true;
+}
+
+// caller holds writerMutex; word is normalized and non-empty, walSeq is the
+// log record of this insert (0 when not logged). Does nothing to a partition
+// that could not be decoded.
+void insertLocked(string_view word, string_view meaning, uint64_t walSeq) {
+    if (!partitionWritableLocked(partOf(word))) return;
+    DictState* old = dictState.load();
+    FrozenTrie* ft = old->parts[partOf(word)];
+    DictState* next = new DictState(*old);
+    if (!next->arena) next->arena = make_shared<BufferArena>();
+    vector<TrieNode*> replaced;
+    bool isNew;
+    // a word moving from the frozen trie into the buffer keeps its weight;
+    // one that was deleted starts again from zero
+    uint32_t weight = 0;
+    TrieNode* existing = findInBuffer(old->buffer, word);
+    int32_t entry = ft ? frozenFind(ft, word.data() + 1, word.size() - 1) : -1;
+    if (existing) weight = existing->weight;
+    else if (entry >= 0) weight = frozenWeight(ft, entry);
+    if (existing) next->arena->garbage += existing->meaning.size();
+    if (existing && existing->erased) next->tombstones--;
+    if (entry >= 0 && (!existing || existing->erased)) next->shadowed++;
+    next->buffer = insertIntoBuffer(*next->arena, old->buffer, word, meaning, weight, replaced, isNew);
+    if (isNew) next->bufferedWords++;
+    if (walSeq) next->walSeq = walSeq;
+    unsavedParts.set(partOf(word));
+    // the next freeze merges the buffer into this copy, so keep it resident
+    next->evictable.reset(partOf(word));
+    publishState(next, [old, replaced, arena = next->arena] {
+        for (TrieNode* n : replaced) freeBufferNode(*arena, n);
+        delete old;
+    });
+    invalidateCachedWord(word);
+    maintainBufferLocked();
+}
+
+// caller holds writerMutex; word is normalized and non-empty, walSeq as for
+// insertLocked. A word that is only buffered is unlinked from the buffer;
+// one that is also frozen is covered by a tombstone until the next freeze.
+void eraseLocked(string_view word, uint64_t walSeq) {
+    if (!partitionWritableLocked(partOf(word))) return;
+    DictState* old = dictState.load();
+    FrozenTrie* ft = old->parts[partOf(word)];
+    TrieNode* existing = findInBuffer(old->buffer, word);
+    bool frozen = ft && frozenFind(ft, word.data() + 1, word.size() - 1) >= 0;
+    if (existing ? existing->erased : !frozen) return;
+    DictState* next = new DictState(*old);
+    if (!next->arena) next->arena = make_shared<BufferArena>();
+    vector<TrieNode*> replaced;
+    if (existing) next->arena->garbage += existing->meaning.size();
+    if (frozen) {
+        bool isNew;
+        next->buffer = insertIntoBuffer(*next->arena, old->buffer, word, string_view(), 0, replaced, isNew, true);
+        if (isNew) next->bufferedWords++;
+        if (existing) next->shadowed--;
+        next->tombstones++;
+    } else {
+        next->buffer = eraseFromBuffer(*next->arena, old->buffer, word, replaced);
+        next->bufferedWords--;
+    }
+    if (walSeq) next->walSeq = walSeq;
+    unsavedParts.set(partOf(word));
+    next->evictable.reset(partOf(word));
+    publishState(next, [old, replaced, arena = next->arena] {
+        for (TrieNode* n : replaced) freeBufferNode(*arena, n);
+        delete old;
+    });
+    invalidateCachedWord(word);
+    maintainBufferLocked();
+}
+
+// word is normalized and non-empty; the caller holds a ReadGuard
+bool lookupNormalized(string_view word, string &meaning) {
+    const DictState* st = dictState.load();
+    // the buffer holds the newest inserts, so it shadows the frozen copy
+    TrieNode* node = findInBuffer(st->buffer, word);
+    if (node) {
+        if (node->erased) return false;
+        meaning.assign(node->meaning);
+        return true;
+    }
+    FrozenTrie* ft = frozenPart(st, partOf(word));
+    if (!ft) return false;
+    int32_t entry = frozenFind(ft, word.data() + 1, word.size() - 1);
+    if (entry < 0) return false;
+    countLookup(ft, entry);
+    meaning.assign(frozenMeaningView(ft, entry));
+    return true;
+}
+
+// allocates nothing once `meaning` has grown to the longest meaning it has
+// held, unless the lookup cache has to make room for a new query
+bool searchInTrie(string_view wordRaw, string &meaning) {
+    MetricTimer timer(MH_LOOKUP, true);
+    countMetric(MC_LOOKUPS);
+    bool cached = lookupCacheOn.load(memory_order_relaxed);
+    size_t rawHash = cached ? hash<string_view>()(wordRaw) : 0;
+    // the lookup countLookup would sample goes to the trie, so cached hot
+    // words keep feeding the autocomplete weights
+    bool sampled = (lookupSampleTick + 1) % LOOKUP_SAMPLE_RATE == 0;
+    if (cached && !sampled) {
+        int hit;
+        {
+            ReadGuard guard;
+            hit = cacheFind(wordRaw, rawHash, meaning);
+        }
+        if (hit >= 0) {
+            if (hit) {
+                lookupSampleTick++;
+                countMetric(MC_LOOKUP_HITS);
+            }
+            return hit;
+        }
+    }
+    KeyBuffer key(wordRaw);
+    string_view word = key.view();
+    if (word.empty()) return false;
+    CacheTicket ticket{};
+    if (cached) ticket = cacheTicket(word);
+    bool found;
+    uint32_t tick = lookupSampleTick;
+    {
+        ReadGuard guard;
+        found = lookupNormalized(word, meaning);
+    }
+    // not a frozen hit, so nothing was sampled; move past the slot anyway
+    if (cached && sampled && lookupSampleTick == tick) lookupSampleTick++;
+    if (found) countMetric(MC_LOOKUP_HITS);
+    if (cached) cacheStore(wordRaw, rawHash, ticket, found, found ? string_view(meaning) : string_view());
+    return found;
+}
+
+// ======================= BATCH LOOKUP SECTION =======================
+// Resolving a long list of words one at a time leaves the CPU waiting on
+// one cache miss per character. The batch walk keeps BATCH_LANES words in
+// flight and advances them round robin. A lane's visit verifies check[t],
+// reads base[t] for its next letter and prefetches the check and base slots
+// of the following transition, so by the time the lane comes around again
+// both are usually in cache.
+//
+// Hits are then sorted by partition and entry, so each meaning block is
+// decoded once per batch instead of once per word. Callers that only need
+// to know which words exist pass meanings = nullptr and skip decoding.
+
+const int BATCH_LANES = 16;
+
+struct BatchLane {
+    size_t word;        // index into the batch
+    const FrozenTrie* ft;
+    const char* key;    // word without its first byte
+    size_t len;
+    size_t pos;
+    int32_t s;
+    int32_t t;          // pending transition, checked in the second step
+};
+
+inline void prefetchRead(const void* p) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p, 0, 1);
+#endif
+}
+
+struct BatchHit {
+    const FrozenTrie* ft;
+    int32_t entry;
+    size_t word;
+};
+
+// per-thread working memory of searchInTrieBatch, kept between calls so a
+// batch no larger than earlier ones allocates nothing
+struct BatchScratch {
+    string keyBytes;            // every normalized key, back to back
+    vector<size_t> keyEnd;      // key i is keyBytes[keyEnd[i - 1], keyEnd[i])
+    vector<size_t> pending;
+    vector<BatchHit> hits;
+};
+
+thread_local BatchScratch batchScratch;
+
+// Word is anything that converts to string_view. (*meanings)[i] is the
+// meaning of words[i]; the vector is never shrunk, so it may hold more than
+// n strings, and every string keeps its capacity for the next call.
+template<class Word>
+void searchInTrieBatch(const Word* words, size_t n, vector<char> &found, vector<string>* meanings) {
+    if (meanings) {
+        if (meanings->size() < n) meanings->resize(n);
+        for (size_t i = 0; i < n; i++) (*meanings)[i].clear();
+    }
+    found.assign(n, 0);
+
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+    BatchScratch &scratch = batchScratch;
+    string &keyBytes = scratch.keyBytes;
+    vector<size_t> &pending = scratch.pending;
+    keyBytes.clear();
+    scratch.keyEnd.resize(n);
+    pending.clear();
+    for (size_t i = 0; i < n; i++) {
+        appendNormalized(string_view(words[i]), keyBytes);
+        scratch.keyEnd[i] = keyBytes.size();
+    }
+    // views only once keyBytes has stopped growing
+    auto keyOf = [&](size_t i) {
+        size_t from = i ? scratch.keyEnd[i - 1] : 0;
+        return string_view(keyBytes.data() + from, scratch.keyEnd[i] - from);
+    };
+    // st keeps a pending partition pending after it is decoded, so each one
+    // is looked up once here rather than once per key through the locks
+    const FrozenTrie* parts[FROZEN_PARTS];
+    bitset<FROZEN_PARTS> resolved;
+    auto partFor = [&](string_view key) {
+        int p = partOf(key);
+        if (!resolved[p]) {
+            parts[p] = frozenPart(st, p);
+            resolved.set(p);
+        }
+        return parts[p];
+    };
+    size_t bufferHits = 0;
+    for (size_t i = 0; i < n; i++) {
+        string_view key = keyOf(i);
+        if (key.empty()) continue;
+        TrieNode* node = findInBuffer(st->buffer, key);
+        if (node && node->erased) {
+            continue;
+        } else if (node) {
+            if (meanings) (*meanings)[i].assign(node->meaning);
+            found[i] = 1;
+            bufferHits++;
+        } else if (partFor(key)) {
+            pending.push_back(i);
+        }
+    }
+
+    vector<BatchHit> &hits = scratch.hits;
+    hits.clear();
+    BatchLane lanes[BATCH_LANES];
+    int active = 0;
+    size_t next = 0;
+
+    auto refill = [&](BatchLane &lane) {
+        while (next < pending.size()) {
+            size_t i = pending[next++];
+            string_view key = keyOf(i);
+            const FrozenTrie* ft = partFor(key);
+            lane = {i, ft, key.data() + 1, key.size() - 1, 0, 0, -1};
+            if (lane.len == 0) {
+                if (ft->value[0] >= 0) hits.push_back({ft, ft->value[0], i});
+                continue;
+            }
+            lane.t = ft->base[0] + (unsigned char)lane.key[0];
+            if (lane.t < (int32_t)ft->states) {
+                prefetchRead(&ft->check[lane.t]);
+                prefetchRead(&ft->base[lane.t]);
+            }
+            return true;
+        }
+        return false;
+    };
+
+    for (int l = 0; l < BATCH_LANES && refill(lanes[active]); l++) active++;
+
+    while (active > 0) {
+        for (int l = 0; l < active; ) {
+            BatchLane &lane = lanes[l];
+            const FrozenTrie* ft = lane.ft;
+            bool done = false;
+            if (lane.t >= (int32_t)ft->states || ft->check[lane.t] != lane.s) {
+                done = true;
+            } else {
+                lane.s = lane.t;
+                lane.pos++;
+                if (lane.pos == lane.len) {
+                    if (ft->value[lane.s] >= 0) hits.push_back({ft, ft->value[lane.s], lane.word});
+                    done = true;
+                } else {
+                    lane.t = ft->base[lane.s] + (unsigned char)lane.key[lane.pos];
+                    if (lane.t < (int32_t)ft->states) {
+                        prefetchRead(&ft->check[lane.t]);
+                        prefetchRead(&ft->base[lane.t]);
+                    }
+                }
+            }
+            if (done && !refill(lane)) {
+                lane = lanes[--active];
+                continue;
+            }
+            l++;
+        }
+    }
+
+    for (BatchHit &h : hits) found[h.word] = 1;
+    countMetric(MC_BATCH_WORDS, n);
+    countMetric(MC_BATCH_HITS, bufferHits + hits.size());
+    if (!meanings) return;
+    sort(hits.begin(), hits.end(), [](const BatchHit &a, const BatchHit &b) {
+        return a.ft != b.ft ? a.ft->id < b.ft->id : a.entry < b.entry;
+    });
+    for (BatchHit &h : hits) (*meanings)[h.word].assign(frozenMeaningView(h.ft, h.entry));
+}
+
+// ======================= AUTOCOMPLETE SECTION =======================
+// Top-K completions of a prefix, ranked by weight (imported score plus
+// sampled lookup counts, live ones included). Every frozen state knows the
+// highest stored weight in its subtree; adding the partition's highest live
+// count bounds every weight below it, so a best-first walk pops entries in
+// weight order and stops after K of them instead of listing the whole
+// subtree. Counts widen that bound until a rebuild folds them into the
+// stored weights. The buffer is small and is simply scanned; its words
+// shadow frozen ones with the same key. An empty prefix ranks only the
+// partitions already decoded rather than decoding every pending one.
+
+struct Completion {
+    string word;
+    uint32_t weight;
+};
+
+// Queue items stay small: the word is rebuilt from a trail of (parent, byte)
+// links only for the K items that are actually returned.
+struct CompletionItem {
+    uint32_t score;
+    bool isEntry;
+    int32_t ref;        // state, or entry index when isEntry
+    int32_t trail;      // index into the trail, -1 for the starting prefix
+    const FrozenTrie* ft;
+    string_view prefix; // key bytes before the trail
+
+    // priority_queue pops the largest: higher score, then entries before
+    // subtrees, then earlier-discovered items (shorter words)
+    bool operator<(const CompletionItem &o) const {
+        if (score != o.score) return score < o.score;
+        if (isEntry != o.isEntry) return !isEntry;
+        return trail > o.trail;
+    }
+};
+
+vector<Completion> autocomplete(const string &prefixRaw, size_t k) {
+    vector<Completion> out;
+    string prefix = normalizeWord(prefixRaw);
+    if (k == 0) return out;
+
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+
+    vector<TrieEntry> buffered;
+    collectBufferPrefix(st->buffer, prefix, buffered);
+    // buffered words, deleted ones included, hide their frozen copies
+    vector<string> shadowed;
+    for (auto &e : buffered) shadowed.push_back(e.key);
+    buffered.erase(remove_if(buffered.begin(), buffered.end(), [](const TrieEntry &e) { return e.erased; }),
+                   buffered.end());
+    sort(buffered.begin(), buffered.end(), [](const TrieEntry &a, const TrieEntry &b) {
+        return a.weight > b.weight;
+    });
+
+    // no entry in the subtree of s weighs more
+    auto bound = [](const FrozenTrie* ft, int32_t s) {
+        uint64_t w = (uint64_t)ft->maxWeight[s] + ft->maxHits.load(memory_order_relaxed);
+        return (uint32_t)min<uint64_t>(w, UINT32_MAX);
+    };
+
+    vector<pair<int32_t, char>> trail;
+    priority_queue<CompletionItem> pq;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (!prefix.empty() && partOf(prefix) != p) continue;
+        if (prefix.empty() && st->pending[p]) continue;
+        const FrozenTrie* ft = frozenPart(st, p);
+        if (!ft) continue;
+        int32_t s = 0;
+        bool ok = true;
+        for (size_t i = 1; i < prefix.size() && ok; i++) {
+            int32_t t = ft->base[s] + (unsigned char)prefix[i];
+            if (t >= (int32_t)ft->states || ft->check[t] != s) ok = false;
+            else s = t;
+        }
+        string_view start = prefix.empty() ? partitionKey(p) : string_view(prefix);
+        if (ok) pq.push({bound(ft, s), false, s, -1, ft, start});
+    }
+
+    auto wordOf = [&](const CompletionItem &item) {
+        string tail;
+        for (int32_t i = item.trail; i >= 0; i = trail[i].first) tail.push_back(trail[i].second);
+        return string(item.prefix) + string(tail.rbegin(), tail.rend());
+    };
+
+    // next frozen completion in weight order
+    auto nextFrozen = [&](Completion &c) {
+        while (!pq.empty()) {
+            CompletionItem item = pq.top();
+            pq.pop();
+            if (item.isEntry) {
+                string word = wordOf(item);
+                if (binary_search(shadowed.begin(), shadowed.end(), word)) continue;
+                c = {word, item.score};
+                return true;
+            }
+            const FrozenTrie* ft = item.ft;
+            int32_t s = item.ref;
+            if (ft->value[s] >= 0) {
+                pq.push({frozenWeight(ft, ft->value[s]), true, ft->value[s], item.trail, ft, item.prefix});
+            }
+            for (int c = ft->firstChild[s]; c != 0; c = ft->nextSibling[ft->base[s] + c]) {
+                int32_t t = ft->base[s] + c;
+                trail.push_back({item.trail, (char)c});
+                pq.push({bound(ft, t), false, t, (int32_t)trail.size() - 1, ft, item.prefix});
+            }
+        }
+        return false;
+    };
+
+    Completion f;
+    bool hasFrozen = nextFrozen(f);
+    size_t bi = 0;
+    while (out.size() < k && (hasFrozen || bi < buffered.size())) {
+        if (bi < buffered.size() && (!hasFrozen || buffered[bi].weight >= f.weight)) {
+            out.push_back({buffered[bi].key, buffered[bi].weight});
+            bi++;
+        } else {
+            out.push_back(f);
+            hasFrozen = nextFrozen(f);
+        }
+    }
+    return out;
+}
+
+// ======================= FUZZY LOOKUP SECTION =======================
+// "Did you mean": every word within edit distance maxDist of the query,
+// counted in code points, so a wrong accent is one edit. The frozen trie is
+// walked depth first carrying one row of the Levenshtein table per code
+// point of the path (distances from each query prefix to the path); bytes
+// inside a multi-byte code point are followed without a row of their own.
+// As soon as every cell of a row exceeds maxDist no word below can match,
+// so the whole subtree is skipped. Only cells within maxDist of the diagonal
+// can be <= maxDist, so each row computes just that band (Ukkonen) and caps
+// everything else at maxDist + 1. Buffered words are checked one by one.
+
+struct FuzzyMatch {
+    string word;
+    int distance;
+    uint32_t weight;
+};
+
+// the code points of a key; keys are valid UTF-8
+vector<uint32_t> codePoints(string_view key) {
+    vector<uint32_t> out;
+    const unsigned char* p = (const unsigned char*)key.data();
+    const unsigned char* end = p + key.size();
+    uint32_t cp;
+    while (p < end) {
+        if (nextCodePoint(p, end, cp)) out.push_back(cp);
+    }
+    return out;
+}
+
+struct FuzzyWalker {
+    const vector<uint32_t> &query;
+    int maxDist;
+    size_t width;           // query length in code points + 1
+    vector<int> rows;       // row d starts at rows[d * width]
+    string path;
+    vector<FuzzyMatch> &out;
+    const FrozenTrie* ft = nullptr;
+
+    FuzzyWalker(const vector<uint32_t> &q, int k, vector<FuzzyMatch> &o)
+        : query(q), maxDist(k), width(q.size() + 1), out(o) {
+        // a row deeper than |query| + k is all > k, so that is as far as we go
+        rows.resize((query.size() + k + 2) * width);
+        for (size_t j = 0; j < width; j++) rows[j] = (int)j;
+    }
+
+    // fills the band of row `depth` from the row above for code point c;
+    // returns the row minimum (capped at maxDist + 1)
+    int step(size_t depth, uint32_t c) {
+        const int* prev = &rows[(depth - 1) * width];
+        int* cur = &rows[depth * width];
+        int cap = maxDist + 1;
+        size_t n = width - 1;
+        size_t lo = depth > (size_t)maxDist ? depth - maxDist : 1;
+        size_t hi = min(n, depth + maxDist);
+        cur[0] = min((int)depth, cap);
+        int best = cur[0];
+        if (lo > 1) cur[lo - 1] = cap;
+        for (size_t j = lo; j <= hi; j++) {
+            int sub = prev[j - 1] + (query[j - 1] == c ? 0 : 1);
+            cur[j] = min(cap, min(sub, min(prev[j], cur[j - 1]) + 1));
+            best = min(best, cur[j]);
+        }
+        if (hi + 1 <= n) cur[hi + 1] = cap;
+        return best;
+    }
+
+    // row `depth` describes the complete code points of path, and `need`
+    // more bytes of code point cp follow; visit state s and its subtree
+    void walk(int32_t s, size_t depth, uint32_t cp, int need) {
+        int32_t entry = ft->value[s];
+        size_t n = width - 1;
+        bool inBand = depth <= n + maxDist && n <= depth + maxDist;
+        int dist = inBand ? rows[depth * width + n] : maxDist + 1;
+        if (entry >= 0 && need == 0 && dist <= maxDist) out.push_back({path, dist, frozenWeight(ft, entry)});
+        for (int c = ft->firstChild[s]; c != 0; c = ft->nextSibling[ft->base[s] + c]) {
+            follow(ft->base[s] + c, depth, cp, need, (unsigned char)c);
+        }
+    }
+
+    // state t is reached from the path above by byte b
+    void follow(int32_t t, size_t depth, uint32_t cp, int need, unsigned char b) {
+        if (need > 0) {
+            cp = cp << 6 | (b & 0x3F);
+            need--;
+        } else if (b >= 0xC0) {
+            need = b >= 0xF0 ? 3 : b >= 0xE0 ? 2 : 1;
+            cp = b & (0x3F >> need);
+        } else {
+            cp = b;
+        }
+        if (need == 0 && step(++depth, cp) > maxDist) return;
+        path.push_back((char)b);
+        walk(t, depth, cp, need);
+        path.pop_back();
+    }
+};
+
+int editDistance(const vector<uint32_t> &a, const vector<uint32_t> &b) {
+    vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) row[j] = (int)j;
+    for (size_t i = 1; i <= a.size(); i++) {
+        int diag = row[0];
+        row[0] = (int)i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            int up = row[j];
+            row[j] = min(diag + (a[i - 1] == b[j - 1] ? 0 : 1), min(up, row[j - 1]) + 1);
+            diag = up;
+        }
+    }
+    return row[b.size()];
+}
+
+// closest words first, then by weight; at most `limit` results
+vector<FuzzyMatch> fuzzySearch(const string &wordRaw, int maxDist, size_t limit) {
+    vector<FuzzyMatch> out;
+    vector<uint32_t> query = codePoints(normalizeWord(wordRaw));
+    if (query.empty()) return out;
+
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+    FuzzyWalker walker(query, maxDist, out);
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (!st->parts[p] && !st->pending[p]) continue;
+        // a single-byte first letter can rule the partition out before it is decoded
+        if (p < 0x80 && walker.step(1, (uint32_t)p) > maxDist) continue;
+        walker.ft = frozenPart(st, p);
+        if (!walker.ft) continue;
+        walker.path.clear();
+        walker.follow(0, 0, 0, 0, (unsigned char)p);
+    }
+
+    vector<TrieEntry> buffered;
+    string current;
+    collectTrieWords(st->buffer, current, buffered);
+    // a buffered word, deleted or not, replaces its frozen copy
+    vector<string> shadowing;   // in key order, like the buffer
+    for (TrieEntry &e : buffered) shadowing.push_back(e.key);
+    out.erase(remove_if(out.begin(), out.end(), [&](const FuzzyMatch &m) {
+        return binary_search(shadowing.begin(), shadowing.end(), m.word);
+    }), out.end());
+    for (TrieEntry &e : buffered) {
+        if (e.erased) continue;
+        vector<uint32_t> key = codePoints(e.key);
+        if ((int)key.size() - (int)query.size() > maxDist || (int)query.size() - (int)key.size() > maxDist) continue;
+        int dist = editDistance(key, query);
+        if (dist <= maxDist) out.push_back({e.key, dist, e.weight});
+    }
+
+    sort(out.begin(), out.end(), [](const FuzzyMatch &a, const FuzzyMatch &b) {
+        if (a.distance != b.distance) return a.distance < b.distance;
+        if (a.weight != b.weight) return a.weight > b.weight;
+        return a.word < b.word;
+    });
+    if (out.size() > limit) out.resize(limit);
+    return out;
+}
+
+// ======================= REVERSE LOOKUP SECTION =======================
+// "Which words have a meaning that says X": the query is cut into terms the
+// way meanings are, and a word matches when its meaning (all senses
+// together) has every one of them. In each partition the posting lists of
+// the terms are decoded shortest first and intersected with the running
+// result, four states against four per SSE2 compare, or by galloping when a
+// list is much longer than the result. Frozen words the buffer replaced or
+// deleted are dropped; the buffer is small and its words are checked
+// against the terms one by one.
+
+// the index of term in ft's sorted term table, or -1
+int64_t findTerm(const FrozenTrie* ft, string_view term) {
+    auto termAt = [&](uint32_t k) {
+        return string_view(ft->termText + ft->termOff[k], ft->termOff[k + 1] - ft->termOff[k]);
+    };
+    uint32_t lo = 0, hi = ft->terms;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (termAt(mid) < term) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < ft->terms && termAt(lo) == term ? (int64_t)lo : -1;
+}
+
+// appends the states in term k's posting list to out
+void decodePostings(const FrozenTrie* ft, uint32_t k, vector<uint32_t> &out) {
+    const uint8_t* p = ft->postings + ft->postOff[k];
+    const uint8_t* end = ft->postings + ft->postOff[k + 1];
+    uint32_t state = 0;
+    while (p < end) {
+        uint32_t gap = 0;
+        for (int shift = 0; p < end; shift += 7) {
+            uint8_t b = *p++;
+            if (shift < 32) gap |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        state += gap;
+        out.push_back(state);
+    }
+}
+
+// keeps the states of a (ascending) that b (ascending) also has, in place;
+// returns how many are left
+size_t intersectPostings(uint32_t* a, size_t na, const uint32_t* b, size_t nb) {
+    size_t out = 0, i = 0, j = 0;
+    if (nb / 16 > na) {
+        for (; i < na && j < nb; i++) {
+            size_t step = 1;
+            while (j + step < nb && b[j + step] < a[i]) step *= 2;
+            j = lower_bound(b + j, b + min(nb, j + step + 1), a[i]) - b;
+            if (j < nb && b[j] == a[i]) a[out++] = a[i];
+        }
+        return out;
+    }
+#ifdef __SSE2__
+    // a block of a matches a block of b where it equals some rotation of it;
+    // the block with the smaller last state moves on (both when they tie),
+    // so every equal pair meets in exactly one compare
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(eq));
+        uint32_t lastA = a[i + 3], lastB = b[j + 3];
+        // a match is written to a[out] with out at most its own index, so writes
+        // only clobber values no later compare needs; they can land in this
+        // block, so the matches are read from a copy of va
+        uint32_t block[4];
+        _mm_storeu_si128((__m128i*)block, va);
+        for (; mask; mask &= mask - 1) a[out++] = block[__builtin_ctz(mask)];
+        if (lastA <= lastB) i += 4;
+        if (lastB <= lastA) j += 4;
     }
-    for (int i = 0; i < 26; i++) {
-        if (node->child[i]) {
-            current.push_back('a' + i);
-            collectTrieWords(node->child[i], current, out);
-            current.pop_back();
+#endif
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (b[j] < a[i]) {
+            j++;
+        } else {
+            a[out++] = a[i];
+            i++;
+            j++;
         }
     }
+    return out;
 }
 
-void clearTrie(TrieNode* node) {
-    if (!node) return;
-    for (int i = 0; i < 26; i++) {
-        if (node->child[i]) clearTrie(node->child[i]);
+// the word that ends at state s of partition p
+string frozenWordAt(const FrozenTrie* ft, int p, int32_t s) {
+    string tail;
+    for (uint32_t depth = 0; s != 0 && depth < ft->states; depth++) {
+        int32_t parent = ft->check[s];
+        tail.push_back((char)(s - ft->base[parent]));
+        s = parent;
     }
-    delete node;
+    return string(partitionKey(p)) + string(tail.rbegin(), tail.rend());
 }
 
-// ======================= HUFFMAN SECTION =======================
+// words whose meaning has every term of the query, highest weight first and
+// then in key order, at most `limit`; total, if given, receives the number
+// of matches before the limit
+vector<Completion> reverseLookup(const string &queryRaw, size_t limit, size_t* total = nullptr) {
+    MetricTimer timer(MH_REVERSE_LOOKUP);
+    countMetric(MC_REVERSE_LOOKUPS);
+    vector<Completion> out;
+    if (total) *total = 0;
+    vector<string> terms = termsOf(queryRaw);
+    if (terms.empty()) return out;
 
-struct HuffmanNode {
-    char ch;
-    int freq;
-    HuffmanNode *left;
-    HuffmanNode *right;
+    ReadGuard guard;
+    const DictState* st = dictState.load();
+    vector<TrieEntry> buffered;   // in key order, so partition by partition
+    string current;
+    collectTrieWords(st->buffer, current, buffered);
 
-    HuffmanNode(char c, int f) {
-        ch = c;
-        freq = f;
-        left = right = nullptr;
+    struct Hit {
+        uint32_t weight;
+        int p;
+        int32_t entry;
+        int32_t state;
+        const FrozenTrie* ft;
+    };
+    vector<Hit> hits;
+    vector<uint32_t> result, list, hidden;
+    vector<pair<uint32_t, uint32_t>> lists;  // (bytes, term), shortest first
+    size_t bufferedEnd = 0;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        size_t bufferedFrom = bufferedEnd;
+        while (bufferedEnd < buffered.size() && partOf(buffered[bufferedEnd].key) == p) bufferedEnd++;
+        if (!st->parts[p] && !st->pending[p]) continue;
+        const FrozenTrie* ft = frozenPart(st, p);
+        if (!ft || !ft->terms) continue;
+        lists.clear();
+        for (const string &t : terms) {
+            int64_t k = findTerm(ft, t);
+            if (k < 0) break;
+            lists.push_back({ft->postOff[k + 1] - ft->postOff[k], (uint32_t)k});
+        }
+        if (lists.size() < terms.size()) continue;
+        sort(lists.begin(), lists.end());
+        result.clear();
+        decodePostings(ft, lists[0].second, result);
+        for (size_t l = 1; l < lists.size() && !result.empty(); l++) {
+            list.clear();
+            decodePostings(ft, lists[l].second, list);
+            result.resize(intersectPostings(result.data(), result.size(), list.data(), list.size()));
+        }
+        if (result.empty()) continue;
+
+        // buffered words, deleted ones included, hide their frozen copies
+        hidden.clear();
+        for (size_t i = bufferedFrom; i < bufferedEnd; i++) {
+            const string &key = buffered[i].key;
+            int32_t s = frozenState(ft, key.data() + 1, key.size() - 1);
+            if (s >= 0) hidden.push_back((uint32_t)s);
+        }
+        sort(hidden.begin(), hidden.end());
+        for (uint32_t s : result) {
+            if (s >= ft->states || ft->value[s] < 0 || binary_search(hidden.begin(), hidden.end(), s)) continue;
+            hits.push_back({frozenWeight(ft, ft->value[s]), p, ft->value[s], (int32_t)s, ft});
+        }
     }
-};
 
-struct HuffmanCompare {
-    bool operator()(HuffmanNode* a, HuffmanNode* b) {
-        return a->freq > b->freq; // min-heap by freq
+    for (TrieEntry &e : buffered) {
+        if (e.erased) continue;
+        vector<string> has = termsOf(e.meaning);
+        if (includes(has.begin(), has.end(), terms.begin(), terms.end())) out.push_back({e.key, e.weight});
     }
-};
+    if (total) *total = hits.size() + out.size();
 
-unordered_map<char,int> buildFrequencyTable(const string &text) {
-    unordered_map<char,int> freq;
-    for (char c : text) freq[c]++;
-    return freq;
+    // entry order is key order within a partition, so only the words that
+    // can make the cut are spelled out
+    size_t keep = min(limit, hits.size());
+    partial_sort(hits.begin(), hits.begin() + keep, hits.end(), [](const Hit &a, const Hit &b) {
+        if (a.weight != b.weight) return a.weight > b.weight;
+        return a.p != b.p ? a.p < b.p : a.entry < b.entry;
+    });
+    for (size_t i = 0; i < keep; i++) out.push_back({frozenWordAt(hits[i].ft, hits[i].p, hits[i].state), hits[i].weight});
+    sort(out.begin(), out.end(), [](const Completion &a, const Completion &b) {
+        return a.weight != b.weight ? a.weight > b.weight : a.word < b.word;
+    });
+    if (out.size() > limit) out.resize(limit);
+    return out;
 }
 
-HuffmanNode* buildHuffmanTree(const unordered_map<char,int> &freq) {
-    if (freq.empty()) return nullptr;
-    priority_queue<HuffmanNode*, vector<HuffmanNode*>, HuffmanCompare> pq;
-    for (auto &p : freq) {
-        pq.push(new HuffmanNode(p.first, p.second));
-    }
-    while (pq.size() > 1) {
-        HuffmanNode* left = pq.top();  pq.pop();
-        HuffmanNode* right = pq.top(); pq.pop();
-        HuffmanNode* parent = new HuffmanNode('\0', left->freq + right->freq);
-        parent->left = left;
-        parent->right = right;
-        pq.push(parent);
+// ======================= BULK LOADER SECTION =======================
+// Word lists ("Word - Meaning." per line) are loaded in two parallel passes.
+// Every input is cut into newline-aligned chunks, and workers parse whole
+// chunks in place with string_views: normalized keys go into the worker's own
+// arena and entries are bucketed by first key byte, so no line allocates.
+// Then each partition's entries from all workers are sorted and built into a frozen
+// partition on a worker of its own, and the partitions make up the new state.
+// The same worker merges repeated words into one entry with several senses
+// and indexes the terms of the meanings for reverse lookups.
+
+const size_t LOAD_CHUNK_MIN = 1 << 20;
+const size_t LOAD_CHUNK_MAX = 256 << 20;
+
+// Parse "Word - Meaning." style line; word and meaning point into line.
+// Words may contain hyphens ("co-op - ..."), so " - " separates first.
+bool parseLine(string_view line, string_view &word, string_view &meaning) {
+    size_t pos = line.find(" - ");
+    size_t sep = 3;
+    if (pos == string_view::npos) {
+        pos = line.find('-');
+        sep = 1;
     }
-    return pq.top();
+    if (pos == string_view::npos) return false;
+    auto trim = [](string_view s) {
+        size_t b = 0, e = s.size();
+        while (b < e && isspace((unsigned char)s[b])) b++;
+        while (e > b && isspace((unsigned char)s[e - 1])) e--;
+        return s.substr(b, e - b);
+    };
+    word = trim(line.substr(0, pos));
+    meaning = trim(line.substr(pos + sep));
+    return !word.empty();
 }
 
-void buildCodes(HuffmanNode* root, const string &code, unordered_map<char,string> &codes) {
-    if (!root) return;
-    if (!root->left && !root->right) {
-        codes[root->ch] = (code == "" ? "0" : code);
-        return;
+struct ParsedEntry {
+    uint64_t seq;       // chunk << 32 | line, so duplicates merge in input order
+    size_t keyOff;      // normalized key in the worker's arena
+    const char* meaning;
+    uint32_t keyLen, meaningLen;
+};
+
+struct ParseWorker {
+    string keys;
+    vector<ParsedEntry> parts[FROZEN_PARTS];
+};
+
+// runs work(0) .. work(threads - 1) at once, the last one on this thread
+template<class F>
+void runWorkers(unsigned threads, F work) {
+    vector<thread> pool;
+    for (unsigned t = 0; t + 1 < threads; t++) pool.emplace_back(work, t);
+    work(threads - 1);
+    for (auto &th : pool) th.join();
+}
+
+void parseChunk(string_view chunk, uint64_t chunkIndex, ParseWorker &w) {
+    uint64_t line = 0;
+    size_t pos = 0;
+    while (pos < chunk.size()) {
+        size_t end = chunk.find('\n', pos);
+        if (end == string_view::npos) end = chunk.size();
+        string_view word, meaning;
+        if (parseLine(chunk.substr(pos, end - pos), word, meaning)) {
+            size_t keyOff = w.keys.size();
+            appendNormalized(word, w.keys);
+            size_t keyLen = w.keys.size() - keyOff;
+            if (keyLen > 0) {
+                int p = (unsigned char)w.keys[keyOff];
+                w.parts[p].push_back({chunkIndex << 32 | line, keyOff, meaning.data(),
+                                      (uint32_t)keyLen, (uint32_t)meaning.size()});
+            } else {
+                w.keys.resize(keyOff);
+            }
+        }
+        line++;
+        pos = end + 1;
     }
-    buildCodes(root->left, code + "0", codes);
-    buildCodes(root->right, code + "1", codes);
 }
 
-// returns encoded bitstring, also gives root + freq table
-string huffmanEncode(const string &text,
-                     unordered_map<char,string> &codes,
-                     HuffmanNode* &rootOut,
-                     unordered_map<char,int> &freqOut) {
-    if (text.empty()) {
-        rootOut = nullptr;
-        codes.clear();
-        freqOut.clear();
-        return "";
+// parses every input into a new state; a word listed more than once gets
+// the senses of all its lines, in input order. threads = 0 uses every core;
+// indexMeanings = false leaves the partitions without meaning indexes.
+DictState* buildStateFromBuffers(const vector<string_view> &inputs, unsigned threads = 0, bool indexMeanings = true) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    size_t total = 0;
+    for (auto in : inputs) total += in.size();
+    size_t target = clamp(total / (threads * 4) + 1, LOAD_CHUNK_MIN, LOAD_CHUNK_MAX);
+
+    vector<string_view> chunks;
+    for (string_view in : inputs) {
+        while (!in.empty()) {
+            size_t cut = in.size();
+            if (cut > target) {
+                cut = in.find('\n', target);
+                cut = cut == string_view::npos ? in.size() : cut + 1;
+            }
+            chunks.push_back(in.substr(0, cut));
+            in.remove_prefix(cut);
+        }
     }
-    freqOut = buildFrequencyTable(text);
-    HuffmanNode* root = buildHuffmanTree(freqOut);
-    codes.clear();
-    buildCodes(root, "", codes);
 
-    string encoded;
-    encoded.reserve(text.size() * 2);
-    for (char c : text) encoded += codes[c];
+    vector<ParseWorker> workers(max<size_t>(1, min<size_t>(threads, chunks.size())));
+    atomic<size_t> nextChunk(0);
+    runWorkers(workers.size(), [&](unsigned t) {
+        for (size_t c; (c = nextChunk++) < chunks.size();) parseChunk(chunks[c], c, workers[t]);
+    });
 
-    rootOut = root;
-    return encoded;
+    DictState* st = new DictState();
+    atomic<int> nextPart(0);
+    atomic<size_t> words(0);
+    runWorkers(min<unsigned>(threads, FROZEN_PARTS), [&](unsigned) {
+        struct Keyed { string_view key; uint64_t seq; const ParsedEntry* e; };
+        vector<Keyed> keyed;
+        vector<TrieEntry> part;
+        for (int p; (p = nextPart++) < FROZEN_PARTS;) {
+            keyed.clear();
+            for (auto &w : workers) {
+                for (auto &e : w.parts[p]) keyed.push_back({string_view(w.keys).substr(e.keyOff, e.keyLen), e.seq, &e});
+            }
+            if (keyed.empty()) continue;
+            sort(keyed.begin(), keyed.end(), [](const Keyed &a, const Keyed &b) {
+                return a.key != b.key ? a.key < b.key : a.seq < b.seq;
+            });
+            part.clear();
+            for (size_t k = 0; k < keyed.size(); k++) {
+                string_view meaning(keyed[k].e->meaning, keyed[k].e->meaningLen);
+                if (k > 0 && keyed[k - 1].key == keyed[k].key) {
+                    mergeSenses(part.back().meaning, meaning);
+                    continue;
+                }
+                part.push_back({string(keyed[k].key.substr(1)), string(meaning), 0});
+            }
+            st->parts[p] = buildFrozenTrie(part, indexMeanings);
+            words += part.size();
+        }
+    });
+    st->frozenWords = words;
+    return st;
 }
 
-string huffmanDecode(const string &encoded, HuffmanNode* root) {
-    string decoded;
-    if (!root) return decoded;
-    HuffmanNode* curr = root;
-    for (char bit : encoded) {
-        curr = (bit == '0') ? curr->left : curr->right;
-        if (!curr->left && !curr->right) {
-            decoded.push_back(curr->ch);
-            curr = root;
+// loads the given word list files as the whole dictionary; unreadable files
+// are skipped and returned in missing. Returns false if none could be read.
+bool loadWordFiles(const vector<string> &paths, vector<string> &missing, unsigned threads = 0) {
+    vector<shared_ptr<MappedFile>> files;
+    vector<string_view> inputs;
+    for (auto &path : paths) {
+        shared_ptr<MappedFile> mf = mapFile(path);
+        if (!mf) {
+            missing.push_back(path);
+            continue;
         }
+        files.push_back(mf);
+        inputs.push_back(string_view(mf->data, mf->size));
     }
-    return decoded;
-}
-
-void freeHuffmanTree(HuffmanNode* root) {
-    if (!root) return;
-    freeHuffmanTree(root->left);
-    freeHuffmanTree(root->right);
-    delete root;
+    if (files.empty()) return false;
+    replaceDictionary(buildStateFromBuffers(inputs, threads));
+    return true;
 }
 
 // ======================= INITIAL DATA (YOUR WORD LIST) =======================
@@ -412,154 +4012,2408 @@ string getInitialDictionaryText() {
         "Queue - A line of people waiting.\n";
 }
 
-// Parse "Word - Meaning." style line
-bool parseLine(const string &line, string &word, string &meaning) {
-    int pos = line.find('-');
-    if (pos == string::npos) return false;
-    word = line.substr(0, pos);
-    meaning = line.substr(pos + 1);
-    // trim spaces
-    auto trim = [](string &s) {
-        while (!s.empty() && isspace((unsigned char)s.front())) s.erase(s.begin());
-        while (!s.empty() && isspace((unsigned char)s.back())) s.pop_back();
-    };
-    trim(word);
-    trim(meaning);
-    return !word.empty();
+// parse "Word - Meaning" lines into a complete state, built off to the side
+DictState* buildStateFromText(const string &text) {
+    return buildStateFromBuffers({string_view(text)});
+}
+
+// build Trie from initial big text
+void loadInitialDataIntoTrie() {
+    replaceDictionary(buildStateFromText(getInitialDictionaryText()));
+}
+
+// ======================= FILE HANDLING + HUFFMAN INTEGRATION =======================
+// A snapshot is split like the frozen trie: one file per non-empty partition
+// (first byte of the word), each Huffman coded with its own table.
+// dictionary.huff itself is only the manifest naming those files, so a save
+// re-encodes just the partitions changed since the last save or load, writes
+// them under new names and swaps the manifest in with one rename. Files the
+// old manifest used and the new one does not are removed afterwards.
+//
+// Manifest: dictionary.huff (native byte order)
+// 4 bytes: magic "HUF3"
+// 8 bytes: generation, bumped by every save
+// 8 bytes: last write-ahead log record in the snapshot
+// HuffPart[FROZEN_PARTS]
+// 8 bytes: checksum of everything before it
+// Manifests written before the log position was added lack that field and
+// read as holding no log records.
+//
+// Partition file: dictionary.huff.<partition byte in hex>.<generation written>
+// 4 bytes: magic "HUF4"
+// 8 bytes: decoded text length
+// 8 bytes: decoded bytes per chunk (the last chunk may be shorter)
+// 8 bytes: chunk count
+// 256 bytes: canonical code length of every byte value (0 = unused)
+// 8 bytes per chunk: end of the chunk's packed bits, counted from the first
+// packed code bits of the partition's "word - meaning" lines, MSB first,
+//       each chunk padded to a whole byte
+// then, only if some word has a weight: 4 bytes magic "WGT1", 8 bytes count,
+//       count (u32 line, u32 weight) pairs for the words with a weight
+// All chunks share the code, so they are encoded and decoded independently;
+// the chunks of every partition of a save or load go to one pool of workers.
+//
+// Partition files written before chunking are a single HUF2 stream (same
+// layout without the chunk fields and table) and still load, as does a lone
+// HUF2 file, the older single-stream snapshot.
+//
+// Meaning index file: <partition file>.idx, written along with it
+// 4 bytes: magic "IDX1"
+// 8 bytes: checksum of the partition file it belongs to
+// 4 bytes: states of the partition, 4 bytes: term count
+// termOff[terms + 1], postOff[terms + 1], term text, postings (see
+// buildMeaningIndex)
+// 8 bytes: checksum of everything before it
+// Postings name double-array states, and loading builds a partition's
+// double array from the same words the same way, so the index is used as
+// is. Without a matching index file a partition's index is rebuilt from
+// its meanings while loading.
+
+const string HUFF_FILE = "dictionary.huff";
+const char HUFF_MAGIC[4] = {'H', 'U', 'F', '2'};
+const char HUFF_MANIFEST_MAGIC[4] = {'H', 'U', 'F', '3'};
+const char HUFF_CHUNKED_MAGIC[4] = {'H', 'U', 'F', '4'};
+const size_t HUFF_HEADER_SIZE = 4 + 8 + 256;
+const size_t HUFF_CHUNKED_HEADER_SIZE = 4 + 8 + 8 + 8 + 256;
+const size_t HUFF_CHUNK_SIZE = 1 << 20;
+const char PART_WEIGHTS_MAGIC[4] = {'W', 'G', 'T', '1'};
+const char MEANING_INDEX_MAGIC[4] = {'I', 'D', 'X', '1'};
+const size_t MEANING_INDEX_HEADER_SIZE = 4 + 8 + 4 + 4;
+
+struct HuffPart {
+    uint64_t generation;        // save that wrote the file, 0 for an empty partition
+    uint64_t words;
+    uint64_t bytes;
+    uint64_t checksum;          // over the whole file
+};
+
+struct HuffManifest {
+    uint64_t generation = 0;
+    uint64_t walSeq = 0;
+    HuffPart parts[FROZEN_PARTS] = {};
+};
+
+// the snapshot unsavedParts is relative to, guarded by snapshotMutex
+// (taken before writerMutex)
+struct HuffSnapshot {
+    string path;
+    uint64_t generation = 0;
+};
+
+HuffSnapshot huffSnapshot;
+mutex snapshotMutex;
+
+// word-at-a-time hash; catches truncated or corrupted files, not tampering
+uint64_t checksum64(const void* data, size_t len, uint64_t seed = 0) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = seed ^ (len * 0x9E3779B97F4A7C15ULL);
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h ^= w * 0xC2B2AE3D27D4EB4FULL;
+        h = ((h << 31) | (h >> 33)) * 0x9E3779B97F4A7C15ULL;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    h ^= tail * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// moves a fully written temporary file over the real one in a single step.
+// Windows will not replace a file that is still mapped, but will rename it,
+// so such a file is first moved to path.old; that copy is deleted once
+// nothing maps it, and read in place of path if a crash falls in between
+bool replaceFile(const string &tmp, const string &path) {
+#ifdef _WIN32
+    if (MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) return true;
+    string aside = path + ".old";
+    DeleteFileA(aside.c_str());
+    if (!MoveFileExA(path.c_str(), aside.c_str(), 0)) return false;
+    if (!MoveFileExA(tmp.c_str(), path.c_str(), 0)) {
+        MoveFileExA(aside.c_str(), path.c_str(), 0);
+        return false;
+    }
+    DeleteFileA(aside.c_str());
+    return true;
+#else
+    return rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+}
+
+bool syncFile(FILE* f) {
+    if (fflush(f) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// makes a rename into path's directory durable; Windows has no equivalent
+// and needs none, since the rename itself is written through
+bool syncParentDirectory(const string &path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    size_t slash = path.find_last_of('/');
+    string dir = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#endif
+}
+
+bool readWholeFile(const string &path, string &out) {
+    ifstream fin(path, ios::binary);
+    if (!fin) return false;
+    out.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+    return !fin.bad();
+}
+
+// writes data to path and waits until it is on disk
+bool writeWholeFile(const string &path, const string &data) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+    ok = syncFile(out) && ok;
+    return fclose(out) == 0 && ok;
+}
+
+string huffPartPath(const string &path, int p, uint64_t generation) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%02x.%llu", p, (unsigned long long)generation);
+    return path + suffix;
+}
+
+string huffIndexPath(const string &path, int p, uint64_t generation) {
+    return huffPartPath(path, p, generation) + ".idx";
+}
+
+// ft's meaning index as an index file; stampMeaningIndex completes it once
+// the partition file's checksum is known
+string encodeMeaningIndex(const FrozenTrie* ft) {
+    string out(MEANING_INDEX_MAGIC, 4);
+    out.append(8, '\0');
+    out.append((const char*)&ft->states, 4);
+    out.append((const char*)&ft->terms, 4);
+    out.append((const char*)ft->termOff, (ft->terms + 1) * sizeof(uint32_t));
+    out.append((const char*)ft->postOff, (ft->terms + 1) * sizeof(uint32_t));
+    out.append(ft->termText, ft->termOff[ft->terms]);
+    out.append((const char*)ft->postings, ft->postOff[ft->terms]);
+    return out;
+}
+
+void stampMeaningIndex(string &file, uint64_t partChecksum) {
+    memcpy(&file[4], &partChecksum, 8);
+    uint64_t sum = checksum64(file.data(), file.size());
+    file.append((const char*)&sum, 8);
+}
+
+// copies the index in raw into ft if it was written for the partition
+// file with checksum partChecksum and fits ft
+bool attachMeaningIndex(FrozenTrie* ft, string_view raw, uint64_t partChecksum) {
+    if (raw.size() < MEANING_INDEX_HEADER_SIZE + 8 || memcmp(raw.data(), MEANING_INDEX_MAGIC, 4) != 0) return false;
+    size_t body = raw.size() - 8;
+    uint64_t stored, forPart;
+    uint32_t states, terms;
+    memcpy(&stored, raw.data() + body, 8);
+    memcpy(&forPart, raw.data() + 4, 8);
+    memcpy(&states, raw.data() + 12, 4);
+    memcpy(&terms, raw.data() + 16, 4);
+    if (stored != checksum64(raw.data(), body) || forPart != partChecksum || states != ft->states) return false;
+    size_t offBytes = ((size_t)terms + 1) * sizeof(uint32_t);
+    if (body - MEANING_INDEX_HEADER_SIZE < offBytes * 2) return false;
+    const char* at = raw.data() + MEANING_INDEX_HEADER_SIZE;
+    ft->termOffStore.resize(terms + 1);
+    ft->postOffStore.resize(terms + 1);
+    memcpy(ft->termOffStore.data(), at, offBytes);
+    memcpy(ft->postOffStore.data(), at + offBytes, offBytes);
+    at += offBytes * 2;
+    size_t textBytes = ft->termOffStore[terms], postingBytes = ft->postOffStore[terms];
+    if ((size_t)(raw.data() + body - at) != textBytes + postingBytes) {
+        ft->termOffStore.clear();
+        ft->postOffStore.clear();
+        return false;
+    }
+    ft->termTextStore.assign(at, textBytes);
+    ft->postingsStore.assign((const uint8_t*)at + textBytes, (const uint8_t*)at + textBytes + postingBytes);
+    attachIndexStores(ft);
+    return true;
+}
+
+// runs work(0) .. work(tasks - 1) on up to `threads` cores, handing the
+// tasks out in order
+template<class F>
+void forEachTask(size_t tasks, unsigned threads, F work) {
+    atomic<size_t> nextTask(0);
+    runWorkers((unsigned)max<size_t>(1, min<size_t>(threads, tasks)), [&](unsigned) {
+        for (size_t t; (t = nextTask++) < tasks;) work(t);
+    });
+}
+
+// encodes every text as one HUF4 stream with its own code. Counting bytes
+// and then encoding are both split into HUFF_CHUNK_SIZE pieces of all the
+// texts, shared out over up to `threads` cores.
+vector<string> encodeHuffStreams(const vector<string_view> &texts, unsigned threads) {
+    vector<pair<size_t, size_t>> chunks;    // text, first byte
+    vector<size_t> firstChunk;
+    for (size_t i = 0; i < texts.size(); i++) {
+        firstChunk.push_back(chunks.size());
+        size_t at = 0;
+        do {
+            chunks.push_back({i, at});
+            at += HUFF_CHUNK_SIZE;
+        } while (at < texts[i].size());
+    }
+    firstChunk.push_back(chunks.size());
+    auto chunkText = [&](size_t c) {
+        return texts[chunks[c].first].substr(chunks[c].second, HUFF_CHUNK_SIZE);
+    };
+
+    vector<array<uint64_t, 256>> counts(chunks.size());
+    forEachTask(chunks.size(), threads, [&](size_t c) {
+        string_view piece = chunkText(c);
+        counts[c].fill(0);
+        countByteFrequencies(piece.data(), piece.size(), counts[c].data());
+    });
+    vector<HuffmanCode> codes(texts.size());
+    forEachTask(texts.size(), threads, [&](size_t i) {
+        uint64_t freq[256] = {};
+        for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) {
+            for (int b = 0; b < 256; b++) freq[b] += counts[c][b];
+        }
+        codes[i] = buildHuffmanCode(freq);
+    });
+
+    vector<string> packed(chunks.size());
+    forEachTask(chunks.size(), threads, [&](size_t c) {
+        string_view piece = chunkText(c);
+        huffmanEncode(codes[chunks[c].first], piece.data(), piece.size(), packed[c]);
+    });
+
+    vector<string> out(texts.size());
+    forEachTask(texts.size(), threads, [&](size_t i) {
+        uint64_t textLen = texts[i].size(), chunkSize = HUFF_CHUNK_SIZE;
+        uint64_t count = firstChunk[i + 1] - firstChunk[i], end = 0;
+        size_t total = HUFF_CHUNKED_HEADER_SIZE + count * 8;
+        for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) total += packed[c].size();
+        string &file = out[i];
+        file.reserve(total);
+        file.append(HUFF_CHUNKED_MAGIC, 4);
+        file.append((const char*)&textLen, 8);
+        file.append((const char*)&chunkSize, 8);
+        file.append((const char*)&count, 8);
+        file.append((const char*)codes[i].len, 256);
+        for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) {
+            end += packed[c].size();
+            file.append((const char*)&end, 8);
+        }
+        for (size_t c = firstChunk[i]; c < firstChunk[i + 1]; c++) {
+            file += packed[c];
+            string().swap(packed[c]);
+        }
+    });
+    return out;
+}
+
+string encodeHuffStream(const string &text, unsigned threads = 1) {
+    return move(encodeHuffStreams({string_view(text)}, threads)[0]);
+}
+
+// a HUF2 or HUF4 stream with its chunk table read out; HUF2 is one chunk
+struct HuffStreamView {
+    HuffmanCode code;
+    uint64_t textLen = 0;
+    uint64_t chunkSize = 1;
+    vector<uint64_t> chunkEnd;
+    const char* bits = nullptr;
+};
+
+bool parseHuffStream(string_view raw, HuffStreamView &s) {
+    size_t bitsLen;
+    if (raw.size() >= HUFF_HEADER_SIZE && memcmp(raw.data(), HUFF_MAGIC, 4) == 0) {
+        memcpy(&s.textLen, raw.data() + 4, 8);
+        memcpy(s.code.len, raw.data() + 12, 256);
+        bitsLen = raw.size() - HUFF_HEADER_SIZE;
+        s.chunkSize = max<uint64_t>(s.textLen, 1);
+        s.chunkEnd.assign(1, bitsLen);
+        s.bits = raw.data() + HUFF_HEADER_SIZE;
+    } else if (raw.size() >= HUFF_CHUNKED_HEADER_SIZE && memcmp(raw.data(), HUFF_CHUNKED_MAGIC, 4) == 0) {
+        uint64_t count;
+        memcpy(&s.textLen, raw.data() + 4, 8);
+        memcpy(&s.chunkSize, raw.data() + 12, 8);
+        memcpy(&count, raw.data() + 20, 8);
+        memcpy(s.code.len, raw.data() + 28, 256);
+        size_t rest = raw.size() - HUFF_CHUNKED_HEADER_SIZE;
+        if (s.chunkSize == 0 || count > rest / 8 ||
+            count != (s.textLen == 0 ? 1 : (s.textLen - 1) / s.chunkSize + 1)) {
+            return false;
+        }
+        s.chunkEnd.resize(count);
+        memcpy(s.chunkEnd.data(), raw.data() + HUFF_CHUNKED_HEADER_SIZE, count * 8);
+        bitsLen = rest - count * 8;
+        s.bits = raw.data() + HUFF_CHUNKED_HEADER_SIZE + count * 8;
+    } else {
+        return false;
+    }
+    // every byte costs at least one bit, which bounds a corrupted length
+    uint64_t prev = 0;
+    for (size_t c = 0; c < s.chunkEnd.size(); c++) {
+        uint64_t len = min(s.chunkSize, s.textLen - c * s.chunkSize);
+        if (s.chunkEnd[c] < prev || s.chunkEnd[c] > bitsLen || len > (s.chunkEnd[c] - prev) * 8) return false;
+        prev = s.chunkEnd[c];
+    }
+    return prev == bitsLen && buildCanonicalCode(s.code);
+}
+
+// decodes streams[i] into *out[i], spreading the chunks of all streams over
+// up to `threads` cores. Returns the index of a corrupted stream, or -1.
+long decodeHuffStreams(const vector<string_view> &streams, const vector<string*> &out, unsigned threads) {
+    vector<HuffStreamView> views(streams.size());
+    atomic<long> bad(-1);
+    forEachTask(streams.size(), threads, [&](size_t i) {
+        if (!parseHuffStream(streams[i], views[i])) bad = (long)i;
+        else out[i]->resize(views[i].textLen);
+    });
+    if (bad >= 0) return bad;
+
+    vector<pair<size_t, size_t>> chunks;    // stream, chunk
+    for (size_t i = 0; i < views.size(); i++) {
+        for (size_t c = 0; c < views[i].chunkEnd.size(); c++) chunks.push_back({i, c});
+    }
+    forEachTask(chunks.size(), threads, [&](size_t t) {
+        if (bad >= 0) return;
+        auto [i, c] = chunks[t];
+        const HuffStreamView &s = views[i];
+        uint64_t from = c ? s.chunkEnd[c - 1] : 0;
+        uint64_t at = c * s.chunkSize;
+        if (!huffmanDecode(s.code, s.bits + from, s.chunkEnd[c] - from, out[i]->data() + at,
+                           min(s.chunkSize, s.textLen - at))) {
+            bad = (long)i;
+        }
+    });
+    if (bad >= 0) out[bad]->clear();
+    return bad;
+}
+
+bool decodeHuffStream(string_view raw, string &decoded, unsigned threads = 1) {
+    return decodeHuffStreams({raw}, {&decoded}, threads) < 0;
+}
+
+// appends the weight table of a partition file, if it needs one
+void appendPartitionWeights(string &file, const vector<pair<uint32_t, uint32_t>> &weights) {
+    if (weights.empty()) return;
+    uint64_t count = weights.size();
+    file.append(PART_WEIGHTS_MAGIC, 4);
+    file.append((const char*)&count, 8);
+    for (auto [line, w] : weights) {
+        file.append((const char*)&line, 4);
+        file.append((const char*)&w, 4);
+    }
+}
+
+// splits a partition file into its Huffman stream and its weights; false if
+// what follows the stream is not a weight table
+bool splitPartitionFile(string_view file, string_view &stream, vector<pair<uint32_t, uint32_t>> &weights) {
+    stream = file;
+    weights.clear();
+    // only chunked streams can be followed by anything; their size is in the header
+    if (file.size() < HUFF_CHUNKED_HEADER_SIZE || memcmp(file.data(), HUFF_CHUNKED_MAGIC, 4) != 0) return true;
+    uint64_t count, end;
+    memcpy(&count, file.data() + 20, 8);
+    size_t table = HUFF_CHUNKED_HEADER_SIZE;
+    if (count == 0 || count > (file.size() - table) / 8) return false;
+    memcpy(&end, file.data() + table + (count - 1) * 8, 8);
+    if (end > file.size() - table - count * 8) return false;
+    stream = file.substr(0, table + count * 8 + end);
+    string_view rest = file.substr(stream.size());
+    if (rest.empty()) return true;
+    if (rest.size() < 12 || memcmp(rest.data(), PART_WEIGHTS_MAGIC, 4) != 0) return false;
+    memcpy(&count, rest.data() + 4, 8);
+    if (count != (rest.size() - 12) / 8 || (rest.size() - 12) % 8 != 0) return false;
+    weights.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        memcpy(&weights[i].first, rest.data() + 12 + i * 8, 4);
+        memcpy(&weights[i].second, rest.data() + 16 + i * 8, 4);
+    }
+    return true;
+}
+
+bool parseHuffManifest(string_view raw, HuffManifest &m) {
+    size_t body = 4 + 8 + 8 + sizeof(m.parts);
+    bool hasSeq = raw.size() == body + 8;
+    if (!hasSeq) body -= 8;
+    if (raw.size() != body + 8 || memcmp(raw.data(), HUFF_MANIFEST_MAGIC, 4) != 0) return false;
+    uint64_t stored;
+    memcpy(&stored, raw.data() + body, 8);
+    if (stored != checksum64(raw.data(), body)) return false;
+    memcpy(&m.generation, raw.data() + 4, 8);
+    m.walSeq = 0;
+    if (hasSeq) memcpy(&m.walSeq, raw.data() + 12, 8);
+    memcpy(m.parts, raw.data() + (hasSeq ? 20 : 12), sizeof(m.parts));
+    return true;
+}
+
+string encodeHuffManifest(const HuffManifest &m) {
+    string out(HUFF_MANIFEST_MAGIC, 4);
+    out.append((const char*)&m.generation, 8);
+    out.append((const char*)&m.walSeq, 8);
+    out.append((const char*)m.parts, sizeof(m.parts));
+    uint64_t sum = checksum64(out.data(), out.size());
+    out.append((const char*)&sum, 8);
+    return out;
+}
+
+// saves the dictionary as a partitioned snapshot at path. Only partitions
+// changed since this process last saved or loaded that same snapshot are
+// re-encoded (all of them with rewriteAll), in parallel on up to `threads`
+// cores (0 = every core).
+bool writeCompressedDictionary(const string &path, string &error, bool rewriteAll = false, unsigned threads = 0) {
+    MetricTimer timer(MH_SNAPSHOT_SAVE);
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    lock_guard<mutex> saving(snapshotMutex);
+    string raw;
+    HuffManifest old;
+    bool haveOld = readWholeFile(path, raw) && parseHuffManifest(raw, old);
+
+    ReadGuard guard;
+    const DictState* st;
+    bitset<FROZEN_PARTS> dirty;
+    {
+        // with the buffer folded in, each partition's index covers all its
+        // words and can be saved with it
+        lock_guard<mutex> lock(writerMutex);
+        freezeLocked();
+        st = dictState.load();
+        dirty = unsavedParts;
+        unsavedParts.reset();
+    }
+    auto keepUnsaved = [&] {
+        lock_guard<mutex> lock(writerMutex);
+        unsavedParts |= dirty;
+    };
+    if (st->frozenWords + st->bufferedWords == 0) {
+        keepUnsaved();
+        error = "Nothing to save.";
+        return false;
+    }
+
+    // the bits only describe the snapshot this process last saved or loaded
+    bool incremental = !rewriteAll && haveOld && path == huffSnapshot.path &&
+                       old.generation == huffSnapshot.generation;
+    HuffManifest next;
+    next.generation = old.generation + 1;
+    next.walSeq = st->walSeq;
+    vector<int> todo;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        const HuffPart &prev = old.parts[p];
+        bool reuse = incremental && !dirty[p];
+        if (reuse && prev.generation) {
+            ifstream fin(huffPartPath(path, p, prev.generation), ios::binary | ios::ate);
+            reuse = fin && (uint64_t)fin.tellg() == prev.bytes;
+        }
+        if (reuse) next.parts[p] = prev;
+        else todo.push_back(p);
+    }
+
+    // gather the text and index of every partition to rewrite, then encode
+    // them all with one pool so a large partition does not leave the other
+    // cores idle
+    vector<string> texts(todo.size()), indexes(todo.size());
+    vector<size_t> words(todo.size());
+    vector<vector<pair<uint32_t, uint32_t>>> weights(todo.size());
+    atomic<bool> unreadable(false);
+    forEachTask(todo.size(), threads, [&](size_t i) {
+        int p = todo[i];
+        unique_ptr<FrozenTrie> decoded;
+        const FrozenTrie* ft = st->failed[p] ? nullptr : peekPartition(st, p, decoded);
+        if (!ft) {
+            // its words are still only in the old file, so it must not be written empty
+            if (st->pending[p]) unreadable = true;
+            return;
+        }
+        vector<TrieEntry> entries;
+        string current;
+        collectFrozenWords(ft, 0, current, entries);
+        words[i] = entries.size();
+        for (size_t e = 0; e < entries.size(); e++) {
+            texts[i].append(partitionKey(p)).append(entries[e].key).append(" - ").append(entries[e].meaning).append("\n");
+            if (entries[e].weight) weights[i].push_back({(uint32_t)e, entries[e].weight});
+        }
+        indexes[i] = encodeMeaningIndex(ft);
+    });
+    if (unreadable) {
+        keepUnsaved();
+        error = "Some partitions could not be decoded; not saving to " + path + ".";
+        return false;
+    }
+    vector<size_t> written;
+    vector<string_view> views;
+    for (size_t i = 0; i < todo.size(); i++) {
+        if (words[i]) {
+            written.push_back(i);
+            views.push_back(texts[i]);
+        }
+    }
+    vector<string> files = encodeHuffStreams(views, threads);
+    vector<string>().swap(texts);
+
+    atomic<bool> failed(false);
+    forEachTask(files.size(), threads, [&](size_t f) {
+        int p = todo[written[f]];
+        string &file = files[f];
+        appendPartitionWeights(file, weights[written[f]]);
+        string &index = indexes[written[f]];
+        next.parts[p] = {next.generation, words[written[f]], file.size(), checksum64(file.data(), file.size())};
+        stampMeaningIndex(index, next.parts[p].checksum);
+        if (!writeWholeFile(huffPartPath(path, p, next.generation), file) ||
+            !writeWholeFile(huffIndexPath(path, p, next.generation), index)) {
+            failed = true;
+        }
+    });
+
+    string tmp = path + ".tmp";
+    if (failed || !writeWholeFile(tmp, encodeHuffManifest(next)) || !replaceFile(tmp, path)) {
+        for (int p : todo) {
+            remove(huffPartPath(path, p, next.generation).c_str());
+            remove(huffIndexPath(path, p, next.generation).c_str());
+        }
+        remove(tmp.c_str());
+        keepUnsaved();
+        error = "Error writing " + path + ".";
+        return false;
+    }
+    huffSnapshot = {path, next.generation};
+    // the new manifest names only synced files; until its rename is on disk
+    // too, a crash may bring back the old manifest, so keep what it names
+    if (!syncParentDirectory(path)) {
+        keepUnsaved();
+        error = "Error syncing the directory of " + path + ".";
+        return false;
+    }
+    for (int p = 0; p < FROZEN_PARTS && haveOld; p++) {
+        uint64_t gen = old.parts[p].generation;
+        if (gen && gen != next.parts[p].generation) {
+            remove(huffPartPath(path, p, gen).c_str());
+            remove(huffIndexPath(path, p, gen).c_str());
+        }
+    }
+    return true;
+}
+
+// caller holds snapshotMutex; swaps in a state read from the snapshot at
+// path, keeping the snapshot's log position unless supersedesLog (see
+// replaceDictionaryLocked)
+void adoptSnapshot(DictState* fresh, const string &path, const HuffManifest* m, bool supersedesLog = true) {
+    {
+        lock_guard<mutex> lock(writerMutex);
+        replaceDictionaryLocked(fresh, supersedesLog);
+        // a single-stream file is rewritten in full by the next save
+        if (m) unsavedParts.reset();
+    }
+    huffSnapshot = {path, m ? m->generation : 0};
+}
+
+// decodes one partition file of a snapshot and builds its frozen trie,
+// taking the meaning index from index (the .idx file, may be empty) if it
+// matches
+FrozenTrie* decodeSnapshotPartition(string_view file, string_view index, const HuffPart &part, int p) {
+    string text;
+    string_view stream;
+    vector<pair<uint32_t, uint32_t>> weights;
+    if (file.size() != part.bytes || checksum64(file.data(), file.size()) != part.checksum ||
+        !splitPartitionFile(file, stream, weights) || !decodeHuffStream(stream, text)) {
+        return nullptr;
+    }
+    DictState* st = buildStateFromBuffers({string_view(text)}, 1, false);
+    FrozenTrie* ft = st->parts[p];
+    st->parts[p] = nullptr;
+    freeWholeState(st);
+    if (ft) setFrozenWeights(ft, weights);
+    if (ft && !attachMeaningIndex(ft, index, part.checksum)) indexFrozenTrie(ft);
+    return ft;
+}
+
+// opens a partitioned snapshot as the whole dictionary without decoding
+// anything: partition files are mapped and each is decoded when first read.
+// Files a later save removes stay readable through the mapping. The state
+// keeps the snapshot's log position, so opening it at startup replays only
+// newer records (check logContinuesFrom first).
+bool openCompressedDictionary(const string &path, string &error) {
+    MetricTimer timer(MH_SNAPSHOT_LOAD);
+    lock_guard<mutex> loading(snapshotMutex);
+    string raw;
+    HuffManifest m;
+    if (!readWholeFile(path, raw)) {
+        error = "No compressed file found (" + path + ").";
+        return false;
+    }
+    if (!parseHuffManifest(raw, m)) {
+        error = "Not a partitioned snapshot (" + path + ").";
+        return false;
+    }
+    auto lazy = make_shared<LazyParts>();
+    lazy->source = path;
+    vector<shared_ptr<MappedFile>> files(FROZEN_PARTS), indexFiles(FROZEN_PARTS);
+    DictState* fresh = new DictState();
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (!m.parts[p].generation) continue;
+        files[p] = mapFile(huffPartPath(path, p, m.parts[p].generation));
+        if (!files[p] || files[p]->size != m.parts[p].bytes) {
+            delete fresh;
+            error = "Missing or truncated partition files for " + path + ".";
+            return false;
+        }
+        indexFiles[p] = mapFile(huffIndexPath(path, p, m.parts[p].generation));
+        lazy->words[p] = m.parts[p].words;
+        fresh->frozenWords += m.parts[p].words;
+        fresh->pending.set(p);
+    }
+    lazy->decode = [files, indexFiles, m](int p) -> FrozenTrie* {
+        if (!files[p]) return nullptr;
+        string_view index = indexFiles[p] ? string_view(indexFiles[p]->data, indexFiles[p]->size) : string_view();
+        return decodeSnapshotPartition(string_view(files[p]->data, files[p]->size), index, m.parts[p], p);
+    };
+    fresh->lazy = lazy;
+    fresh->walSeq = m.walSeq;
+    adoptSnapshot(fresh, path, &m, false);
+    return true;
+}
+
+// loads a snapshot as the whole dictionary, decoding its partitions in
+// parallel on up to `threads` cores (0 = every core)
+bool readCompressedDictionary(const string &path, string &error, unsigned threads = 0) {
+    MetricTimer timer(MH_SNAPSHOT_LOAD);
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    lock_guard<mutex> loading(snapshotMutex);
+    string raw;
+    if (!readWholeFile(path, raw)) {
+        error = "No compressed file found (" + path + ").";
+        return false;
+    }
+
+    HuffManifest m;
+    bool partitioned = parseHuffManifest(raw, m);
+    vector<string> texts(partitioned ? FROZEN_PARTS : 1), indexes(FROZEN_PARTS);
+    vector<vector<pair<uint32_t, uint32_t>>> weights(FROZEN_PARTS);
+    if (!partitioned) {
+        if (raw.size() < HUFF_HEADER_SIZE || memcmp(raw.data(), HUFF_MAGIC, 4) != 0) {
+            error = "Invalid file format.";
+            return false;
+        }
+        if (!decodeHuffStream(raw, texts[0], threads)) {
+            error = "Corrupted file.";
+            return false;
+        }
+    } else {
+        vector<string> files(FROZEN_PARTS);
+        atomic<int> bad(-1);
+        forEachTask(FROZEN_PARTS, threads, [&](size_t p) {
+            const HuffPart &part = m.parts[p];
+            if (!part.generation || bad >= 0) return;
+            if (!readWholeFile(huffPartPath(path, p, part.generation), files[p]) ||
+                files[p].size() != part.bytes || checksum64(files[p].data(), files[p].size()) != part.checksum) {
+                bad = (int)p;
+            }
+            readWholeFile(huffIndexPath(path, p, part.generation), indexes[p]);
+        });
+        // chunks of all partitions share the workers, as on save
+        vector<int> present;
+        vector<string_view> streams;
+        vector<string*> outs;
+        for (int p = 0; p < FROZEN_PARTS && bad < 0; p++) {
+            if (!m.parts[p].generation) continue;
+            string_view stream;
+            if (!splitPartitionFile(files[p], stream, weights[p])) bad = p;
+            present.push_back(p);
+            streams.push_back(stream);
+            outs.push_back(&texts[p]);
+        }
+        if (bad < 0) {
+            long corrupt = decodeHuffStreams(streams, outs, threads);
+            if (corrupt >= 0) bad = present[corrupt];
+        }
+        vector<string>().swap(files);
+        if (bad >= 0) {
+            char hex[8];
+            snprintf(hex, sizeof(hex), "%02x", bad.load());
+            error = "Corrupted file (partition " + string(hex) + " of " + path + ").";
+            return false;
+        }
+    }
+
+    // build the new dictionary off to the side, then swap it in; saved
+    // meaning indexes spare tokenizing the meanings again
+    vector<string_view> inputs(texts.begin(), texts.end());
+    DictState* fresh = buildStateFromBuffers(inputs, threads, !partitioned);
+    if (partitioned) {
+        forEachTask(FROZEN_PARTS, threads, [&](size_t p) {
+            FrozenTrie* ft = fresh->parts[p];
+            if (ft) setFrozenWeights(ft, weights[p]);
+            if (ft && !attachMeaningIndex(ft, indexes[p], m.parts[p].checksum)) indexFrozenTrie(ft);
+        });
+    }
+    adoptSnapshot(fresh, path, partitioned ? &m : nullptr);
+    return true;
+}
+
+void saveCompressedDictionaryToFile() {
+    string error;
+    if (writeCompressedDictionary(HUFF_FILE, error)) {
+        cout << "Dictionary compressed and saved to " << HUFF_FILE << "\n";
+    } else {
+        cout << error << "\n";
+    }
+}
+
+void loadCompressedDictionaryFromFile() {
+    string error;
+    if (readCompressedDictionary(HUFF_FILE, error)) {
+        cout << "Dictionary loaded and decoded back into Trie from " << HUFF_FILE << "\n";
+    } else {
+        cout << error << "\n";
+    }
+}
+
+// ======================= BINARY IMAGE SECTION =======================
+// File format: dictionary.img (native byte order, everything 8-byte aligned)
+// ImageHeader
+// ImagePart[FROZEN_PARTS]
+// per non-empty partition: base[states], check[states], value[states],
+//    maxWeight[states], firstChild[states], nextSibling[states],
+//    meaningOff[entries + 1], weight[entries],
+//    blockStart[blocks + 1], blockBytes[blocks + 1],
+//    256 code lengths, packed meaning blocks,
+//    meaning index: termOff[terms + 1], postOff[terms + 1], term text, postings
+//
+// The frozen partitions are used straight from the mapping, so loading is
+// just a header check and processes mapping the same image share its pages.
+// Each partition is checksummed before its arrays are first trusted.
+
+const string IMAGE_FILE = "dictionary.img";
+const char IMAGE_MAGIC[8] = {'D', 'I', 'C', 'T', 'I', 'M', 'G', '\0'};
+const uint32_t IMAGE_VERSION = 6;
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t partCount;
+    uint64_t fileSize;
+    uint64_t walSeq;            // last write-ahead log record in the image
+    uint64_t headerChecksum;    // over header + part table, this field zeroed
+};
+
+struct ImagePart {
+    uint32_t states;
+    uint32_t entries;
+    uint32_t blocks;
+    uint32_t terms;
+    uint64_t offset;            // start of base[], 0 for an empty partition
+    uint64_t bytes;
+    uint64_t checksum;          // over the partition's arrays
+};
+
+size_t alignTo8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+size_t partitionImageBytes(const FrozenTrie* ft) {
+    return alignTo8(ft->states * sizeof(int32_t)) * 4 + alignTo8(ft->states) * 2
+         + alignTo8((ft->entries + 1) * sizeof(uint32_t))
+         + alignTo8(ft->entries * sizeof(uint32_t))
+         + alignTo8((ft->blocks + 1) * sizeof(uint32_t)) * 2
+         + 256 + alignTo8(ft->packedSize())
+         + alignTo8((ft->terms + 1) * sizeof(uint32_t)) * 2
+         + alignTo8(ft->termOff[ft->terms]) + alignTo8(ft->postOff[ft->terms]);
+}
+
+void appendAligned(string &out, const void* data, size_t len) {
+    out.append((const char*)data, len);
+    out.resize(alignTo8(out.size()), '\0');
+}
+
+uint64_t imageHeaderChecksum(ImageHeader header, const ImagePart* parts) {
+    header.headerChecksum = 0;
+    uint64_t h = checksum64(&header, sizeof(header));
+    return checksum64(parts, sizeof(ImagePart) * header.partCount, h);
+}
+
+// lays the frozen partitions out as a complete image in out; walSeq, if
+// given, receives the log position the image was taken at. False if a
+// partition could not be decoded, as the image would be missing its words.
+bool encodeDictionaryImage(string &out, uint64_t* walSeq = nullptr) {
+    // the image holds frozen partitions only, so take a state with an empty buffer
+    ReadGuard guard;
+    const DictState* st;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        foldLookupCountsLocked();
+        st = dictState.load();
+    }
+
+    ImageHeader header;
+    memcpy(header.magic, IMAGE_MAGIC, 8);
+    header.version = IMAGE_VERSION;
+    header.partCount = FROZEN_PARTS;
+    header.walSeq = st->walSeq;
+    if (walSeq) *walSeq = st->walSeq;
+    ImagePart parts[FROZEN_PARTS] = {};
+
+    // the header and part table are filled in once the partitions are laid out
+    out.assign(sizeof(ImageHeader) + sizeof(parts), '\0');
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        unique_ptr<FrozenTrie> decoded;
+        const FrozenTrie* ft = st->failed[p] ? nullptr : peekPartition(st, p, decoded);
+        if (!ft && st->pending[p]) return false;
+        if (!ft) continue;
+        size_t start = out.size();
+        appendAligned(out, ft->base, ft->states * sizeof(int32_t));
+        appendAligned(out, ft->check, ft->states * sizeof(int32_t));
+        appendAligned(out, ft->value, ft->states * sizeof(int32_t));
+        appendAligned(out, ft->maxWeight, ft->states * sizeof(uint32_t));
+        appendAligned(out, ft->firstChild, ft->states);
+        appendAligned(out, ft->nextSibling, ft->states);
+        appendAligned(out, ft->meaningOff, (ft->entries + 1) * sizeof(uint32_t));
+        appendAligned(out, ft->weight, ft->entries * sizeof(uint32_t));
+        appendAligned(out, ft->blockStart, (ft->blocks + 1) * sizeof(uint32_t));
+        appendAligned(out, ft->blockBytes, (ft->blocks + 1) * sizeof(uint32_t));
+        appendAligned(out, ft->codeLens, 256);
+        appendAligned(out, ft->packed, ft->packedSize());
+        appendAligned(out, ft->termOff, (ft->terms + 1) * sizeof(uint32_t));
+        appendAligned(out, ft->postOff, (ft->terms + 1) * sizeof(uint32_t));
+        appendAligned(out, ft->termText, ft->termOff[ft->terms]);
+        appendAligned(out, ft->postings, ft->postOff[ft->terms]);
+        parts[p].states = ft->states;
+        parts[p].entries = ft->entries;
+        parts[p].blocks = ft->blocks;
+        parts[p].terms = ft->terms;
+        parts[p].offset = start;
+        parts[p].bytes = out.size() - start;
+        parts[p].checksum = checksum64(out.data() + start, parts[p].bytes);
+    }
+    header.fileSize = out.size();
+    header.headerChecksum = imageHeaderChecksum(header, parts);
+    memcpy(&out[0], &header, sizeof(header));
+    memcpy(&out[sizeof(header)], parts, sizeof(parts));
+    return true;
+}
+
+bool writeDictionaryImage(const string &path, uint64_t* walSeq = nullptr) {
+    MetricTimer timer(MH_IMAGE_SAVE);
+    string image;
+    if (!encodeDictionaryImage(image, walSeq)) return false;
+
+    // write next to the target and rename, so a mapped image is never torn
+    // (it keeps the old file, which Windows needs moved aside first);
+    // both are on disk before returning, as the caller may then trim the log
+    string tmp = path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) return false;
+    bool ok = fwrite(image.data(), 1, image.size(), out) == image.size();
+    ok = syncFile(out) && ok;
+    ok = fclose(out) == 0 && ok;
+    return ok && replaceFile(tmp, path) && syncParentDirectory(path);
+}
+
+// the frozen trie of one image partition, using its arrays in place; null
+// with error set if its checksum or its array sizes do not match
+FrozenTrie* mapImagePartition(const shared_ptr<MappedFile> &mf, const ImagePart &part, string &error) {
+    const char* at = mf->data + part.offset;
+    if (checksum64(at, part.bytes) != part.checksum) {
+        error = "checksum mismatch";
+        return nullptr;
+    }
+    unique_ptr<FrozenTrie> ft(new FrozenTrie());
+    ft->states = part.states;
+    ft->entries = part.entries;
+    ft->blocks = part.blocks;
+    ft->image = mf;
+    size_t arrayBytes = alignTo8(part.states * sizeof(int32_t));
+    size_t blockBytes = alignTo8((part.blocks + 1) * sizeof(uint32_t));
+    ft->base = (const int32_t*)at;
+    ft->check = (const int32_t*)(at + arrayBytes);
+    ft->value = (const int32_t*)(at + arrayBytes * 2);
+    ft->maxWeight = (const uint32_t*)(at + arrayBytes * 3);
+    at += arrayBytes * 4;
+    ft->firstChild = (const uint8_t*)at;
+    ft->nextSibling = (const uint8_t*)(at + alignTo8(part.states));
+    at += alignTo8(part.states) * 2;
+    ft->meaningOff = (const uint32_t*)at;
+    at += alignTo8((part.entries + 1) * sizeof(uint32_t));
+    ft->weight = (const uint32_t*)at;
+    at += alignTo8(part.entries * sizeof(uint32_t));
+    ft->blockStart = (const uint32_t*)at;
+    ft->blockBytes = (const uint32_t*)(at + blockBytes);
+    ft->codeLens = (const unsigned char*)(at + blockBytes * 2);
+    ft->packed = (const char*)(at + blockBytes * 2 + 256);
+    // the sizes of the packed blocks and of the index are read from the
+    // partition itself, so each array is bounded before its last value is read
+    const char* partEnd = mf->data + part.offset + part.bytes;
+    size_t termBytes = alignTo8(((size_t)part.terms + 1) * sizeof(uint32_t));
+    bool fits = ft->packed <= partEnd && alignTo8(ft->packedSize()) <= (size_t)(partEnd - ft->packed);
+    at = fits ? ft->packed + alignTo8(ft->packedSize()) : partEnd;
+    fits = fits && termBytes * 2 <= (size_t)(partEnd - at);
+    ft->terms = part.terms;
+    ft->termOff = (const uint32_t*)at;
+    ft->postOff = (const uint32_t*)(at + termBytes);
+    ft->termText = fits ? at + termBytes * 2 : partEnd;
+    fits = fits && alignTo8(ft->termOff[ft->terms]) <= (size_t)(partEnd - ft->termText);
+    ft->postings = (const uint8_t*)(fits ? ft->termText + alignTo8(ft->termOff[ft->terms]) : partEnd);
+    if (!fits || partitionImageBytes(ft.get()) != part.bytes) {
+        error = "size mismatch";
+        return nullptr;
+    }
+    if (!attachFrozenCode(ft.get())) {
+        error = "bad code table";
+        return nullptr;
+    }
+    return ft.release();
+}
+
+// swaps the image in mf in as the frozen dictionary. verifyParts checks every
+// partition now, which touches every page of the image; otherwise each one
+// starts out pending and is checked when first used, so a damaged partition
+// fails on its own instead of being read out of bounds
+bool adoptDictionaryImage(shared_ptr<MappedFile> mf, bool verifyParts, string &error) {
+    size_t tableEnd = sizeof(ImageHeader) + sizeof(ImagePart) * FROZEN_PARTS;
+    if (mf->size < tableEnd) {
+        error = "file too small";
+        return false;
+    }
+    ImageHeader header;
+    memcpy(&header, mf->data, sizeof(header));
+    const ImagePart* parts = (const ImagePart*)(mf->data + sizeof(ImageHeader));
+    if (memcmp(header.magic, IMAGE_MAGIC, 8) != 0) {
+        error = "not a dictionary image";
+        return false;
+    }
+    if (header.version != IMAGE_VERSION || header.partCount != FROZEN_PARTS) {
+        error = "unsupported image version " + to_string(header.version);
+        return false;
+    }
+    if (header.fileSize != mf->size || imageHeaderChecksum(header, parts) != header.headerChecksum) {
+        error = "header checksum mismatch";
+        return false;
+    }
+
+    DictState* st = new DictState();
+    auto lazy = make_shared<LazyParts>();
+    lazy->source = "the dictionary image";
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        const ImagePart &part = parts[p];
+        if (part.states == 0) continue;
+        if (part.offset % 8 != 0 || part.offset > mf->size || part.bytes > mf->size - part.offset) {
+            freeWholeState(st);
+            error = "partition " + to_string(p) + " out of range";
+            return false;
+        }
+        st->frozenWords += part.entries;
+        if (verifyParts) {
+            st->parts[p] = mapImagePartition(mf, part, error);
+            if (st->parts[p]) continue;
+            freeWholeState(st);
+            error = "partition " + to_string(p) + ": " + error;
+            return false;
+        }
+        lazy->words[p] = part.entries;
+        st->pending.set(p);
+    }
+    if (st->pending.any()) {
+        lazy->decode = [mf, parts](int p) {
+            string error;
+            return mapImagePartition(mf, parts[p], error);
+        };
+        st->lazy = lazy;
+    }
+    st->walSeq = header.walSeq;
+    replaceDictionary(st, false);
+    return true;
+}
+
+bool mapDictionaryImage(const string &path, bool verifyParts, string &error) {
+    MetricTimer timer(MH_IMAGE_LOAD);
+    shared_ptr<MappedFile> mf = mapFile(path);
+#ifdef _WIN32
+    // a crash inside replaceFile can leave the last image only under path.old
+    if (!mf) mf = mapFile(path + ".old");
+#endif
+    if (!mf) {
+        error = "cannot open " + path;
+        return false;
+    }
+    return adoptDictionaryImage(mf, verifyParts, error);
+}
+
+// ----- embedded image -----
+// The same image can be linked into the program, so a build starts with its
+// word list already laid out in .rodata: nothing is parsed and the pages are
+// shared through the page cache by every process running that binary.
+//   ./myDic --emit-embedded dictionary_embedded.inc a.txt ... z.txt
+//   g++ -O2 -DDICT_EMBEDDED myDic.cpp -o myDic
+// With no word files the built-in list is emitted. The image is in native
+// byte order, so it is generated on (or for) the machine it is built for.
+// MSVC caps the length of a string literal, so this needs GCC or Clang.
+// A dictionary.img on disk still takes precedence, since it holds the saves.
+
+// writes the current dictionary as a C++ array definition; run before the
+// log is opened so the image's walSeq is 0
+bool writeEmbeddedImage(const string &path, string &error) {
+    string image;
+    if (!encodeDictionaryImage(image)) {
+        error = "some partitions could not be decoded";
+        return false;
+    }
+    string out;
+    out.reserve(image.size() * 4 + 256);
+    out += "// Generated by myDic --emit-embedded, do not edit.\n";
+    out += "// " + to_string(frozenWordCount()) + " words, image version " + to_string(IMAGE_VERSION) + "\n";
+    // one long string literal: compilers take it far faster than a brace list
+    // of numbers. Octal escapes are always three digits, so a digit after one
+    // cannot extend it
+    out += "alignas(8) const char EMBEDDED_IMAGE[] =\n\"";
+    for (size_t i = 0; i < image.size(); i++) {
+        unsigned char c = image[i];
+        if (c >= 32 && c < 127 && c != '\\' && c != '"' && c != '?') {
+            out += (char)c;
+        } else {
+            out += '\\';
+            out += (char)('0' + (c >> 6));
+            out += (char)('0' + ((c >> 3) & 7));
+            out += (char)('0' + (c & 7));
+        }
+        if (i % 64 == 63 && i + 1 < image.size()) out += "\"\n\"";
+    }
+    out += "\";\n";
+
+    string tmp = path + ".tmp";
+    ofstream fout(tmp, ios::binary);
+    if (fout) fout.write(out.data(), out.size());
+    fout.close();
+    if (!fout || !replaceFile(tmp, path)) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+#ifdef DICT_EMBEDDED
+#include "dictionary_embedded.inc"
+
+// adopts the linked-in image in place; only the per-partition headers,
+// lookup counters and decode tables are allocated
+bool loadEmbeddedDictionary(string &error) {
+    MetricTimer timer(MH_IMAGE_LOAD);
+    auto mf = make_shared<MappedFile>();
+    mf->data = EMBEDDED_IMAGE;
+    mf->size = sizeof(EMBEDDED_IMAGE) - 1;   // not the literal's terminating zero
+    mf->borrowed = true;
+    return adoptDictionaryImage(mf, false, error);
+}
+#endif
+
+// ======================= WRITE-AHEAD LOG SECTION =======================
+// File format: dictionary.wal
+// 8 bytes: magic "DICTWAL1"
+// records: WalRecordHeader, then payload (u32 word length, word, meaning)
+// op WAL_INSERT inserts or overwrites; WAL_DELETE removes, with no meaning.
+// Conditional updates are decided before logging, so they log as inserts.
+//
+// Every insert is appended to the log before it returns, so it survives a
+// crash without rewriting a snapshot. Writers only queue their record while
+// holding writerMutex; the first one to wait for the disk writes everything
+// queued so far in one go (group commit) while later writers queue behind
+// it. Startup maps the last image and replays the records after its walSeq.
+// A background thread fsyncs batched records and, once the log has grown
+// past compactBytes, writes a fresh image and drops the records it covers.
+//
+// A change is applied before its record reaches the disk, so when writing
+// the log fails that change stays visible but is not durable. The log is
+// then marked failed and every later change is refused, until a checkpoint
+// writes an image that holds everything applied (the background thread
+// tries one every second).
+
+const string WAL_FILE = "dictionary.wal";
+const char WAL_MAGIC[8] = {'D', 'I', 'C', 'T', 'W', 'A', 'L', '1'};
+
+enum WalOp : uint8_t {
+    WAL_INSERT = 1,
+    WAL_DELETE = 2,
+};
+
+struct WalRecordHeader {
+    uint64_t checksum;          // over the rest of the header and the payload
+    uint64_t seq;
+    uint32_t length;            // payload bytes
+    uint8_t op;
+    uint8_t reserved[3];
+};
+
+struct WalOptions {
+    // 1: an insert returns once its record is fsynced; n > 1: fsync once n
+    // records are written (and at least every syncIntervalMs);
+    // 0: never fsync, the OS writes the file back when it likes
+    size_t syncEvery = 1;
+    unsigned syncIntervalMs = 100;
+    size_t compactBytes = 16 << 20;
+    string imagePath = IMAGE_FILE;
+};
+
+struct WriteAheadLog {
+    mutex m;
+    condition_variable cv;
+    string path;
+    FILE* file = nullptr;
+    string pending;             // queued records, not written yet
+    size_t pendingRecords = 0;
+    uint64_t lastSeq = 0;       // last sequence number handed out
+    uint64_t writtenSeq = 0;    // records up to here are in the file
+    uint64_t syncedSeq = 0;     // ... and on disk
+    size_t unsyncedRecords = 0;
+    size_t fileBytes = 0;
+    size_t retryCheckpointAt = 0;   // log size to try again at after a failed checkpoint
+    chrono::steady_clock::time_point retryFailedAt; // next checkpoint attempt while failed
+    bool flushing = false;
+    bool failed = false;
+    bool stopping = false;
+    thread background;
+};
+
+WalOptions walOptions;
+WriteAheadLog wal;
+// held from writing an image until the log is trimmed to it, so the menu and
+// the background thread never interleave two checkpoints
+mutex checkpointMutex;
+
+void encodeWalRecord(string &out, uint64_t seq, WalOp op, string_view word, string_view meaning) {
+    WalRecordHeader h = {};
+    h.seq = seq;
+    h.op = op;
+    h.length = (uint32_t)(4 + word.size() + meaning.size());
+    uint32_t wordLen = (uint32_t)word.size();
+    size_t start = out.size();
+    out.append((const char*)&h, sizeof(h));
+    out.append((const char*)&wordLen, 4);
+    out += word;
+    out += meaning;
+    h.checksum = checksum64(out.data() + start + 8, out.size() - start - 8);
+    memcpy(&out[start], &h.checksum, 8);
+}
+
+struct WalRecord {
+    uint64_t seq;
+    WalOp op;
+    string word, meaning;
+};
+
+// parses records from a log image; returns the length of the valid prefix,
+// so a torn or corrupted tail can be cut off
+size_t decodeWalRecords(const string &data, vector<WalRecord> &out) {
+    if (data.size() < 8 || memcmp(data.data(), WAL_MAGIC, 8) != 0) return 0;
+    size_t pos = 8;
+    while (data.size() - pos >= sizeof(WalRecordHeader)) {
+        WalRecordHeader h;
+        memcpy(&h, data.data() + pos, sizeof(h));
+        if (h.length < 4 || h.length > data.size() - pos - sizeof(h)) break;
+        if (checksum64(data.data() + pos + 8, sizeof(h) - 8 + h.length) != h.checksum) break;
+        const char* payload = data.data() + pos + sizeof(h);
+        uint32_t wordLen;
+        memcpy(&wordLen, payload, 4);
+        if (wordLen > h.length - 4 || (h.op != WAL_INSERT && h.op != WAL_DELETE)) break;
+        out.push_back({h.seq, (WalOp)h.op, string(payload + 4, wordLen),
+                       string(payload + 4 + wordLen, h.length - 4 - wordLen)});
+        pos += sizeof(h) + h.length;
+    }
+    return pos;
 }
 
-// build Trie from initial big text
-void loadInitialDataIntoTrie() {
-    string text = getInitialDictionaryText();
-    stringstream ss(text);
-    string line;
-    while (getline(ss, line)) {
-        if (line.empty()) continue;
-        string word, meaning;
-        if (parseLine(line, word, meaning)) {
-            insertIntoTrie(word, meaning);
+// caller holds wal.m and nobody is flushing; writes the queue, and fsyncs
+// when forced or the batching policy says so. Drops wal.m during the I/O.
+void walFlushLocked(unique_lock<mutex> &lk, bool forceSync) {
+    string batch;
+    batch.swap(wal.pending);
+    size_t records = wal.pendingRecords;
+    uint64_t upTo = wal.lastSeq;
+    wal.pendingRecords = 0;
+    bool sync = forceSync || walOptions.syncEvery == 1 ||
+                (walOptions.syncEvery > 1 && wal.unsyncedRecords + records >= walOptions.syncEvery);
+    wal.flushing = true;
+    lk.unlock();
+    bool ok = fwrite(batch.data(), 1, batch.size(), wal.file) == batch.size();
+    ok = ok && (sync ? syncFile(wal.file) : fflush(wal.file) == 0);
+    lk.lock();
+    wal.flushing = false;
+    wal.failed = wal.failed || !ok;
+    wal.writtenSeq = upTo;
+    wal.fileBytes += batch.size();
+    if (sync) {
+        wal.syncedSeq = upTo;
+        wal.unsyncedRecords = 0;
+    } else {
+        wal.unsyncedRecords += records;
+    }
+    wal.cv.notify_all();
+}
+
+// caller holds writerMutex, so records queue in the order they are applied;
+// returns 0 when no log is open
+uint64_t walAppendLocked(WalOp op, string_view word, string_view meaning) {
+    lock_guard<mutex> lk(wal.m);
+    if (!wal.file) return 0;
+    uint64_t seq = ++wal.lastSeq;
+    encodeWalRecord(wal.pending, seq, op, word, meaning);
+    wal.pendingRecords++;
+    return seq;
+}
+
+// waits until record seq is written (and fsynced if syncEvery is 1),
+// writing the queue itself if no one else is; false if the log failed
+bool walCommit(uint64_t seq) {
+    unique_lock<mutex> lk(wal.m);
+    bool waitSync = walOptions.syncEvery == 1;
+    while (wal.file && !wal.failed) {
+        if (wal.writtenSeq >= seq && (!waitSync || wal.syncedSeq >= seq)) return true;
+        if (!wal.flushing) walFlushLocked(lk, false);
+        else wal.cv.wait(lk);
+    }
+    return !wal.failed;
+}
+
+// caller holds writerMutex; false once the log has failed, so nothing more
+// is applied that could not be logged
+bool walAcceptsWritesLocked() {
+    lock_guard<mutex> lk(wal.m);
+    return !wal.file || !wal.failed;
+}
+
+// true while changes are refused because the log could not be written
+bool writeAheadLogFailed() {
+    lock_guard<mutex> lk(wal.m);
+    return wal.file && wal.failed;
+}
+
+// rewrites the log without the records up to upTo; caller holds wal.m
+// with nothing queued or being written
+bool walTrimLocked(uint64_t upTo) {
+    fclose(wal.file);
+    wal.file = nullptr;
+    ifstream fin(wal.path, ios::binary);
+    string data((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+    fin.close();
+    vector<WalRecord> records;
+    size_t valid = decodeWalRecords(data, records);
+    size_t cut = 8;
+    for (auto &r : records) {
+        if (r.seq > upTo) break;
+        cut += sizeof(WalRecordHeader) + 4 + r.word.size() + r.meaning.size();
+    }
+
+    string tmp = wal.path + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    bool ok = out != nullptr;
+    if (ok) {
+        ok = fwrite(WAL_MAGIC, 1, 8, out) == 8;
+        ok = ok && fwrite(data.data() + cut, 1, valid - cut, out) == valid - cut;
+        ok = syncFile(out) && ok;
+        ok = fclose(out) == 0 && ok;
+    }
+    ok = ok && replaceFile(tmp, wal.path);
+    wal.file = fopen(wal.path.c_str(), "ab");
+    if (!wal.file) {
+        wal.failed = true;
+        return false;
+    }
+    if (ok) {
+        wal.fileBytes = 8 + valid - cut;
+        wal.syncedSeq = wal.writtenSeq;
+        wal.unsyncedRecords = 0;
+    }
+    return ok;
+}
+
+// writes a snapshot image, then drops the log records it contains
+bool checkpointDictionary() {
+    lock_guard<mutex> lock(checkpointMutex);
+    uint64_t seq;
+    if (!writeDictionaryImage(walOptions.imagePath, &seq)) return false;
+    unique_lock<mutex> lk(wal.m);
+    if (!wal.file) return true;
+    wal.cv.wait(lk, [] { return !wal.flushing; });
+    if (!wal.pending.empty()) walFlushLocked(lk, true);
+    wal.cv.wait(lk, [] { return !wal.flushing; });
+    if (!walTrimLocked(seq)) return false;
+    // the image holds every change, even those the log lost, unless one was
+    // applied after the image was taken
+    if (wal.failed && wal.lastSeq <= seq) {
+        wal.failed = false;
+        wal.writtenSeq = wal.syncedSeq = wal.lastSeq;
+    }
+    return true;
+}
+
+// applies the log records newer than the published state
+size_t replayWriteAheadLog() {
+    string data;
+    {
+        unique_lock<mutex> lk(wal.m);
+        if (wal.path.empty()) return 0;
+        if (wal.file) {
+            wal.cv.wait(lk, [] { return !wal.flushing; });
+            if (!wal.pending.empty()) walFlushLocked(lk, false);
+            wal.cv.wait(lk, [] { return !wal.flushing; });
         }
+        ifstream fin(wal.path, ios::binary);
+        data.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+    }
+    vector<WalRecord> records;
+    decodeWalRecords(data, records);
+    size_t applied = 0;
+    uint64_t lastInFile = 0;
+    lock_guard<mutex> lock(writerMutex);
+    for (auto &r : records) {
+        lastInFile = max(lastInFile, r.seq);
+        if (r.seq <= dictState.load()->walSeq) continue;
+        if (r.op == WAL_DELETE) eraseLocked(r.word, r.seq);
+        else insertLocked(r.word, r.meaning, r.seq);
+        applied++;
     }
+    // a record can change nothing (a delete of a missing word), so the
+    // state's position may stop short of the file's; new records go after both
+    lock_guard<mutex> lk(wal.m);
+    wal.lastSeq = max({wal.lastSeq, dictState.load()->walSeq, lastInFile});
+    if (!wal.file) wal.writtenSeq = wal.syncedSeq = wal.lastSeq;
+    return applied;
 }
 
-// ======================= FILE HANDLING + HUFFMAN INTEGRATION =======================
-// File format: dictionary.huff
-// Line 1: number_of_distinct_characters (N)
-// Next N lines: token frequency
-//    token is: single char OR "\n" for newline OR "\s" for space
-// Next token: the word "DATA"
-// Next token: encoded bitstring (0/1)
+// true if replaying the log at logPath brings a state holding the records
+// up to walSeq up to date. False once a checkpoint has trimmed newer records
+// away: they are then only in the image, so a state that old must not be
+// started from.
+bool logContinuesFrom(uint64_t walSeq, const string &logPath = WAL_FILE) {
+    string data;
+    readWholeFile(logPath, data);
+    vector<WalRecord> records;
+    decodeWalRecords(data, records);
+    if (!records.empty()) return records[0].seq <= walSeq + 1;
+    ImageHeader h;
+    ifstream image(walOptions.imagePath, ios::binary);
+    bool haveImage = image.read((char*)&h, sizeof(h)) && memcmp(h.magic, IMAGE_MAGIC, 8) == 0;
+    return !haveImage || h.walSeq <= walSeq;
+}
 
-const string HUFF_FILE = "dictionary.huff";
+void walBackground() {
+    unique_lock<mutex> lk(wal.m);
+    while (!wal.stopping) {
+        wal.cv.wait_for(lk, chrono::milliseconds(walOptions.syncIntervalMs));
+        if (wal.stopping || !wal.file || wal.flushing) continue;
+        bool behind = !wal.pending.empty() || wal.writtenSeq > wal.syncedSeq;
+        if (behind && walOptions.syncEvery != 0) walFlushLocked(lk, true);
+        bool recover = wal.failed && chrono::steady_clock::now() >= wal.retryFailedAt;
+        if (recover || wal.fileBytes > max(walOptions.compactBytes, wal.retryCheckpointAt)) {
+            lk.unlock();
+            bool ok = checkpointDictionary();
+            lk.lock();
+            // rather than rewriting the whole image every interval, wait
+            // until the log has grown by as much again, or a second has
+            // passed while changes are refused
+            wal.retryCheckpointAt = ok ? 0 : wal.fileBytes + walOptions.compactBytes;
+            wal.retryFailedAt = chrono::steady_clock::now() + chrono::seconds(1);
+        }
+    }
+}
 
-void saveCompressedDictionaryToFile() {
-    // 1) Get all words from Trie and convert to text
-    vector<pair<string,string>> entries;
-    string current;
-    collectTrieWords(trieRoot, current, entries);
+// replays the log on top of the current dictionary and opens it for
+// appending; returns the number of records replayed, or -1 on error
+long openWriteAheadLog(const string &path = WAL_FILE) {
+    {
+        lock_guard<mutex> lk(wal.m);
+        wal.path = path;
+    }
+    size_t replayed = replayWriteAheadLog();
 
-    string text;
-    for (auto &p : entries) {
-        text += p.first + " - " + p.second + "\n";
+    // keep only the valid prefix, so new records are not hidden behind a torn one
+    ifstream fin(path, ios::binary);
+    string data((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+    fin.close();
+    vector<WalRecord> records;
+    size_t valid = decodeWalRecords(data, records);
+    if (valid != data.size() || valid < 8) {
+        ofstream fout(path, ios::binary | ios::trunc);
+        if (valid < 8) fout.write(WAL_MAGIC, 8);
+        else fout.write(data.data(), valid);
+        fout.close();
+        if (!fout) return -1;
+        valid = max<size_t>(valid, 8);
     }
 
-    if (text.empty()) {
-        cout << "Nothing to save.\n";
-        return;
+    lock_guard<mutex> lk(wal.m);
+    wal.file = fopen(path.c_str(), "ab");
+    if (!wal.file) return -1;
+    wal.fileBytes = valid;
+    wal.failed = false;
+    wal.stopping = false;
+    wal.background = thread(walBackground);
+    return (long)replayed;
+}
+
+// writes and fsyncs whatever is queued, then closes the log
+void closeWriteAheadLog() {
+    {
+        unique_lock<mutex> lk(wal.m);
+        if (!wal.file) return;
+        wal.stopping = true;
+        wal.cv.notify_all();
     }
+    wal.background.join();
+    unique_lock<mutex> lk(wal.m);
+    wal.cv.wait(lk, [] { return !wal.flushing; });
+    walFlushLocked(lk, true);
+    fclose(wal.file);
+    wal.file = nullptr;
+}
 
-    // 2) Huffman encode
-    unordered_map<char,string> codes;
-    unordered_map<char,int> freq;
-    HuffmanNode* root = nullptr;
-    string encoded = huffmanEncode(text, codes, root, freq);
+// inserts or overwrites a word; with a log open it returns once the insert
+// is logged. False if the word has no letters, its partition could not be
+// decoded or the log could not be written (see writeAheadLogFailed; a failed
+// commit leaves the insert applied but not durable)
+bool insertIntoTrie(string_view wordRaw, string_view meaning) {
+    MetricTimer timer(MH_INSERT);
+    KeyBuffer key(wordRaw);
+    string_view word = key.view();
+    if (word.empty()) return false;
+    countMetric(MC_INSERTS);
+    uint64_t seq;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if (!partitionWritableLocked(partOf(word)) || !walAcceptsWritesLocked()) return false;
+        seq = walAppendLocked(WAL_INSERT, word, meaning);
+        insertLocked(word, meaning, seq);
+    }
+    return seq == 0 || walCommit(seq);
+}
 
-    // 3) Write freq table + encoded string to file
-    ofstream fout(HUFF_FILE);
-    if (!fout) {
-        cout << "Error opening file for write.\n";
-        freeHuffmanTree(root);
-        return;
+// removes a word; with a log open it returns once the delete is logged.
+// False if the word is not in the dictionary or the log could not be written
+bool deleteFromTrie(string_view wordRaw) {
+    MetricTimer timer(MH_DELETE);
+    KeyBuffer key(wordRaw);
+    string_view word = key.view();
+    if (word.empty()) return false;
+    uint64_t seq;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if (!partitionWritableLocked(partOf(word)) || !walAcceptsWritesLocked()) return false;
+        if (!findLocked(word, nullptr)) return false;
+        countMetric(MC_DELETES);
+        seq = walAppendLocked(WAL_DELETE, word, string_view());
+        eraseLocked(word, seq);
     }
+    return seq == 0 || walCommit(seq);
+}
 
-    fout << freq.size() << "\n";
-    for (auto &p : freq) {
-        char c = p.first;
-        string token;
-        if (c == '\n') token = "\\n";
-        else if (c == ' ') token = "\\s";
-        else token = string(1, c);
-        fout << token << " " << p.second << "\n";
+// overwrites the meaning of a word that is already in the dictionary; with
+// expected, only while its meaning is still exactly *expected. False if
+// nothing was changed or the log could not be written
+bool updateInTrie(string_view wordRaw, string_view meaning, const string_view* expected = nullptr) {
+    MetricTimer timer(MH_INSERT);
+    KeyBuffer key(wordRaw);
+    string_view word = key.view();
+    if (word.empty()) return false;
+    uint64_t seq;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if (!partitionWritableLocked(partOf(word)) || !walAcceptsWritesLocked()) return false;
+        string current;
+        if (!findLocked(word, &current) || (expected && current != *expected)) return false;
+        countMetric(MC_UPDATES);
+        seq = walAppendLocked(WAL_INSERT, word, meaning);
+        insertLocked(word, meaning, seq);
     }
-    fout << "DATA\n";
-    fout << encoded << "\n";
+    return seq == 0 || walCommit(seq);
+}
 
-    fout.close();
-    freeHuffmanTree(root);
-    cout << "Dictionary compressed and saved to " << HUFF_FILE << "\n";
+// gives a word one more sense (several, separated by SENSE_SEPARATOR),
+// adding the word if it is new; insertIntoTrie instead replaces every sense.
+// False if the word already had all of them or the log could not be written
+bool addSense(string_view wordRaw, string_view sense) {
+    MetricTimer timer(MH_INSERT);
+    KeyBuffer key(wordRaw);
+    string_view word = key.view();
+    if (word.empty()) return false;
+    uint64_t seq;
+    {
+        lock_guard<mutex> lock(writerMutex);
+        if (!partitionWritableLocked(partOf(word)) || !walAcceptsWritesLocked()) return false;
+        string meaning;
+        bool found = findLocked(word, &meaning);
+        if (!mergeSenses(meaning, sense) && found) return false;
+        countMetric(found ? MC_UPDATES : MC_INSERTS);
+        seq = walAppendLocked(WAL_INSERT, word, meaning);
+        insertLocked(word, meaning, seq);
+    }
+    return seq == 0 || walCommit(seq);
 }
 
-void loadCompressedDictionaryFromFile() {
-    ifstream fin(HUFF_FILE);
-    if (!fin) {
-        cout << "No compressed file found (" << HUFF_FILE << ").\n";
-        return;
+void saveDictionaryImage() {
+    if (checkpointDictionary()) {
+        cout << "Dictionary image saved to " << walOptions.imagePath << "\n";
+    } else {
+        cout << "Error writing " << walOptions.imagePath << ".\n";
     }
+}
 
-    int n;
-    if (!(fin >> n)) {
-        cout << "Corrupted file.\n";
-        return;
+void loadDictionaryImage() {
+    string error;
+    if (mapDictionaryImage(walOptions.imagePath, true, error)) {
+        size_t replayed = replayWriteAheadLog();
+        cout << "Dictionary image mapped from " << walOptions.imagePath << " (" << frozenWordCount()
+             << " words, " << replayed << " logged changes replayed)\n";
+    } else {
+        cout << "Could not load image: " << error << "\n";
     }
+}
+
+// ======================= STATISTICS SECTION =======================
+// What the metrics counted, plus sizes read off the current state, as a
+// short report for the menu or as Prometheus text (menu, or STATS on the
+// query server).
+
+struct DictGauges {
+    size_t frozenWords = 0;
+    size_t bufferedWords = 0;
+    size_t bufferedDeletes = 0;
+    size_t bufferedUpdates = 0;   // buffered words that are also frozen
+    size_t bufferNodes = 0;
+    size_t bufferBytes = 0;       // arena memory behind the buffer
+    size_t bufferWaste = 0;       // ... of which compaction would free
+    size_t frozenBytes = 0;       // decoded frozen partitions
+    size_t decodedParts = 0;
+    size_t pendingParts = 0;
+    size_t failedParts = 0;
+};
 
-    unordered_map<char,int> freq;
-    for (int i = 0; i < n; i++) {
-        string token;
-        int f;
-        fin >> token >> f;
-        char c;
-        if (token == "\\n") c = '\n';
-        else if (token == "\\s") c = ' ';
-        else c = token[0];
-        freq[c] = f;
+DictGauges readGauges() {
+    // the arena is only stable under the writer lock
+    lock_guard<mutex> lock(writerMutex);
+    const DictState* st = dictState.load();
+    DictGauges g;
+    g.frozenWords = st->frozenWords;
+    g.bufferedWords = st->bufferedWords;
+    g.bufferedDeletes = st->tombstones;
+    g.bufferedUpdates = st->shadowed;
+    g.bufferNodes = countTrieNodes(st->buffer);
+    g.bufferBytes = st->arena ? st->arena->reserved : 0;
+    g.bufferWaste = st->arena ? st->arena->waste() : 0;
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        if (st->parts[p]) {
+            g.frozenBytes += st->parts[p]->bytesUsed();
+            g.decodedParts++;
+        }
     }
+    g.pendingParts = st->pending.count() - st->failed.count();
+    g.failedParts = st->failed.count();
+    return g;
+}
+
+// a tombstone is counted as buffered, and its word as frozen; so is a
+// buffered word that replaces a frozen one
+size_t totalWords(const DictGauges &g) {
+    return g.frozenWords + g.bufferedWords - 2 * g.bufferedDeletes - g.bufferedUpdates;
+}
+
+string formatNs(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) snprintf(buf, sizeof(buf), "%llu ns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(buf, sizeof(buf), "%.1f us", ns / 1e3);
+    else if (ns < 1000000000) snprintf(buf, sizeof(buf), "%.1f ms", ns / 1e6);
+    else snprintf(buf, sizeof(buf), "%.2f s", ns / 1e9);
+    return buf;
+}
 
-    string marker;
-    fin >> marker;
-    if (marker != "DATA") {
-        cout << "Invalid file format.\n";
+void printStatistics(ostream &out) {
+    MetricsSnapshot m = readMetrics();
+    DictGauges g = readGauges();
+    auto ratio = [](uint64_t part, uint64_t whole) { return whole ? 100.0 * part / whole : 0.0; };
+    out << fixed << setprecision(1);
+    out << "Words: " << totalWords(g) << " ("
+        << g.bufferedWords - g.bufferedDeletes << " buffered";
+    if (g.bufferedDeletes) out << ", " << g.bufferedDeletes << " deletes not frozen yet";
+    out << ")\n";
+    out << "Frozen tries: " << g.frozenBytes / 1024 << " KB in " << g.decodedParts << " partitions";
+    if (g.pendingParts) out << ", " << g.pendingParts << " not decoded yet";
+    if (g.failedParts) out << ", " << g.failedParts << " could not be decoded";
+    out << "\n";
+    out << "Write buffer: " << g.bufferNodes << " nodes, " << g.bufferBytes / 1024 << " KB";
+    if (g.bufferNodes) out << " (" << (double)g.bufferBytes / g.bufferNodes << " bytes per node)";
+    if (g.bufferWaste) out << ", " << g.bufferWaste / 1024 << " KB reclaimable";
+    out << "\n";
+    LookupCacheStats cache = readLookupCacheStats();
+    if (cache.capacity) {
+        out << "Lookup cache: " << cache.entries << " of " << cache.capacity << " entries";
+        if (METRICS_ENABLED) out << ", " << ratio(cache.hits, cache.hits + cache.misses) << "% hit rate";
+        out << "\n";
+    }
+    if (!METRICS_ENABLED) {
+        out << "Counters and timings are compiled out (MYDIC_NO_METRICS).\n";
+        out.unsetf(ios::floatfield);
         return;
     }
+    out << "Lookups: " << m.counters[MC_LOOKUPS] << ", "
+        << ratio(m.counters[MC_LOOKUP_HITS], m.counters[MC_LOOKUPS]) << "% found; batched: "
+        << m.counters[MC_BATCH_WORDS] << ", "
+        << ratio(m.counters[MC_BATCH_HITS], m.counters[MC_BATCH_WORDS]) << "% found; reverse: "
+        << m.counters[MC_REVERSE_LOOKUPS] << "\n";
+    out << "Inserts: " << m.counters[MC_INSERTS] << ", updates: " << m.counters[MC_UPDATES]
+        << ", deletes: " << m.counters[MC_DELETES] << ", freezes: " << m.counters[MC_FREEZES]
+        << ", buffer compactions: " << m.counters[MC_COMPACTIONS] << "\n";
+    out << "Huffman: " << m.counters[MC_HUFF_ENCODED_BYTES] / 1024 << " KB encoded, "
+        << m.counters[MC_HUFF_DECODED_BYTES] / 1024 << " KB decoded\n";
+    out << "Partitions decoded on use: " << m.counters[MC_PARTITION_DECODES]
+        << ", evicted: " << m.counters[MC_PARTITION_EVICTIONS] << "\n";
+    const pair<MetricHistogram, const char*> timings[] = {
+        {MH_LOOKUP, "lookup (1 in 16 timed)"}, {MH_INSERT, "insert"}, {MH_FREEZE, "freeze"},
+        {MH_HUFF_ENCODE, "huffman encode"}, {MH_HUFF_DECODE, "huffman decode"},
+        {MH_PARTITION_DECODE, "partition decode"}, {MH_SNAPSHOT_SAVE, "snapshot save"},
+        {MH_SNAPSHOT_LOAD, "snapshot load"}, {MH_IMAGE_SAVE, "image save"}, {MH_IMAGE_LOAD, "image load"},
+        {MH_DELETE, "delete"}, {MH_COMPACT, "buffer compaction"}, {MH_REVERSE_LOOKUP, "reverse lookup"},
+    };
+    for (auto &t : timings) {
+        uint64_t n = m.count(t.first);
+        if (!n) continue;
+        out << "  " << t.second << ": " << n << " timed, mean " << formatNs(m.sumNs[t.first] / n)
+            << ", p50 <= " << formatNs(m.quantileNs(t.first, 0.5))
+            << ", p99 <= " << formatNs(m.quantileNs(t.first, 0.99)) << "\n";
+    }
+    out.unsetf(ios::floatfield);
+}
 
-    string encoded;
-    fin >> encoded;
-    fin.close();
+// Prometheus text exposition format, one metric per line
+string formatPrometheusMetrics() {
+    DictGauges g = readGauges();
+    string out;
+    char line[160];
+    auto gauge = [&](const char* name, size_t value) {
+        snprintf(line, sizeof(line), "# TYPE dict_%s gauge\ndict_%s %zu\n", name, name, value);
+        out += line;
+    };
+    gauge("frozen_words", g.frozenWords);
+    gauge("buffered_words", g.bufferedWords);
+    gauge("buffered_deletes", g.bufferedDeletes);
+    gauge("buffered_updates", g.bufferedUpdates);
+    gauge("buffer_nodes", g.bufferNodes);
+    gauge("buffer_bytes", g.bufferBytes);
+    gauge("buffer_waste_bytes", g.bufferWaste);
+    gauge("frozen_bytes", g.frozenBytes);
+    gauge("decoded_partitions", g.decodedParts);
+    gauge("pending_partitions", g.pendingParts);
+    gauge("failed_partitions", g.failedParts);
+    LookupCacheStats cache = readLookupCacheStats();
+    gauge("lookup_cache_entries", cache.entries);
+    gauge("lookup_cache_capacity", cache.capacity);
+    if (!METRICS_ENABLED) return out;
+
+    MetricsSnapshot m = readMetrics();
+    for (int c = 0; c < METRIC_COUNTERS; c++) {
+        snprintf(line, sizeof(line), "# TYPE dict_%s counter\ndict_%s %llu\n",
+                 COUNTER_NAMES[c], COUNTER_NAMES[c], (unsigned long long)m.counters[c]);
+        out += line;
+    }
+    out += "# dict_lookup_seconds times one lookup in " + to_string(METRIC_SAMPLE_RATE) + "\n";
+    for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+        const char* name = HISTOGRAM_NAMES[h];
+        snprintf(line, sizeof(line), "# TYPE dict_%s histogram\n", name);
+        out += line;
+        uint64_t seen = 0;
+        for (int i = 0; i + 1 < HIST_BUCKETS; i++) {
+            seen += m.buckets[h][i];
+            snprintf(line, sizeof(line), "dict_%s_bucket{le=\"%g\"} %llu\n",
+                     name, (double)(1ULL << i) * 1e-9, (unsigned long long)seen);
+            out += line;
+        }
+        seen += m.buckets[h][HIST_BUCKETS - 1];
+        snprintf(line, sizeof(line), "dict_%s_bucket{le=\"+Inf\"} %llu\ndict_%s_sum %.9f\ndict_%s_count %llu\n",
+                 name, (unsigned long long)seen, name, m.sumNs[h] * 1e-9, name, (unsigned long long)seen);
+        out += line;
+    }
+    return out;
+}
+
+// ======================= QUERY SERVER SECTION =======================
+// --serve ADDRESS answers line-based requests on a Unix socket (ADDRESS is a
+// path) or on localhost TCP (ADDRESS is a port number):
+//   GET <word>               -> "OK <meaning>" or "NF"; several senses are
+//                               separated by SENSE_SEPARATOR (0x1f)
+//   PREFIX <prefix>          -> "OK <n>", then n lines "<word>\t<weight>"
+//   REV <words>              -> the same, for words whose meaning has all of <words>
+//   INS <word> - <meaning>   -> "OK" or "ERR <reason>"
+//   ADD <word> - <meaning>   -> "OK", or "ERR <reason>" (e.g. it had that sense)
+//   UPD <word> - <meaning>   -> "OK", or "NF" if the word is not there
+//   DEL <word>               -> "OK" or "NF"
+//   STATS                    -> "OK <n>", then n lines of Prometheus text
+// A change that could not be logged gets "ERR log failed" (it may have been
+// applied, but not durably; see the write-ahead log section). Clients may
+// pipeline: send any number of requests before reading, replies come back in
+// request order.
+//
+// The accept thread hands every connection to one worker, and each worker
+// runs its own edge-triggered epoll loop, so a connection is only ever
+// touched by one thread. A run of pipelined GETs is resolved with one
+// searchInTrieBatch call. Replies are gathered with writev straight from the
+// looked-up meanings (meanings are Huffman coded, so they are decoded once,
+// but not copied again into a reply buffer); only what the socket does not
+// take right away is copied into the connection's output queue.
+//
+// Changes (INS, ADD, UPD, DEL) wait for writerMutex and the log's fsync, so
+// a worker hands them to a pool of writer threads (as many as workers, which
+// lets their log records share fsyncs) instead of running them itself. That
+// connection's later requests wait for the reply; the worker's other
+// connections carry on. A writer wakes the worker through an eventfd.
+
+const size_t SERVER_PREFIX_LIMIT = 10;
+const size_t SERVER_REVERSE_LIMIT = 100;
+const size_t SERVER_BATCH = 256;            // GETs per searchInTrieBatch call
+const size_t SERVER_READ_CHUNK = 64 << 10;
+const size_t SERVER_MAX_LINE = 1 << 20;
+const size_t SERVER_MAX_QUEUED = 4 << 20;   // stop reading while this much output waits
 
-    // rebuild Huffman tree
-    HuffmanNode* root = buildHuffmanTree(freq);
+atomic<bool> serverStop{false};
 
-    // decode back to full text
-    string decoded = huffmanDecode(encoded, root);
-    freeHuffmanTree(root);
+#ifdef __linux__
 
-    // clear old Trie and rebuild from decoded text
-    clearTrie(trieRoot);
-    trieRoot = new TrieNode();
-    stringstream ss(decoded);
+struct ServerConn {
+    int fd;
+    string in;
+    size_t inPos = 0;       // start of the unparsed input
+    string out;             // reply bytes the socket has not taken yet
+    bool eof = false;
+    bool broken = false;
+    bool writing = false;   // a change is with the writers; nothing after it is answered yet
+};
+
+struct ServerWorker;
+
+// a change handed from a worker to the writer threads and back
+struct ServerWrite {
+    ServerWorker* worker;
+    ServerConn* conn;
     string line;
-    while (getline(ss, line)) {
-        if (line.empty()) continue;
-        string word, meaning;
-        if (parseLine(line, word, meaning)) {
-            insertIntoTrie(word, meaning);
+    string reply;
+};
+
+struct ServerWriteQueue {
+    mutex m;
+    condition_variable cv;
+    deque<ServerWrite*> todo;
+    bool stopping = false;
+};
+
+// a piece of a reply: static text or a meaning (data), or a range of the
+// worker's scratch text (data == nullptr), which may still grow
+struct ReplySegment {
+    const char* data;
+    size_t off;
+    size_t len;
+};
+
+struct ServerWorker {
+    int epfd = -1;
+    int wakeFd = -1;                        // eventfd, signalled when writes are done
+    ServerWriteQueue* writes = nullptr;
+    mutex m;
+    vector<ServerConn*> incoming;           // handed over by the accept thread
+    vector<ServerWrite*> done;              // replied to by the writers
+    unordered_set<ServerConn*> conns;
+    vector<string> batch;                   // words of the pending GETs
+    size_t batchSize = 0;
+    vector<char> found;
+    vector<string> meanings;
+    bool meaningsQueued = false;            // segments point into meanings
+    string scratch;
+    vector<ReplySegment> segments;
+};
+
+void addSegment(ServerWorker &w, const char* data, size_t len) {
+    w.segments.push_back({data, 0, len});
+}
+
+void addScratch(ServerWorker &w, string_view text) {
+    if (!w.segments.empty() && !w.segments.back().data) {
+        w.segments.back().len += text.size();
+    } else {
+        w.segments.push_back({nullptr, w.scratch.size(), text.size()});
+    }
+    w.scratch.append(text);
+}
+
+// sends c.out; false once the socket is gone
+bool flushQueued(ServerConn &c) {
+    size_t sent = 0;
+    while (sent < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c.broken = true;
+            break;
+        }
+        sent += n;
+    }
+    c.out.erase(0, sent);
+    return !c.broken;
+}
+
+// writes the gathered segments; the part the socket does not take goes to
+// c.out and is sent once epoll reports the socket writable again
+void sendReplies(ServerWorker &w, ServerConn &c) {
+    size_t i = 0;
+    // anything already queued has to go out first
+    while (c.out.empty() && i < w.segments.size() && !c.broken) {
+        iovec iov[64];
+        int count = 0;
+        for (size_t j = i; j < w.segments.size() && count < 64; j++) {
+            ReplySegment &s = w.segments[j];
+            iov[count].iov_base = (void*)(s.data ? s.data : w.scratch.data() + s.off);
+            iov[count].iov_len = s.len;
+            count++;
+        }
+        ssize_t n = writev(c.fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c.broken = true;
+            break;
+        }
+        while (n > 0) {
+            ReplySegment &s = w.segments[i];
+            size_t used = min((size_t)n, s.len);
+            if (s.data) s.data += used;
+            else s.off += used;
+            s.len -= used;
+            n -= used;
+            if (s.len == 0) i++;
+        }
+    }
+    if (!c.broken) {
+        for (; i < w.segments.size(); i++) {
+            ReplySegment &s = w.segments[i];
+            c.out.append(s.data ? s.data : w.scratch.data() + s.off, s.len);
+        }
+    }
+    w.segments.clear();
+    w.scratch.clear();
+    w.meaningsQueued = false;
+}
+
+void resolveGets(ServerWorker &w, ServerConn &c) {
+    if (w.batchSize == 0) return;
+    // the previous batch's meanings are about to be overwritten
+    if (w.meaningsQueued) sendReplies(w, c);
+    searchInTrieBatch(w.batch.data(), w.batchSize, w.found, &w.meanings);
+    for (size_t i = 0; i < w.batchSize; i++) {
+        if (w.found[i]) {
+            addSegment(w, "OK ", 3);
+            addSegment(w, w.meanings[i].data(), w.meanings[i].size());
+            addSegment(w, "\n", 1);
+        } else {
+            addSegment(w, "NF\n", 3);
+        }
+    }
+    w.meaningsQueued = true;
+    w.batchSize = 0;
+}
+
+// the reply to a change that returned false: its usual one, unless the log failed
+const char* writeFailure(const char* usual) {
+    return writeAheadLogFailed() ? "ERR log failed\n" : usual;
+}
+
+bool isServerWrite(string_view line) {
+    string_view verb = line.substr(0, 4);
+    return verb == "INS " || verb == "ADD " || verb == "UPD " || verb == "DEL ";
+}
+
+// runs on a writer thread
+string applyServerWrite(string_view line) {
+    string_view word, meaning;
+    if (line.substr(0, 4) == "DEL ") return deleteFromTrie(line.substr(4)) ? "OK\n" : writeFailure("NF\n");
+    if (!parseLine(line.substr(4), word, meaning)) return "ERR expected <word> - <meaning>\n";
+    if (line.substr(0, 4) == "UPD ") return updateInTrie(word, meaning) ? "OK\n" : writeFailure("NF\n");
+    if (line.substr(0, 4) == "ADD ") return addSense(word, meaning) ? "OK\n" : writeFailure("ERR not added\n");
+    return insertIntoTrie(word, meaning) ? "OK\n" : writeFailure("ERR not inserted\n");
+}
+
+void serverWriterLoop(ServerWriteQueue &q) {
+    unique_lock<mutex> lock(q.m);
+    while (true) {
+        q.cv.wait(lock, [&] { return q.stopping || !q.todo.empty(); });
+        if (q.todo.empty()) return;
+        ServerWrite* job = q.todo.front();
+        q.todo.pop_front();
+        lock.unlock();
+        job->reply = applyServerWrite(job->line);
+        {
+            lock_guard<mutex> done(job->worker->m);
+            job->worker->done.push_back(job);
+        }
+        uint64_t one = 1;
+        ssize_t ignored = write(job->worker->wakeFd, &one, sizeof(one));
+        (void)ignored;
+        lock.lock();
+    }
+}
+
+void serveRequest(ServerWorker &w, ServerConn &c, string_view line) {
+    if (line.substr(0, 4) == "GET ") {
+        if (w.batchSize == w.batch.size()) w.batch.emplace_back();
+        w.batch[w.batchSize++].assign(line.substr(4));
+        if (w.batchSize == SERVER_BATCH) resolveGets(w, c);
+        return;
+    }
+    resolveGets(w, c);
+    if (line.substr(0, 7) == "PREFIX ") {
+        vector<Completion> found = autocomplete(string(line.substr(7)), SERVER_PREFIX_LIMIT);
+        addScratch(w, "OK " + to_string(found.size()) + "\n");
+        for (auto &f : found) addScratch(w, f.word + "\t" + to_string(f.weight) + "\n");
+    } else if (line.substr(0, 4) == "REV ") {
+        vector<Completion> found = reverseLookup(string(line.substr(4)), SERVER_REVERSE_LIMIT);
+        addScratch(w, "OK " + to_string(found.size()) + "\n");
+        for (auto &f : found) addScratch(w, f.word + "\t" + to_string(f.weight) + "\n");
+    } else if (isServerWrite(line)) {
+        c.writing = true;
+        ServerWrite* job = new ServerWrite{&w, &c, string(line), string()};
+        lock_guard<mutex> lock(w.writes->m);
+        w.writes->todo.push_back(job);
+        w.writes->cv.notify_one();
+    } else if (line == "STATS") {
+        string text = formatPrometheusMetrics();
+        addScratch(w, "OK " + to_string(count(text.begin(), text.end(), '\n')) + "\n");
+        addScratch(w, text);
+    } else {
+        addScratch(w, "ERR unknown request\n");
+    }
+}
+
+// answers the complete lines read so far, up to the first change handed
+// to the writers
+void answerBuffered(ServerWorker &w, ServerConn &c) {
+    size_t nl;
+    while (!c.writing && (nl = c.in.find('\n', c.inPos)) != string::npos) {
+        string_view line(c.in.data() + c.inPos, nl - c.inPos);
+        c.inPos = nl + 1;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        serveRequest(w, c, line);
+    }
+    resolveGets(w, c);
+    c.in.erase(0, c.inPos);
+    c.inPos = 0;
+    if (!c.writing && c.in.size() > SERVER_MAX_LINE) {
+        addScratch(w, "ERR line too long\n");
+        c.eof = true;
+    }
+    sendReplies(w, c);
+}
+
+// reads and answers until the socket runs dry, the client stops reading,
+// a change is waiting for the writers or the connection ends
+void serviceConn(ServerWorker &w, ServerConn &c) {
+    if (!flushQueued(c)) return;
+    // lines left behind a change that has just been answered
+    answerBuffered(w, c);
+    while (!c.broken && !c.writing && !c.eof && c.out.size() < SERVER_MAX_QUEUED) {
+        size_t old = c.in.size();
+        c.in.resize(old + SERVER_READ_CHUNK);
+        ssize_t n = read(c.fd, &c.in[old], SERVER_READ_CHUNK);
+        c.in.resize(old + max<ssize_t>(n, 0));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) c.broken = true;
+            break;
+        }
+        if (n == 0) c.eof = true;
+        answerBuffered(w, c);
+    }
+}
+
+void closeConn(ServerWorker &w, ServerConn* c) {
+    close(c->fd);
+    w.conns.erase(c);
+    delete c;
+}
+
+// a connection with a change at the writers stays open until it is answered
+bool connFinished(const ServerConn* c) {
+    return !c->writing && (c->broken || (c->eof && c->out.empty()));
+}
+
+// queues the writers' replies and answers what their connections sent after
+// them; connections that are done go to finished
+void finishWrites(ServerWorker &w, vector<ServerConn*> &finished) {
+    uint64_t count;
+    ssize_t ignored = read(w.wakeFd, &count, sizeof(count));
+    (void)ignored;
+    vector<ServerWrite*> done;
+    {
+        lock_guard<mutex> lock(w.m);
+        done.swap(w.done);
+    }
+    for (ServerWrite* job : done) {
+        ServerConn* c = job->conn;
+        c->writing = false;
+        c->out += job->reply;
+        delete job;
+        if (!c->broken) serviceConn(w, *c);
+        if (connFinished(c)) finished.push_back(c);
+    }
+}
+
+void serverWorkerLoop(ServerWorker &w) {
+    epoll_event events[64];
+    // closed after the whole batch, since a later event may still name them
+    vector<ServerConn*> finished;
+    while (!serverStop.load()) {
+        int n = epoll_wait(w.epfd, events, 64, 100);
+        {
+            // after the wait, so every connection an event names is known here
+            lock_guard<mutex> lock(w.m);
+            for (ServerConn* c : w.incoming) w.conns.insert(c);
+            w.incoming.clear();
+        }
+        for (int i = 0; i < n; i++) {
+            ServerConn* c = (ServerConn*)events[i].data.ptr;
+            if (!c) {
+                finishWrites(w, finished);
+                continue;
+            }
+            if (connFinished(c)) continue;
+            if (events[i].events & EPOLLERR) c->broken = true;
+            else if (!c->broken) serviceConn(w, *c);
+            if (connFinished(c)) finished.push_back(c);
+        }
+        for (ServerConn* c : finished) closeConn(w, c);
+        finished.clear();
+    }
+    lock_guard<mutex> lock(w.m);
+    for (ServerConn* c : w.incoming) w.conns.insert(c);
+    w.incoming.clear();
+    while (!w.conns.empty()) closeConn(w, *w.conns.begin());
+}
+
+// a port number means localhost TCP, anything else a Unix socket path
+bool isPortNumber(const string &address) {
+    return !address.empty() && address.size() <= 5 &&
+           all_of(address.begin(), address.end(), [](unsigned char ch) { return isdigit(ch) != 0; });
+}
+
+int openListener(const string &address, string &error) {
+    bool tcp = isPortNumber(address);
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = strerror(errno);
+        return -1;
+    }
+    int rc;
+    if (tcp) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)stoul(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        rc = bind(fd, (sockaddr*)&addr, sizeof(addr));
+    } else {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) {
+            close(fd);
+            error = "socket path too long";
+            return -1;
+        }
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        unlink(address.c_str());
+        rc = bind(fd, (sockaddr*)&addr, sizeof(addr));
+    }
+    if (rc != 0 || listen(fd, 1024) != 0) {
+        error = strerror(errno);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// serves until serverStop is set (SIGINT / SIGTERM); false if it cannot listen
+bool runServer(const string &address, unsigned threads, string &error) {
+    int listener = openListener(address, error);
+    if (listener < 0) return false;
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    bool tcp = isPortNumber(address);
+    serverStop = false;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, [](int) { serverStop = true; });
+    signal(SIGTERM, [](int) { serverStop = true; });
+
+    ServerWriteQueue writes;
+    vector<unique_ptr<ServerWorker>> workers;
+    auto closeWorkers = [&] {
+        for (auto &w : workers) {
+            if (w->epfd >= 0) close(w->epfd);
+            if (w->wakeFd >= 0) close(w->wakeFd);
+        }
+    };
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(new ServerWorker());
+        ServerWorker &w = *workers.back();
+        w.writes = &writes;
+        w.epfd = epoll_create1(EPOLL_CLOEXEC);
+        w.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (w.epfd < 0 || w.wakeFd < 0 || epoll_ctl(w.epfd, EPOLL_CTL_ADD, w.wakeFd, &ev) != 0) {
+            error = strerror(errno);
+            closeWorkers();
+            close(listener);
+            if (!tcp) unlink(address.c_str());
+            return false;
+        }
+    }
+    vector<thread> pool, writers;
+    for (unsigned t = 0; t < threads; t++) pool.emplace_back(serverWorkerLoop, ref(*workers[t]));
+    for (unsigned t = 0; t < threads; t++) writers.emplace_back(serverWriterLoop, ref(writes));
+
+    size_t next = 0;
+    pollfd pfd = {listener, POLLIN, 0};
+    while (!serverStop.load()) {
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        if (tcp) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        ServerWorker &w = *workers[next++ % threads];
+        ServerConn* c = new ServerConn();
+        c->fd = fd;
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        // registered under w.m, so the worker knows c before it can handle an event for it
+        lock_guard<mutex> lock(w.m);
+        if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            delete c;
+            continue;
+        }
+        w.incoming.push_back(c);
+    }
+    for (thread &t : pool) t.join();
+    // changes still queued are applied; their connections are gone
+    {
+        lock_guard<mutex> lock(writes.m);
+        writes.stopping = true;
+        writes.cv.notify_all();
+    }
+    for (thread &t : writers) t.join();
+    for (auto &w : workers) {
+        for (ServerWrite* job : w->done) delete job;
+    }
+    closeWorkers();
+    close(listener);
+    if (!tcp) unlink(address.c_str());
+    return true;
+}
+
+#else
+
+bool runServer(const string &, unsigned, string &error) {
+    error = "server mode needs Linux (epoll)";
+    return false;
+}
+
+#endif
+
+// ======================= STREAMING SECTION =======================
+// --stream reads words separated by newlines or tabs from stdin and writes
+// one line per word to stdout: "<word>\t<meaning>", or "<word>\t" when the
+// word is unknown. Input is read in STREAM_CHUNK blocks cut after their
+// last separator, every block is resolved with searchInTrieBatch, and each
+// block's output is written with a single fwrite. With several threads the
+// blocks are resolved in parallel but written strictly in input order; at
+// most two blocks per thread are in flight, so memory stays bounded however
+// large the input is.
+
+const size_t STREAM_CHUNK = 4 << 20;
+const size_t STREAM_BATCH = 65536;    // big enough that sorted hits share decoded meaning blocks
+
+struct StreamScratch {
+    vector<string> words;
+    vector<char> found;
+    vector<string> meanings;
+};
+
+void annotateChunk(string_view chunk, StreamScratch &s, string &out) {
+    out.clear();
+    size_t n = 0;
+    auto flush = [&] {
+        searchInTrieBatch(s.words.data(), n, s.found, &s.meanings);
+        for (size_t i = 0; i < n; i++) {
+            out += s.words[i];
+            out += '\t';
+            if (s.found[i]) out += s.meanings[i];
+            out += '\n';
+        }
+        n = 0;
+    };
+    size_t pos = 0;
+    while (pos < chunk.size()) {
+        size_t end = pos;
+        while (end < chunk.size() && chunk[end] != '\n' && chunk[end] != '\t') end++;
+        string_view token = chunk.substr(pos, end - pos);
+        pos = end + 1;
+        if (!token.empty() && token.back() == '\r') token.remove_suffix(1);
+        if (token.empty()) continue;
+        if (n == s.words.size()) s.words.emplace_back();
+        s.words[n++].assign(token);
+        if (n == STREAM_BATCH) flush();
+    }
+    if (n) flush();
+}
+
+// the next block of input, starting with `carry` (the unfinished token of
+// the previous block) and ending at a separator; false at the end of input
+bool readChunk(FILE* in, string &carry, string &chunk) {
+    chunk.swap(carry);
+    carry.clear();
+    while (true) {
+        size_t old = chunk.size();
+        chunk.resize(old + STREAM_CHUNK);
+        size_t n = fread(&chunk[old], 1, STREAM_CHUNK, in);
+        chunk.resize(old + n);
+        if (n == 0) return !chunk.empty();  // the last token had no separator
+        for (size_t i = chunk.size(); i > old; i--) {
+            if (chunk[i - 1] == '\n' || chunk[i - 1] == '\t') {
+                carry.assign(chunk, i, string::npos);
+                chunk.resize(i);
+                return true;
+            }
+        }
+        // one token longer than a block: keep reading
+    }
+}
+
+struct StreamJob {
+    string in, out;
+    bool ready = false;
+};
+
+// false if the output could not be written
+bool streamLookups(FILE* in, FILE* out, unsigned threads = 0) {
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    string carry;
+    if (threads == 1) {
+        StreamScratch scratch;
+        string chunk, result;
+        while (readChunk(in, carry, chunk)) {
+            annotateChunk(chunk, scratch, result);
+            if (fwrite(result.data(), 1, result.size(), out) != result.size()) return false;
         }
+        return fflush(out) == 0;
     }
 
-    cout << "Dictionary loaded and decoded back into Trie from " << HUFF_FILE << "\n";
+    mutex m;
+    condition_variable cv;
+    vector<unique_ptr<StreamJob>> jobs;
+    vector<StreamJob*> idle;
+    deque<StreamJob*> todo, inOrder;
+    bool inputDone = false, failed = false;
+    for (unsigned i = 0; i < threads * 2; i++) {
+        jobs.emplace_back(new StreamJob());
+        idle.push_back(jobs.back().get());
+    }
+
+    vector<thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            StreamScratch scratch;
+            unique_lock<mutex> lk(m);
+            while (true) {
+                cv.wait(lk, [&] { return !todo.empty() || inputDone; });
+                if (todo.empty()) return;
+                StreamJob* job = todo.front();
+                todo.pop_front();
+                lk.unlock();
+                annotateChunk(job->in, scratch, job->out);
+                lk.lock();
+                job->ready = true;
+                cv.notify_all();
+            }
+        });
+    }
+    thread writer([&] {
+        unique_lock<mutex> lk(m);
+        while (true) {
+            cv.wait(lk, [&] { return (!inOrder.empty() && inOrder.front()->ready) || (inputDone && inOrder.empty()); });
+            if (inOrder.empty()) return;
+            StreamJob* job = inOrder.front();
+            inOrder.pop_front();
+            lk.unlock();
+            bool ok = fwrite(job->out.data(), 1, job->out.size(), out) == job->out.size();
+            lk.lock();
+            if (!ok) failed = true;
+            job->ready = false;
+            idle.push_back(job);
+            cv.notify_all();
+        }
+    });
+
+    while (true) {
+        StreamJob* job;
+        {
+            unique_lock<mutex> lk(m);
+            cv.wait(lk, [&] { return !idle.empty() || failed; });
+            if (failed) break;
+            job = idle.back();
+            idle.pop_back();
+        }
+        if (!readChunk(in, carry, job->in)) break;
+        lock_guard<mutex> lock(m);
+        todo.push_back(job);
+        inOrder.push_back(job);
+        cv.notify_all();
+    }
+    {
+        lock_guard<mutex> lock(m);
+        inputDone = true;
+        cv.notify_all();
+    }
+    for (thread &t : workers) t.join();
+    writer.join();
+    return !failed && fflush(out) == 0;
 }
 
 // ======================= SIMPLE MENU =======================
 
+// one line for a single sense, a numbered list for several
+void printMeaning(ostream &out, const char* label, string_view meaning) {
+    vector<string_view> senses = splitSenses(meaning);
+    if (senses.size() == 1) {
+        out << label << ": " << meaning << "\n";
+        return;
+    }
+    out << label << "s:\n";
+    for (size_t i = 0; i < senses.size(); i++) out << "  " << i + 1 << ". " << senses[i] << "\n";
+}
+
+// explains a change that returned false because the log failed; false if it did not
+bool reportLogFailure() {
+    if (!writeAheadLogFailed()) return false;
+    cout << "Could not write " << wal.path << ": a change made just now is kept only in\n"
+         << "memory, and further changes are refused until an image is saved (option 6).\n";
+    return true;
+}
+
 void menu() {
     while (true) {
         cout << "\n--- DICTIONARY + TRIE + HUFFMAN ---\n";
@@ -567,6 +6421,18 @@ void menu() {
         cout << "2. Insert new word\n";
         cout << "3. Save compressed dictionary to file\n";
         cout << "4. Load compressed dictionary from file\n";
+        // Exit keeps its original number, so scripted input still quits with 5
+        cout << "6. Save binary dictionary image\n";
+        cout << "7. Load binary dictionary image\n";
+        cout << "8. Autocomplete prefix\n";
+        cout << "9. Import word weights from file\n";
+        cout << "10. Load word list files\n";
+        cout << "11. Show statistics\n";
+        cout << "12. Print metrics (Prometheus text)\n";
+        cout << "13. Delete word\n";
+        cout << "14. Change meaning of a word\n";
+        cout << "15. Add a meaning to a word\n";
+        cout << "16. Find words by meaning\n";
         cout << "5. Exit\n";
         cout << "Enter choice: ";
         int ch;
@@ -577,11 +6443,19 @@ void menu() {
             cout << "Enter word: ";
             string w;
             getline(cin, w);
-            TrieNode* node = searchInTrie(w);
-            if (node) {
-                cout << "Meaning: " << node->meaning << "\n";
+            string meaning;
+            if (searchInTrie(w, meaning)) {
+                printMeaning(cout, "Meaning", meaning);
             } else {
                 cout << "Word not found.\n";
+                // short words allow fewer typos before every suggestion is noise
+                int maxDist = codePoints(normalizeWord(w)).size() <= 4 ? 1 : 2;
+                vector<FuzzyMatch> close = fuzzySearch(w, maxDist, 5);
+                if (!close.empty()) {
+                    cout << "Did you mean:";
+                    for (size_t i = 0; i < close.size(); i++) cout << (i ? ", " : " ") << close[i].word;
+                    cout << "?\n";
+                }
             }
         } else if (ch == 2) {
             cout << "Enter word: ";
@@ -590,12 +6464,99 @@ void menu() {
             cout << "Enter meaning: ";
             string m;
             getline(cin, m);
-            insertIntoTrie(w, m);
-            cout << "Inserted.\n";
+            if (insertIntoTrie(w, m)) cout << "Inserted.\n";
+            else if (!reportLogFailure()) cout << "Could not insert.\n";
         } else if (ch == 3) {
             saveCompressedDictionaryToFile();
         } else if (ch == 4) {
             loadCompressedDictionaryFromFile();
+        } else if (ch == 6) {
+            saveDictionaryImage();
+        } else if (ch == 7) {
+            loadDictionaryImage();
+        } else if (ch == 8) {
+            cout << "Enter prefix: ";
+            string prefix;
+            getline(cin, prefix);
+            vector<Completion> found = autocomplete(prefix, 10);
+            if (found.empty()) cout << "No completions.\n";
+            for (auto &c : found) cout << "  " << c.word << " (" << c.weight << ")\n";
+        } else if (ch == 9) {
+            cout << "Enter file (lines of \"word score\"): ";
+            string path;
+            getline(cin, path);
+            ifstream fin(path);
+            if (!fin) {
+                cout << "Cannot open " << path << ".\n";
+            } else {
+                cout << "Updated weights of " << importWordWeights(fin) << " words.\n";
+            }
+        } else if (ch == 10) {
+            cout << "Enter files separated by spaces (empty for a.txt ... z.txt): ";
+            string line;
+            getline(cin, line);
+            vector<string> paths;
+            stringstream ss(line);
+            for (string path; ss >> path;) paths.push_back(path);
+            if (paths.empty()) {
+                for (char c = 'a'; c <= 'z'; c++) paths.push_back(string(1, c) + ".txt");
+            }
+            vector<string> missing;
+            auto start = chrono::steady_clock::now();
+            if (!loadWordFiles(paths, missing)) {
+                cout << "No readable files.\n";
+            } else {
+                double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                for (auto &m : missing) cout << "Skipped " << m << ".\n";
+                cout << "Loaded " << frozenWordCount() << " words in " << sec << " s.\n";
+            }
+        } else if (ch == 11) {
+            printStatistics(cout);
+        } else if (ch == 12) {
+            cout << formatPrometheusMetrics();
+        } else if (ch == 13) {
+            cout << "Enter word: ";
+            string w;
+            getline(cin, w);
+            if (deleteFromTrie(w)) cout << "Deleted.\n";
+            else if (!reportLogFailure()) cout << "Word not found.\n";
+        } else if (ch == 14) {
+            cout << "Enter word: ";
+            string w;
+            getline(cin, w);
+            string current;
+            if (!searchInTrie(w, current)) {
+                cout << "Word not found.\n";
+                continue;
+            }
+            printMeaning(cout, "Current meaning", current);
+            cout << "Enter new meaning (replaces all of them): ";
+            string m;
+            getline(cin, m);
+            // unchanged unless nobody else changed the word in the meantime
+            string_view expected = current;
+            if (updateInTrie(w, m, &expected)) cout << "Updated.\n";
+            else if (!reportLogFailure()) cout << "The word changed meanwhile; not updated.\n";
+        } else if (ch == 15) {
+            cout << "Enter word: ";
+            string w;
+            getline(cin, w);
+            cout << "Enter the new meaning: ";
+            string m;
+            getline(cin, m);
+            if (addSense(w, m)) cout << "Added.\n";
+            else if (!reportLogFailure()) cout << "The word already has that meaning.\n";
+        } else if (ch == 16) {
+            cout << "Enter words the meaning should contain: ";
+            string q;
+            getline(cin, q);
+            size_t total;
+            auto start = chrono::steady_clock::now();
+            vector<Completion> found = reverseLookup(q, 20, &total);
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            if (found.empty()) cout << "No words found.\n";
+            else cout << total << (total == 1 ? " word (" : " words (") << ms << " ms)" << (total > found.size() ? ", first ones:" : ":") << "\n";
+            for (auto &c : found) cout << "  " << c.word << "\n";
         } else if (ch == 5) {
             cout << "Exiting.\n";
             break;
@@ -605,9 +6566,98 @@ void menu() {
     }
 }
 
-int main() {
-    loadInitialDataIntoTrie();   // load your full word list into Trie at start
-    menu();
-    clearTrie(trieRoot);
-    return 0;
+#ifndef MYDIC_NO_MAIN
+int main(int argc, char* argv[]) {
+    // --wal-sync N: fsync the log every N inserts (0 = leave it to the OS)
+    // --serve ADDRESS: answer requests on a socket instead of running the menu
+    // --stream: annotate words from stdin to stdout instead of running the menu
+    // --threads N: server or stream worker threads (default: one per core)
+    // --lazy: start from dictionary.huff, decoding partitions as they are read
+    // --lazy-budget MB: drop cold lazily decoded partitions beyond this size
+    // --cache N: cache the answers to up to N distinct queries
+    // --emit-embedded OUT [FILES...]: write the word files (or the built-in
+    //     list) as an image to link in with -DDICT_EMBEDDED, then exit
+    string serveAddress;
+    string embedPath;
+    vector<string> embedFiles;
+    bool stream = false;
+    bool lazy = false;
+    unsigned threads = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--stream") stream = true;
+        else if (arg == "--wal-sync" && hasValue) walOptions.syncEvery = stoul(argv[++i]);
+        else if (arg == "--serve" && hasValue) serveAddress = argv[++i];
+        else if (arg == "--threads" && hasValue) threads = stoul(argv[++i]);
+        else if (arg == "--lazy") lazy = true;
+        else if (arg == "--lazy-budget" && hasValue) lazyBudget = stoul(argv[++i]) << 20;
+        else if (arg == "--cache" && hasValue) configureLookupCache(stoul(argv[++i]));
+        else if (arg == "--emit-embedded" && hasValue) {
+            embedPath = argv[++i];
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) embedFiles.push_back(argv[++i]);
+        }
+    }
+    string error;
+    if (!embedPath.empty()) {
+        vector<string> missing;
+        if (embedFiles.empty()) loadInitialDataIntoTrie();
+        else if (!loadWordFiles(embedFiles, missing, threads) || !missing.empty()) {
+            cerr << "Cannot read " << missing[0] << "\n";
+            return 1;
+        }
+        if (!writeEmbeddedImage(embedPath, error)) {
+            cerr << error << "\n";
+            return 1;
+        }
+        cout << "Wrote " << frozenWordCount() << " words to " << embedPath << "\n";
+        clearDictionary();
+        return 0;
+    }
+    // stdout carries the results in stream mode, so status goes to stderr
+    ostream &status = stream ? cerr : cout;
+    // a saved image is ready as soon as it is mapped; otherwise use the
+    // linked-in image or parse the word list
+    bool opened = false;
+    if (lazy) {
+        opened = openCompressedDictionary(HUFF_FILE, error);
+        if (opened && !logContinuesFrom(dictState.load()->walSeq)) {
+            status << HUFF_FILE << " is older than " << walOptions.imagePath << "; starting from the image.\n";
+            opened = false;
+        } else if (opened) {
+            status << "Opened " << HUFF_FILE << " (" << frozenWordCount() << " words, decoded on use).\n";
+        } else {
+            status << error << "\n";
+        }
+    }
+    if (!opened && !mapDictionaryImage(walOptions.imagePath, false, error)) {
+#ifdef DICT_EMBEDDED
+        opened = loadEmbeddedDictionary(error);
+        if (!opened) status << "Embedded dictionary: " << error << "\n";
+#endif
+        if (!opened) loadInitialDataIntoTrie();   // load your full word list into Trie at start
+    }
+    // inserts logged since the image was written
+    long replayed = openWriteAheadLog();
+    if (replayed < 0) status << "Cannot open " << WAL_FILE << "; changes will not be logged.\n";
+    else if (replayed > 0) status << "Replayed " << replayed << " logged changes.\n";
+    int exitCode = 0;
+    if (stream) {
+        if (!streamLookups(stdin, stdout, threads)) {
+            cerr << "Error writing output.\n";
+            exitCode = 1;
+        }
+    } else if (!serveAddress.empty()) {
+        cout << "Serving " << frozenWordCount() << " words on " << serveAddress << endl;
+        if (!runServer(serveAddress, threads, error)) {
+            cout << "Cannot serve on " << serveAddress << ": " << error << "\n";
+            exitCode = 1;
+        }
+    } else {
+        menu();
+    }
+    closeWriteAheadLog();
+    clearDictionary();
+    return exitCode;
 }
+#endif
@@ -0,0 +1,1135 @@
+// Regression tests for myDic.cpp.
+// Build: g++ -O1 -std=c++17 -pthread tests.cpp -o tests   (add -DUSE_RADIX_TRIE for the radix write buffer)
+// Usage: tests   (prints each failed check; exit status 1 if any failed)
+#define MYDIC_NO_MAIN
+#include "myDic.cpp"
+
+// ======================= HELPERS =======================
+
+int failures = 0;
+
+// counts this thread's heap allocations while countAllocations is set
+thread_local bool countAllocations = false;
+thread_local size_t allocationCount = 0;
+
+void* operator new(size_t size) {
+    if (countAllocations) allocationCount++;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    if (countAllocations) allocationCount++;
+    return malloc(size ? size : 1);
+}
+
+// GCC pairs inlined new-expressions with these and warns about free()
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { free(p); }
+
+// heap allocations made by work(), run once before to warm up reused buffers
+template<class F>
+size_t allocationsOf(F work) {
+    work();
+    allocationCount = 0;
+    countAllocations = true;
+    work();
+    countAllocations = false;
+    return allocationCount;
+}
+
+void check(bool ok, const string &what) {
+    if (ok) return;
+    failures++;
+    cout << "FAILED: " << what << "\n";
+}
+
+void useDictionary(vector<TrieEntry> entries) {
+    replaceDictionary(buildDictState(move(entries)));
+}
+
+// distance of word in the suggestions for query, -1 if it is not among them
+int suggestedDistance(const string &query, int maxDist, const string &word) {
+    for (auto &m : fuzzySearch(query, maxDist, 10)) {
+        if (m.word == normalizeWord(word)) return m.distance;
+    }
+    return -1;
+}
+
+// the words reverseLookup finds for query, in order, separated by spaces
+string reverseWords(const string &query, size_t limit = 10) {
+    string out;
+    for (auto &c : reverseLookup(query, limit)) out += (out.empty() ? "" : " ") + c.word;
+    return out;
+}
+
+// n distinct words over every letter partition, meanings of varying length
+vector<TrieEntry> sampleEntries(size_t n) {
+    vector<TrieEntry> out;
+    for (size_t i = 0; i < n; i++) {
+        string word;
+        for (size_t v = i;; v /= 26) {
+            word.push_back((char)('a' + v % 26));
+            if (v < 26) break;
+        }
+        out.push_back({word, "meaning " + to_string(i) + string(i % 50, 'x'), (uint32_t)(i % 7)});
+    }
+    return out;
+}
+
+// every entry is found with its meaning
+bool holdsEntries(const vector<TrieEntry> &entries) {
+    string meaning;
+    for (auto &e : entries) {
+        if (!searchInTrie(e.key, meaning) || meaning != e.meaning) return false;
+    }
+    return true;
+}
+
+// a file in the working directory for one test; removed before it is handed out
+string scratchFile(const string &name) {
+    string path = "tests-" + name;
+    remove(path.c_str());
+    return path;
+}
+
+bool fileExists(const string &path) {
+    return ifstream(path).good();
+}
+
+void writeText(const string &path, const string &text) {
+    ofstream(path, ios::binary) << text;
+}
+
+// ======================= FROZEN TRIE =======================
+
+void testFrozenTrie() {
+    vector<TrieEntry> entries = sampleEntries(3000);
+    useDictionary(entries);
+    check(frozenWordCount() == entries.size(), "every word is frozen");
+    check(holdsEntries(entries), "every frozen word is found with its meaning");
+
+    useDictionary({{"a", "One.", 0}, {"ab", "Two.", 0}, {"abc", "Three.", 0}, {"abd", "Four.", 0}, {"Zebra", "An animal.", 0}});
+    string meaning;
+    check(searchInTrie("a", meaning) && meaning == "One.", "a one-letter word is found");
+    check(searchInTrie("ABC", meaning) && meaning == "Three.", "lookups fold case");
+    check(searchInTrie("zebra", meaning) && meaning == "An animal.", "keys are stored folded");
+    check(!searchInTrie("abcd", meaning), "a word extending a frozen word is not found");
+    check(!searchInTrie("ac", meaning) && !searchInTrie("zeb", meaning), "a prefix that is no word is not found");
+    check(!searchInTrie("", meaning) && !searchInTrie("--", meaning), "a key without letters is not found");
+    insertIntoTrie("abe", "Five.");
+    insertIntoTrie("ab", "Two again.");
+    freezeTrie();
+    check(searchInTrie("abe", meaning) && meaning == "Five.", "a frozen insert is found");
+    check(searchInTrie("ab", meaning) && meaning == "Two again.", "a frozen overwrite wins");
+    check(searchInTrie("abd", meaning) && meaning == "Four.", "the words around it are kept");
+    check(frozenWordCount() == 6, "freezing counts each word once");
+}
+
+// ======================= HUFFMAN CODEC =======================
+
+// n bytes, mostly a few letters and now and then any byte at all
+string skewedText(size_t n, uint32_t seed) {
+    mt19937 rng(seed);
+    string text(n, ' ');
+    for (char &c : text) c = rng() % 16 ? "etaoin "[rng() % 7] : (char)(rng() % 256);
+    return text;
+}
+
+void testHuffmanRoundTrip() {
+    string every;
+    for (int b = 0; b < 256; b++) every.push_back((char)b);
+    vector<string> texts = {"", "a", string(1000, 'z'), every, every + every + "tail", skewedText(100000, 1)};
+    bool same = true;
+    for (const string &text : texts) {
+        string decoded = "junk";
+        same = same && decodeHuffStream(encodeHuffStream(text), decoded) && decoded == text;
+    }
+    check(same, "every text decodes to itself");
+    string skewed = encodeHuffStream(texts.back());
+    check(skewed.size() < texts.back().size() * 2 / 3, "a skewed text packs to well under a byte per symbol");
+
+    string decoded;
+    check(!decodeHuffStream(string_view(skewed).substr(0, skewed.size() - 1), decoded), "a truncated stream is refused");
+    check(!decodeHuffStream(string_view(skewed).substr(0, 20), decoded), "a truncated header is refused");
+    check(!decodeHuffStream("HUF9 not a stream", decoded), "an unknown stream is refused");
+}
+
+// chunked streams come out the same whatever the thread count, and a bad
+// stream among several is named
+void testParallelHuffman() {
+    string big = skewedText(HUFF_CHUNK_SIZE * 7 / 2, 2);
+    string serial = encodeHuffStream(big, 1);
+    check(encodeHuffStream(big, 4) == serial, "parallel encoding gives the same stream");
+    check(serial.compare(0, 4, HUFF_CHUNKED_MAGIC, 4) == 0, "a long text is chunked");
+    string decoded;
+    check(decodeHuffStream(serial, decoded, 4) && decoded == big, "chunks decode in parallel");
+
+    vector<string_view> texts = {string_view(big), "", "short text", string_view(big).substr(5, HUFF_CHUNK_SIZE)};
+    vector<string> streams = encodeHuffStreams(texts, 3);
+    vector<string> outs(texts.size(), "junk");
+    vector<string*> outPtrs;
+    for (auto &o : outs) outPtrs.push_back(&o);
+    auto decodeAll = [&] { return decodeHuffStreams(vector<string_view>(streams.begin(), streams.end()), outPtrs, 3); };
+    bool same = decodeAll() == -1;
+    for (size_t i = 0; i < texts.size(); i++) same = same && outs[i] == texts[i];
+    check(same, "several streams decode together");
+    string good = streams[3];
+    uint64_t past = streams[3].size();
+    memcpy(&streams[3][HUFF_CHUNKED_HEADER_SIZE], &past, 8);
+    check(decodeAll() == 3, "a stream with a bad chunk table is named");
+    streams[3] = good;
+    streams[0].resize(streams[0].size() - 1);
+    check(decodeAll() == 0, "a truncated stream is named");
+}
+
+// ======================= HUFFMAN SNAPSHOT =======================
+
+// removes the manifest at path and every partition file of its first generations
+void removeSnapshot(const string &path, uint64_t generations) {
+    for (int p = 0; p < FROZEN_PARTS; p++) {
+        for (uint64_t gen = 1; gen <= generations; gen++) {
+            remove(huffPartPath(path, p, gen).c_str());
+            remove(huffIndexPath(path, p, gen).c_str());
+        }
+    }
+    remove(path.c_str());
+}
+
+// a save rewrites only the partitions changed since the last one
+void testSnapshotRoundTrip() {
+    vector<TrieEntry> entries = sampleEntries(3000);
+    entries.push_back({"weighty", "Heavy.", 12345});
+    useDictionary(entries);
+    string path = scratchFile("snapshot.huf");
+    string error;
+    check(writeCompressedDictionary(path, error), "a snapshot is saved");
+    check(fileExists(huffPartPath(path, 'b', 1)) && fileExists(huffIndexPath(path, 'b', 1)),
+          "each partition gets a file and an index");
+
+    clearDictionary();
+    check(readCompressedDictionary(path, error), "the snapshot loads");
+    vector<Completion> top = autocomplete("weighty", 1);
+    check(top.size() == 1 && top[0].weight == 12345, "weights are kept");
+    check(holdsEntries(entries) && totalWords(readGauges()) == entries.size(), "every word comes back");
+
+    insertIntoTrie("bzzz", "Changed.");
+    entries.push_back({"bzzz", "Changed.", 0});
+    check(writeCompressedDictionary(path, error), "a second snapshot is saved");
+    check(fileExists(huffPartPath(path, 'b', 2)) && !fileExists(huffPartPath(path, 'b', 1)),
+          "a changed partition is rewritten and its old file removed");
+    check(fileExists(huffPartPath(path, 'c', 1)) && !fileExists(huffPartPath(path, 'c', 2)),
+          "an unchanged partition keeps its file");
+    check(writeCompressedDictionary(path, error, true) && fileExists(huffPartPath(path, 'c', 3)) &&
+          !fileExists(huffPartPath(path, 'c', 1)), "rewriteAll rewrites every partition");
+
+    clearDictionary();
+    check(readCompressedDictionary(path, error, 1) && holdsEntries(entries), "the rewritten snapshot loads");
+    string damaged = huffPartPath(path, 'c', 3);
+    string data;
+    readWholeFile(damaged, data);
+    data[data.size() / 2] ^= 0x5a;
+    writeWholeFile(damaged, data);
+    check(!readCompressedDictionary(path, error) && error.find("partition 63") != string::npos,
+          "a damaged partition is named");
+    check(holdsEntries(entries), "a failed load keeps the dictionary");
+    removeSnapshot(path, 3);
+}
+
+// partitions of an opened snapshot are decoded when first needed
+void testLazySnapshot() {
+    vector<TrieEntry> entries = sampleEntries(3000);
+    useDictionary(entries);
+    string path = scratchFile("lazy.huf");
+    string error;
+    writeCompressedDictionary(path, error);
+    string damaged = huffPartPath(path, 'e', 1);
+    string data;
+    readWholeFile(damaged, data);
+    data[data.size() / 2] ^= 0x5a;
+    writeWholeFile(damaged, data);
+
+    clearDictionary();
+    check(openCompressedDictionary(path, error), "the snapshot opens");
+    check(readGauges().pendingParts == 26 && totalWords(readGauges()) == entries.size(),
+          "nothing is decoded, but every word is counted");
+    string meaning;
+    check(searchInTrie("b", meaning) && meaning == entries[1].meaning && readGauges().pendingParts == 25,
+          "a lookup decodes its own partition");
+    check(insertIntoTrie("czzz", "Changed.") && readGauges().pendingParts == 24, "an insert decodes its partition");
+    check(!searchInTrie("e", meaning) && !insertIntoTrie("ezzz", "Lost."), "a damaged partition cannot be read or changed");
+    check(writeCompressedDictionary(path, error) && fileExists(huffPartPath(path, 'c', 2)) &&
+          !fileExists(huffPartPath(path, 'd', 2)), "a save writes only the changed partition");
+    check(fileExists(huffPartPath(path, 'd', 1)) && readGauges().pendingParts == 23, "and decodes nothing else");
+
+    entries.erase(remove_if(entries.begin(), entries.end(), [](const TrieEntry &e) { return e.key[0] == 'e'; }),
+                  entries.end());
+    lazyBudget = 1;
+    check(holdsEntries(entries) && readGauges().pendingParts > 0, "over budget, partitions are dropped and decoded again");
+    lazyBudget = 0;
+    removeSnapshot(path, 2);
+}
+
+// ======================= MEANING BLOCKS =======================
+
+// meanings shorter and longer than a block, read back in random order
+void testMeaningBlocks() {
+    vector<TrieEntry> entries = sampleEntries(1500);
+    for (size_t i = 0; i < entries.size(); i += 97) entries[i].meaning = skewedText(3 * MEANING_BLOCK_SIZE + i, (uint32_t)i);
+    entries[5].meaning = "";
+    useDictionary(entries);
+    shuffle(entries.begin(), entries.end(), mt19937(5));
+    check(holdsEntries(entries), "every meaning decodes from its block in any order");
+    ReadGuard guard;
+    const FrozenTrie* ft = dictState.load()->parts[partOf("a")];
+    check(ft && ft->blocks > 1, "a partition is split into several blocks");
+}
+
+// a block that does not decode gives empty meanings and is not cached
+void testDamagedMeaningBlock() {
+    vector<TrieEntry> entries = sampleEntries(1500);
+    sort(entries.begin(), entries.end(), [](const TrieEntry &a, const TrieEntry &b) { return a.key < b.key; });
+    unique_ptr<FrozenTrie> ft(buildFrozenTrie(entries, false));
+    uint32_t last = ft->blocks - 1;
+    // an entry inside the last block, not at its start
+    int32_t entry = -1;
+    string meaning;
+    for (size_t i = 0; i < entries.size(); i++) {
+        int32_t e = frozenFind(ft.get(), entries[i].key.data(), entries[i].key.size());
+        if (ft->meaningOff[e] > ft->blockStart[last] && !entries[i].meaning.empty()) {
+            entry = e;
+            meaning = entries[i].meaning;
+        }
+    }
+    check(ft->blocks > 1 && entry >= 0, "the last block holds several meanings");
+    uint32_t end = ft->blockBytesStore[last + 1];
+    ft->blockBytesStore[last + 1] = ft->blockBytesStore[last];
+    bool empty = false;
+    try {
+        empty = frozenMeaningView(ft.get(), entry).empty();
+    } catch (const exception &) {
+    }
+    check(empty, "a meaning in a block that does not decode is empty");
+    ft->blockBytesStore[last + 1] = end;
+    check(frozenMeaningView(ft.get(), entry) == meaning, "the failed block was not cached");
+}
+
+// ======================= BATCH LOOKUP =======================
+
+// a batch answers exactly what one lookup per word would
+void testBatchMatchesSingle() {
+    vector<TrieEntry> entries = sampleEntries(1000);
+    useDictionary(entries);
+    insertIntoTrie("buffered", "Only in the buffer.");
+    insertIntoTrie("b", "Overwritten in the buffer.");
+    deleteFromTrie("c");
+    vector<string> words = {"", "  ", "C", "B", "buffered", "missing", "a", "a", "Ab"};
+    for (size_t i = 0; i < entries.size(); i += 3) words.push_back(entries[i].key);
+    for (size_t i = 0; i < entries.size(); i += 7) words.push_back(entries[i].key + "q");
+
+    vector<char> found, exists;
+    vector<string> meanings(2000, "stale");
+    searchInTrieBatch(words.data(), words.size(), found, &meanings);
+    searchInTrieBatch(words.data(), words.size(), exists, nullptr);
+    bool same = exists == found;
+    string meaning;
+    for (size_t i = 0; i < words.size(); i++) {
+        bool single = searchInTrie(words[i], meaning);
+        same = same && single == (bool)found[i] && (single ? meanings[i] == meaning : meanings[i].empty());
+    }
+    check(same, "batch results match single lookups");
+    check(found[4] && meanings[3] == "Overwritten in the buffer." && !found[2], "the buffer shadows frozen words in a batch");
+}
+
+// ======================= BINARY IMAGE =======================
+
+// a copy of the file at path with the byte at `at` flipped
+string damagedCopy(const string &path, const string &name, size_t at) {
+    string data;
+    readWholeFile(path, data);
+    data[at] ^= 0x5a;
+    string copy = scratchFile(name);
+    writeWholeFile(copy, data);
+    return copy;
+}
+
+void testImageRoundTrip() {
+    vector<TrieEntry> entries = sampleEntries(2000);
+    entries.push_back({"weighty", "Heavy.", 12345});
+    useDictionary(entries);
+    string path = scratchFile("roundtrip.img");
+    check(writeDictionaryImage(path), "the image is written");
+    insertIntoTrie("afterwards", "Not in the image.");
+
+    string error, meaning;
+    check(mapDictionaryImage(path, true, error), "the image maps with every partition verified");
+    check(frozenWordCount() == entries.size() && holdsEntries(entries), "the mapped image holds every word");
+    check(!searchInTrie("afterwards", meaning), "a word inserted after the save is not in it");
+    vector<Completion> found = autocomplete("weighty", 1);
+    check(found.size() == 1 && found[0].weight == 12345, "weights survive the image");
+
+    check(mapDictionaryImage(path, false, error), "the image maps lazily");
+    check(readGauges().pendingParts > 0, "lazily mapped partitions start pending");
+    vector<string> words;
+    for (auto &e : entries) words.push_back(e.key);
+    vector<char> hit;
+    vector<string> meanings;
+    searchInTrieBatch(words.data(), words.size(), hit, &meanings);
+    bool all = true;
+    for (size_t i = 0; i < entries.size(); i++) all = all && hit[i] && meanings[i] == entries[i].meaning;
+    check(all, "a batch over pending partitions finds every word");
+
+    string header = damagedCopy(path, "header.img", 24);
+    check(!mapDictionaryImage(header, true, error), "a damaged header is refused");
+    string raw;
+    readWholeFile(path, raw);
+    ImagePart part;
+    memcpy(&part, raw.data() + sizeof(ImageHeader) + sizeof(ImagePart) * partOf("w"), sizeof(part));
+    string damaged = damagedCopy(path, "partition.img", part.offset + part.bytes / 2);
+    check(!mapDictionaryImage(damaged, true, error), "a damaged partition fails verification");
+    check(mapDictionaryImage(damaged, false, error), "a lazy map defers the partition checks");
+    check(!searchInTrie("weighty", meaning) && searchInTrie("a", meaning), "only the damaged partition is lost");
+    check(!insertIntoTrie("wasp", "An insect."), "the damaged partition refuses writes");
+    for (const string &f : {path, header, damaged}) remove(f.c_str());
+}
+
+// the bytes of the string literal in a file written by writeEmbeddedImage
+string embeddedBytes(const string &source) {
+    string out;
+    size_t at = source.find("=\n\"");
+    if (at == string::npos) return out;
+    bool inside = false;
+    for (size_t i = at + 2; i < source.size(); i++) {
+        char c = source[i];
+        if (c == '"') inside = !inside;
+        else if (inside && c == '\\' && i + 3 < source.size()) {
+            out += (char)((source[i + 1] - '0') << 6 | (source[i + 2] - '0') << 3 | (source[i + 3] - '0'));
+            i += 3;
+        } else if (inside) {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// the generated source holds the image byte for byte, and an image in
+// memory the program does not own is used in place
+void testEmbeddedImage() {
+    vector<TrieEntry> entries = sampleEntries(2000);
+    entries.push_back({"quote\"back\\slash?", "Every \"escaped\" byte\\?\x01.", 7});
+    useDictionary(entries);
+    string path = scratchFile("embedded.inc");
+    string error, image, source;
+    check(writeEmbeddedImage(path, error) && encodeDictionaryImage(image), "the image source is written");
+    readWholeFile(path, source);
+    check(source.find("alignas(8) const char EMBEDDED_IMAGE[] =") != string::npos && embeddedBytes(source) == image,
+          "the literal spells out the image");
+
+    // lives as long as the program, like a linked-in image
+    static vector<uint64_t> linked;
+    linked.assign(image.size() / 8 + 1, 0);
+    memcpy(linked.data(), image.data(), image.size());
+    auto mf = make_shared<MappedFile>();
+    mf->data = (const char*)linked.data();
+    mf->size = image.size();
+    mf->borrowed = true;
+    clearDictionary();
+    check(adoptDictionaryImage(mf, false, error) && holdsEntries(entries), "the words are read in place");
+    check(reverseWords("escaped") == normalizeWord("quote\"back\\slash?"), "its meaning index is used in place");
+    clearDictionary();
+    remove(path.c_str());
+}
+
+// ======================= AUTOCOMPLETE =======================
+
+// looked-up words climb the ranking before anything folds their counts
+void testAutocompleteLookupCounts() {
+    useDictionary({{"card", "A piece of paper.", 50}, {"care", "Attention.", 40}, {"cart", "A wagon.", 0}});
+    auto first = [] {
+        vector<Completion> found = autocomplete("car", 3);
+        return found.size() == 3 ? found[0].word : string();
+    };
+    check(first() == "card", "the heaviest stored weight ranks first");
+    string meaning;
+    for (uint32_t i = 0; i < 8 * LOOKUP_SAMPLE_RATE; i++) searchInTrie("cart", meaning);
+    check(first() == "cart", "a word looked up often ranks first");
+    vector<Completion> found = autocomplete("car", 3);
+    check(found.size() == 3 && found[1].word == "card" && found[2].word == "care", "the rest keep their order");
+}
+
+// ======================= NORMALIZED KEYS =======================
+
+void testNormalizedKeys() {
+    check(normalizeWord("Café") == "café" && normalizeWord("ÉCOLE") == "école", "accented Latin letters fold");
+    check(normalizeWord("МОСКВА") == "москва" && normalizeWord("ΑΘΗΝΑ") == "αθηνα", "Cyrillic and Greek fold");
+    check(normalizeWord("Straße") == "straße", "there is no full folding");
+    check(normalizeWord("  X-ray  ") == "x-ray" && normalizeWord("Co--op") == "co-op", "a run of joiners is kept once");
+    check(normalizeWord("rock 'n' roll") == "rock n roll", "a space wins over other joiners");
+    check(normalizeWord("caf\xff") == "caf", "malformed UTF-8 is dropped");
+
+    useDictionary({{"co-op", "A shared store.", 0}, {"école", "A school.", 0}});
+    insertIntoTrie("Coop", "A cage for hens.");
+    insertIntoTrie("МОСКВА", "A city.");
+    string meaning;
+    check(searchInTrie("CO-OP", meaning) && meaning == "A shared store.", "a hyphenated frozen word is found");
+    check(searchInTrie("coop", meaning) && meaning == "A cage for hens.", "a hyphen keeps two words apart");
+    check(searchInTrie("École", meaning) && meaning == "A school.", "a frozen word is found in any case");
+    check(searchInTrie("Москва", meaning) && meaning == "A city.", "a buffered word is found in any case");
+    freezeTrie();
+    check(searchInTrie("москва", meaning) && searchInTrie("COOP", meaning) && meaning == "A cage for hens.",
+          "non-ASCII words survive freezing");
+}
+
+// ======================= REVERSE LOOKUP =======================
+
+// every sense is indexed, and the index comes back with a reloaded dictionary
+void testReverseLookup() {
+    useDictionary({{"apple", "A red fruit.", 3}, {"cherry", "A small red fruit.", 0},
+                   {"banana", "A yellow fruit.", 0}, {"grape", "A vine fruit.", 0}});
+    check(addSense("apple", "A tree.") && !addSense("apple", "A tree."), "a sense is added once");
+    insertIntoTrie("tomato", "A red vegetable.");
+    deleteFromTrie("grape");
+    string meaning;
+    check(searchInTrie("apple", meaning) && meaning == string("A red fruit.") + SENSE_SEPARATOR + "A tree.",
+          "the senses are kept in order");
+    auto allFound = [](const string &when) {
+        size_t total;
+        vector<Completion> first = reverseLookup("red", 1, &total);
+        check(first.size() == 1 && first[0].word == "apple" && total == 3, "the limit counts every match " + when);
+        check(reverseWords("Red FRUIT") == "apple cherry", "every term must match, heaviest first " + when);
+        check(reverseWords("tree") == "apple", "a second sense is indexed " + when);
+        check(reverseWords("red vegetable") == "tomato", "buffered words are found " + when);
+        check(reverseWords("vine").empty(), "a deleted word is not found " + when);
+        check(reverseWords("").empty() && reverseWords("kiwi").empty(), "nothing matches an unknown term " + when);
+    };
+    allFound("in the buffer");
+
+    string image = scratchFile("reverse.img"), snapshot = scratchFile("reverse.huf");
+    string error;
+    check(writeDictionaryImage(image) && writeCompressedDictionary(snapshot, error), "the dictionary is saved");
+    allFound("after freezing");
+    clearDictionary();
+    check(mapDictionaryImage(image, true, error), "the image maps");
+    allFound("in a mapped image");
+    clearDictionary();
+    check(readCompressedDictionary(snapshot, error), "the snapshot loads");
+    allFound("in a loaded snapshot");
+    clearDictionary();
+    check(openCompressedDictionary(snapshot, error), "the snapshot opens");
+    allFound("in an opened snapshot");
+    check(searchInTrie("apple", meaning) && meaning == string("A red fruit.") + SENSE_SEPARATOR + "A tree.",
+          "the senses survive a reload");
+    remove(image.c_str());
+    removeSnapshot(snapshot, 1);
+}
+
+// ======================= FUZZY LOOKUP =======================
+
+// the suggestions for query, in order, separated by spaces
+string suggestions(const string &query, int maxDist, size_t limit = 10) {
+    string out;
+    for (auto &m : fuzzySearch(query, maxDist, limit)) out += (out.empty() ? "" : " ") + m.word;
+    return out;
+}
+
+// closest first, then heaviest, across partitions and the buffer
+void testFuzzySearch() {
+    useDictionary({{"apple", "A fruit.", 5}, {"apply", "To ask.", 1}, {"ample", "Enough.", 0},
+                   {"maple", "A tree.", 0}, {"banana", "A fruit.", 9}});
+    check(suggestions("aple", 1) == "apple ample maple", "nearest first, then by weight and key");
+    check(suggestions("aple", 1, 2) == "apple ample", "the limit keeps the best");
+    check(suggestions("aple", 2) == "apple ample maple apply", "a wider bound finds more");
+    check(suggestions("apple", 0) == "apple" && suggestions("aple", 0).empty(), "distance 0 is an exact match");
+    check(suggestions("xpple", 1) == "apple", "a typo in the first letter searches other partitions");
+    check(suggestions("", 2).empty() && suggestions("--", 2).empty(), "an empty query finds nothing");
+    insertIntoTrie("aplet", "Buffered.");
+    deleteFromTrie("ample");
+    check(suggestions("aple", 1) == "apple aplet maple", "buffered words are found and deleted ones skipped");
+}
+
+// ties go by the weights autocomplete uses: live lookup counts, and the
+// buffered copy of a word rather than its frozen one
+void testFuzzyLiveWeights() {
+    useDictionary({{"apple", "A fruit.", 5}, {"ample", "Enough.", 3}, {"maple", "A tree.", 9}});
+    check(suggestions("aple", 1) == "maple apple ample", "frozen weights rank");
+    string meaning;
+    for (uint32_t i = 0; i < 10 * LOOKUP_SAMPLE_RATE; i++) searchInTrie("ample", meaning);
+    check(suggestions("aple", 1) == "ample maple apple", "lookups since the freeze count");
+    deleteFromTrie("maple");
+    insertIntoTrie("maple", "A tree again.");
+    vector<FuzzyMatch> found = fuzzySearch("aple", 1, 10);
+    check(found.size() == 3 && found[2].word == "maple" && found[2].weight == 0,
+          "a buffered word's weight replaces its frozen one");
+}
+
+void testFuzzyNonAscii() {
+    useDictionary({{"café", "A coffee house.", 0}, {"école", "A school.", 0}, {"naïve", "Innocent.", 0}});
+    check(suggestedDistance("cafe", 1, "café") == 1, "\"cafe\" is one edit from frozen \"café\"");
+    check(suggestedDistance("ecole", 1, "école") == 1, "\"ecole\" is one edit from frozen \"école\"");
+    check(suggestedDistance("naive", 1, "naïve") == 1, "\"naive\" is one edit from frozen \"naïve\"");
+    check(suggestedDistance("caf", 1, "café") == 1, "a missing accented letter is one edit");
+    check(suggestedDistance("cafés", 1, "café") == 1, "an extra letter after an accented one is one edit");
+    check(suggestedDistance("cofé", 1, "café") == 1, "a typo before an accented letter is one edit");
+    check(suggestedDistance("cafè", 1, "café") == 1, "one accent swapped for another is one edit");
+    check(suggestedDistance("cofe", 1, "café") == -1, "two edits are not within 1");
+
+    insertIntoTrie("señor", "Sir.");
+    check(suggestedDistance("senor", 1, "señor") == 1, "\"senor\" is one edit from buffered \"señor\"");
+    check(suggestedDistance("sñor", 1, "señor") == 1, "a missing letter before an accented one is one edit");
+}
+
+// ======================= WRITE BUFFER =======================
+
+// words sharing long prefixes, and one node with more children than a
+// Node48 holds, come back from the buffer in key order
+void testWriteBuffer() {
+    useDictionary({});
+    vector<string> fanout = {"é", "ā", "ő", "α", "ω", "д", "я", "ա", "ֆ", "中", "字", "文", "社", "苹", "語", "가", "한", "𠀀"};
+    for (char c = '0'; c <= '9'; c++) fanout.push_back(string(1, c));
+    for (char c = 'a'; c <= 'z'; c++) fanout.push_back(string(1, c));
+    vector<TrieEntry> entries;
+    for (auto &c : fanout) {
+        entries.push_back({"fan" + c, "Short " + c, 0});
+        entries.push_back({"fan" + c + "out", "Long " + c, 0});
+    }
+    for (string w : {"roman", "romane", "romanus", "romulus", "rubens", "ruber", "rubicon", "r"}) {
+        entries.push_back({w, "A word.", 0});
+    }
+    // inserted in reverse, so edges split and nodes grow out of order
+    for (size_t i = entries.size(); i-- > 0;) insertIntoTrie(entries[i].key, entries[i].meaning);
+    check(holdsEntries(entries), "every buffered word is found");
+    string meaning;
+    check(!searchInTrie("fa", meaning) && !searchInTrie("roma", meaning) && !searchInTrie("fanou", meaning),
+          "a prefix inside an edge is not a word");
+
+    sort(entries.begin(), entries.end(), [](const TrieEntry &a, const TrieEntry &b) { return a.key < b.key; });
+    vector<TrieEntry> all;
+    string current;
+    collectTrieWords(dictState.load()->buffer, current, all);
+    bool ordered = all.size() == entries.size();
+    for (size_t i = 0; ordered && i < all.size(); i++) ordered = all[i].key == entries[i].key;
+    check(ordered, "the buffer walks in key order");
+    vector<TrieEntry> some;
+    collectBufferPrefix(dictState.load()->buffer, "rom", some);
+    check(some.size() == 4 && some[0].key == "roman" && some[3].key == "romulus", "a prefix ending inside an edge");
+
+    insertIntoTrie("fanαout", "Overwritten.");
+    check(searchInTrie("fanαout", meaning) && meaning == "Overwritten." && searchInTrie("fanα", meaning),
+          "an overwrite keeps its neighbours");
+    freezeTrie();
+    entries.erase(find_if(entries.begin(), entries.end(), [](const TrieEntry &e) { return e.key == "fanαout"; }));
+    check(holdsEntries(entries), "buffered words survive freezing");
+}
+
+// ======================= ALLOCATIONS =======================
+
+// warmed-up lookups, frozen or buffered, hit or miss, never touch the heap
+void testAllocationFreeLookups() {
+    vector<TrieEntry> entries = sampleEntries(5000);
+    useDictionary(entries);
+    vector<string> words;
+    for (size_t i = 0; i < entries.size(); i += 5) words.push_back(entries[i].key);
+    for (size_t i = 0; i < 200; i++) {
+        string word = entries[i * 13].key + "0";
+        insertIntoTrie(word, "Buffered, with a meaning longer than any short string buffer.");
+        words.push_back(word);
+        words.push_back(entries[i * 17].key + "1");
+        words.push_back("  Mixed-CASE " + entries[i].key);
+    }
+    vector<string_view> views(words.begin(), words.end());
+    string meaning;
+    size_t hits = 0;
+    check(allocationsOf([&] {
+              for (string_view w : views) hits += searchInTrie(w, meaning);
+          }) == 0, "single lookups allocate nothing");
+    vector<char> found;
+    vector<string> meanings;
+    check(allocationsOf([&] { searchInTrieBatch(views.data(), views.size(), found, &meanings); }) == 0,
+          "batch lookups allocate nothing");
+    check(hits > 0, "the lookups found words");
+}
+
+// ======================= DELETES AND COMPACTION =======================
+
+// deletes hide frozen words until a freeze drops them for good
+void testEraseAndFreeze() {
+    vector<TrieEntry> entries = sampleEntries(2000);
+    useDictionary(entries);
+    insertIntoTrie("newword", "Buffered.");
+    string meaning;
+    check(deleteFromTrie("B") && !searchInTrie("b", meaning), "a frozen word is deleted");
+    check(deleteFromTrie("newword") && !searchInTrie("newword", meaning), "a buffered word is deleted");
+    check(!deleteFromTrie("b") && !deleteFromTrie("missing"), "a missing word cannot be deleted");
+    check(!updateInTrie("b", "Back.") && !searchInTrie("b", meaning),
+          "a deleted word cannot be updated");
+    check(readGauges().bufferedDeletes == 1 && totalWords(readGauges()) == entries.size() - 1,
+          "one delete waits for the freeze");
+    vector<Completion> found = autocomplete("b", 100);
+    check(none_of(found.begin(), found.end(), [](const Completion &c) { return c.word == "b"; }),
+          "autocomplete skips a deleted word");
+
+    string_view stale = "Stale.", current = entries[2].meaning;
+    check(!updateInTrie("c", "Changed.", &stale) && updateInTrie("c", "Changed.", &current),
+          "an update only applies while the meaning is as expected");
+    freezeTrie();
+    check(readGauges().bufferedDeletes == 0 && readGauges().frozenWords == entries.size() - 1, "the freeze drops the word");
+    check(!searchInTrie("b", meaning) && searchInTrie("c", meaning) && meaning == "Changed.",
+          "frozen results match the buffered ones");
+    check(insertIntoTrie("b", "Back.") && searchInTrie("b", meaning) && meaning == "Back.", "a deleted word can come back");
+}
+
+// overwriting one buffered word over and over leaves waste the buffer compacts away
+void testBufferCompaction() {
+    vector<TrieEntry> entries = sampleEntries(2000);
+    useDictionary(entries);
+    insertIntoTrie("keep", "Kept through compaction.");
+    uint64_t compactions = readMetrics().counters[MC_COMPACTIONS];
+    string big(4096, 'm');
+    for (int i = 0; i < 1000; i++) insertIntoTrie("churn", big + to_string(i));
+    if (METRICS_ENABLED) check(readMetrics().counters[MC_COMPACTIONS] > compactions, "the buffer was compacted");
+    check(readGauges().bufferWaste <= COMPACT_MIN_WASTE, "compaction frees the waste");
+    string meaning;
+    check(searchInTrie("churn", meaning) && meaning == big + "999" && searchInTrie("keep", meaning) &&
+          meaning == "Kept through compaction.", "buffered words survive compaction");
+    check(holdsEntries(entries) && readGauges().frozenWords == entries.size(), "nothing was frozen");
+}
+
+// ======================= BULK LOADER =======================
+
+// word lists load into one dictionary whatever the thread count
+void testBulkLoader() {
+    string first = scratchFile("first.txt"), second = scratchFile("second.txt");
+    string missingPath = scratchFile("missing.txt");
+    writeText(first, "Apple - A fruit.\nco-op - A shared store.\nno separator\n - No word.\nApple - A tree.");
+    writeText(second, "Banana - A fruit.\r\nCherry-A stone fruit.\r\n");
+    for (unsigned threads : {1u, 4u}) {
+        vector<string> missing;
+        check(loadWordFiles({first, missingPath, second}, missing, threads), "word lists load");
+        check(missing == vector<string>{missingPath}, "an unreadable list is reported");
+        string meaning;
+        check(searchInTrie("apple", meaning) && meaning == string("A fruit.") + SENSE_SEPARATOR + "A tree.",
+              "a repeated word keeps its senses in input order");
+        check(searchInTrie("co-op", meaning) && meaning == "A shared store.", "a word may contain a hyphen");
+        check(searchInTrie("banana", meaning) && meaning == "A fruit.", "carriage returns are trimmed");
+        check(searchInTrie("cherry", meaning) && meaning == "A stone fruit.", "a bare hyphen separates too");
+        check(totalWords(readGauges()) == 4, "lines without a word are skipped");
+    }
+    vector<string> missing;
+    string meaning;
+    check(!loadWordFiles({missingPath}, missing) && searchInTrie("apple", meaning),
+          "nothing readable keeps the dictionary");
+    remove(first.c_str());
+    remove(second.c_str());
+}
+
+// ======================= EPOCH RECLAMATION =======================
+
+// more threads than one block of reader slots, all inside a ReadGuard at once
+void testManyReaders() {
+    useDictionary({{"apple", "A fruit.", 0}});
+    const int threads = 3 * READER_SLOTS;
+    atomic<int> inside{0};
+    atomic<int> together{0};
+    atomic<int> found{0};
+    vector<thread> pool;
+    for (int i = 0; i < threads; i++) {
+        pool.emplace_back([&] {
+            ReadGuard guard;
+            inside++;
+            auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+            while (inside.load() < threads && chrono::steady_clock::now() < deadline) this_thread::yield();
+            if (inside.load() == threads) together++;
+            string meaning;
+            if (searchInTrie("apple", meaning)) found++;
+        });
+    }
+    for (int i = 0; i < 100; i++) insertIntoTrie("word" + to_string(i), "A word.");
+    for (auto &t : pool) t.join();
+    check(together.load() == threads && found.load() == threads, "every reader gets a slot without waiting for another to exit");
+    // what the readers kept alive is freed at the next publish
+    clearDictionary();
+}
+
+// ======================= LOOKUP CACHE =======================
+
+// lock-free hits racing stores and invalidations never see a torn entry
+void testCacheRaces() {
+    vector<TrieEntry> entries;
+    for (int i = 0; i < 64; i++) entries.push_back({"word" + to_string(i), "old meaning " + to_string(i), 0});
+    useDictionary(entries);
+    configureLookupCache(32);
+    atomic<bool> stop{false};
+    atomic<int> torn{0};
+    vector<thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&, t] {
+            string meaning;
+            for (int n = t; !stop.load(); n++) {
+                string i = to_string(n % 64);
+                bool found = searchInTrie("word" + i, meaning);
+                if (!found || (meaning != "old meaning " + i && meaning != "a much longer new meaning " + i)) torn++;
+            }
+        });
+    }
+    for (int i = 0; i < 64; i++) insertIntoTrie("word" + to_string(i), "a much longer new meaning " + to_string(i));
+    this_thread::sleep_for(chrono::milliseconds(50));
+    stop = true;
+    for (auto &t : readers) t.join();
+    check(torn.load() == 0, "a cached lookup returns a whole old or new meaning");
+    string meaning;
+    searchInTrie("word7", meaning);
+    check(searchInTrie("word7", meaning) && meaning == "a much longer new meaning 7", "an insert invalidates its cached word");
+    if (METRICS_ENABLED) check(readLookupCacheStats().hits > 0, "cache hits are counted");
+    configureLookupCache(0);
+}
+
+// every spelling of a changed word, cached hit or miss, is invalidated
+void testCacheInvalidation() {
+    useDictionary({{"apple", "A fruit.", 0}, {"plum", "A fruit.", 0}});
+    configureLookupCache(64);
+    string meaning;
+    auto twice = [&](const string &word) {
+        searchInTrie(word, meaning);
+        return searchInTrie(word, meaning);
+    };
+    check(!twice("PEAR") && !twice("pear") && twice("Apple") && twice("PLUM"), "lookups are cached");
+    insertIntoTrie("Pear", "A fruit.");
+    check(searchInTrie("PEAR", meaning) && searchInTrie("pear", meaning), "an insert invalidates cached misses");
+    deleteFromTrie("APPLE");
+    check(!searchInTrie("Apple", meaning), "a delete invalidates cached hits");
+    updateInTrie("plum", "A stone fruit.");
+    check(searchInTrie("PLUM", meaning) && meaning == "A stone fruit.", "an update invalidates cached meanings");
+    addSense("plum", "A purple colour.");
+    check(searchInTrie("PLUM", meaning) && meaning == string("A stone fruit.") + SENSE_SEPARATOR + "A purple colour.",
+          "a new sense invalidates cached meanings");
+    twice("cherry");
+    useDictionary({{"cherry", "A fruit.", 0}});
+    check(searchInTrie("cherry", meaning) && !searchInTrie("PLUM", meaning), "a new dictionary empties the cache");
+    for (int i = 0; i < 1000; i++) searchInTrie("word" + to_string(i), meaning);
+    LookupCacheStats stats = readLookupCacheStats();
+    check(stats.entries <= stats.capacity && stats.capacity >= 64, "the cache stays within its capacity");
+    configureLookupCache(0);
+}
+
+// ======================= WRITE-AHEAD LOG =======================
+
+// a crash in the middle of a record loses only that record
+void testWalTornTail() {
+    useDictionary({{"apple", "A fruit.", 0}});
+    walOptions.imagePath = scratchFile("torn.img");
+    string log = scratchFile("torn.wal");
+    check(openWriteAheadLog(log) == 0, "an empty log opens");
+    insertIntoTrie("banana", "A fruit.");
+    insertIntoTrie("cherry", "A stone fruit.");
+    deleteFromTrie("apple");
+    closeWriteAheadLog();
+    string data;
+    readWholeFile(log, data);
+    size_t whole = data.size();
+    string torn;
+    encodeWalRecord(torn, 4, WAL_INSERT, "date", "A sweet fruit.");
+    writeWholeFile(log, data + torn.substr(0, torn.size() - 3));
+
+    // restart from a snapshot taken before the first record
+    replaceDictionary(buildDictState({{"apple", "A fruit.", 0}}), false);
+    check(openWriteAheadLog(log) == 3, "the whole records are replayed");
+    string meaning;
+    check(searchInTrie("banana", meaning) && searchInTrie("cherry", meaning) && meaning == "A stone fruit.",
+          "replayed inserts are found");
+    check(!searchInTrie("apple", meaning), "a replayed delete is applied");
+    check(!searchInTrie("date", meaning), "the torn record is dropped");
+    readWholeFile(log, data);
+    check(data.size() == whole, "the torn tail is cut off");
+    insertIntoTrie("date", "A sweet fruit.");
+    closeWriteAheadLog();
+
+    replaceDictionary(new DictState(), false);
+    check(openWriteAheadLog(log) == 4, "records appended after the cut are replayed");
+    check(searchInTrie("date", meaning) && meaning == "A sweet fruit." && !searchInTrie("apple", meaning),
+          "the log replays onto an empty dictionary");
+    closeWriteAheadLog();
+    remove(log.c_str());
+    remove(walOptions.imagePath.c_str());
+    walOptions.imagePath = IMAGE_FILE;
+}
+
+// records that change nothing on replay still count, so new ones follow them
+void testWalSequenceAfterNoOps() {
+    useDictionary({{"apple", "A fruit.", 0}});
+    walOptions.imagePath = scratchFile("noop.img");
+    string log = scratchFile("noop.wal");
+    openWriteAheadLog(log);
+    insertIntoTrie("banana", "A fruit.");
+    deleteFromTrie("apple");
+    closeWriteAheadLog();
+
+    // a new process without apple, so the logged delete changes nothing
+    replaceDictionary(new DictState(), false);
+    {
+        lock_guard<mutex> lk(wal.m);
+        wal.lastSeq = 0;
+    }
+    check(openWriteAheadLog(log) == 2, "both records are replayed");
+    insertIntoTrie("cherry", "A fruit.");
+    closeWriteAheadLog();
+    string data;
+    readWholeFile(log, data);
+    vector<WalRecord> records;
+    decodeWalRecords(data, records);
+    bool increasing = records.size() == 3;
+    for (size_t i = 1; i < records.size(); i++) increasing = increasing && records[i].seq > records[i - 1].seq;
+    check(increasing, "a new record follows the last one in the file");
+    remove(log.c_str());
+    remove(walOptions.imagePath.c_str());
+    walOptions.imagePath = IMAGE_FILE;
+}
+
+// a snapshot saved before a checkpoint trimmed the log is not started from
+void testLazyStartAfterCheckpoint() {
+    useDictionary({{"apple", "A fruit.", 0}});
+    walOptions.imagePath = scratchFile("lazystart.img");
+    string log = scratchFile("lazystart.wal"), snapshot = scratchFile("lazystart.huf");
+    string error, meaning;
+    openWriteAheadLog(log);
+    insertIntoTrie("banana", "A fruit.");
+    check(writeCompressedDictionary(snapshot, error), "a snapshot is saved");
+    uint64_t saved = dictState.load()->walSeq;
+    insertIntoTrie("cherry", "A fruit.");
+    check(checkpointDictionary(), "a checkpoint trims the log");
+    insertIntoTrie("date", "A fruit.");
+    closeWriteAheadLog();
+
+    // restart lazily
+    replaceDictionary(new DictState(), false);
+    check(openCompressedDictionary(snapshot, error) && dictState.load()->walSeq == saved,
+          "the snapshot keeps its log position");
+    check(!logContinuesFrom(saved, log), "records only the image holds are detected");
+    check(mapDictionaryImage(walOptions.imagePath, false, error) && openWriteAheadLog(log) == 1,
+          "the image takes over and the log replays onto it");
+    check(searchInTrie("banana", meaning) && searchInTrie("cherry", meaning) && searchInTrie("date", meaning),
+          "nothing committed is lost");
+
+    check(writeCompressedDictionary(snapshot, error), "a newer snapshot is saved");
+    insertIntoTrie("elder", "A tree.");
+    closeWriteAheadLog();
+    replaceDictionary(new DictState(), false);
+    check(openCompressedDictionary(snapshot, error) && logContinuesFrom(dictState.load()->walSeq, log),
+          "a snapshot the log continues from is started from");
+    check(openWriteAheadLog(log) == 1 && searchInTrie("elder", meaning) && searchInTrie("cherry", meaning) &&
+          searchInTrie("date", meaning), "the log replays onto the opened snapshot");
+    closeWriteAheadLog();
+    remove(log.c_str());
+    remove(walOptions.imagePath.c_str());
+    removeSnapshot(snapshot, 2);
+    walOptions.imagePath = IMAGE_FILE;
+}
+
+// once the log fails, changes are refused until a checkpoint holds them all
+void testWalFailure() {
+    useDictionary({{"apple", "A fruit.", 0}});
+    walOptions.imagePath = scratchFile("failure.img");
+    string log = scratchFile("failure.wal");
+    check(openWriteAheadLog(log) == 0, "an empty log opens");
+    check(insertIntoTrie("banana", "A fruit."), "a logged insert succeeds");
+    {
+        lock_guard<mutex> lk(wal.m);
+        wal.failed = true;
+        wal.retryFailedAt = chrono::steady_clock::now() + chrono::hours(1);
+    }
+    string meaning;
+    check(!insertIntoTrie("cherry", "A fruit.") && !searchInTrie("cherry", meaning), "a failed log refuses inserts");
+    check(!deleteFromTrie("banana") && searchInTrie("banana", meaning), "a failed log refuses deletes");
+    check(writeAheadLogFailed(), "the failure is reported");
+    check(checkpointDictionary() && !writeAheadLogFailed(), "a checkpoint clears the failure");
+    check(insertIntoTrie("cherry", "A fruit."), "changes are accepted again");
+    closeWriteAheadLog();
+    remove(log.c_str());
+    remove(walOptions.imagePath.c_str());
+    walOptions.imagePath = IMAGE_FILE;
+}
+
+// ======================= QUERY SERVER =======================
+
+#ifdef __linux__
+
+// sends request in one piece, closes the sending side and reads every reply
+string askServer(const string &address, const string &request) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+    for (int tries = 0; connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0 && tries < 500; tries++) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    for (size_t sent = 0; sent < request.size();) {
+        ssize_t n = write(fd, request.data() + sent, request.size() - sent);
+        if (n <= 0) break;
+        sent += n;
+    }
+    shutdown(fd, SHUT_WR);
+    string reply;
+    char buf[4096];
+    for (ssize_t n; (n = read(fd, buf, sizeof(buf))) > 0;) reply.append(buf, n);
+    close(fd);
+    return reply;
+}
+
+// pipelined requests are answered in order, a change before the reads after it
+void testServerPipelining() {
+    useDictionary({{"apple", "A fruit.", 0}});
+    string address = scratchFile("server.sock");
+    bool served = false;
+    string error;
+    thread server([&] { served = runServer(address, 2, error); });
+
+    string reply = askServer(address, "GET Apple\nGET pear\r\nINS Pear - A fruit.\nGET pear\n"
+                                      "DEL apple\nGET apple\nUPD plum - A fruit.\nBOGUS\nPREFIX pe\n");
+    check(reply == "OK A fruit.\nNF\nOK\nOK A fruit.\nOK\nNF\nNF\nERR unknown request\nOK 1\npear\t0\n",
+          "pipelined requests are answered in order");
+    string many;
+    for (int i = 0; i < 1000; i++) many += i % 100 == 0 ? "INS w" + to_string(i) + " - A word.\n" : "GET pear\n";
+    reply = askServer(address, many);
+    check(count(reply.begin(), reply.end(), '\n') == 1000 && reply.substr(0, 3) == "OK\n",
+          "a long pipeline gets every reply");
+
+    serverStop = true;
+    server.join();
+    check(served, "the server stops cleanly");
+    string meaning;
+    check(searchInTrie("w900", meaning), "every change reached the dictionary");
+}
+
+#endif
+
+// ======================= STREAMING =======================
+
+// a stream of several blocks comes back in input order whatever the thread count
+void testStreamLookups() {
+    vector<TrieEntry> entries = sampleEntries(5000);
+    useDictionary(entries);
+    const char* separators[] = {"\n", "\t", "\r\n", "\n\n"};
+    string input, expected;
+    for (size_t i = 0; input.size() <= 2 * STREAM_CHUNK; i++) {
+        const TrieEntry &e = entries[i * 7919 % entries.size()];
+        bool known = i % 3 != 0;
+        string word = known ? e.key : e.key + "0";
+        input += word + separators[i % 4];
+        expected += word + "\t" + (known ? e.meaning : "") + "\n";
+    }
+    input += "zz0";
+    expected += "zz0\t\n";
+    for (unsigned threads : {1u, 4u}) {
+        FILE* in = tmpfile();
+        FILE* out = tmpfile();
+        fwrite(input.data(), 1, input.size(), in);
+        rewind(in);
+        check(streamLookups(in, out, threads), "the stream is written");
+        string got(ftell(out), '\0');
+        rewind(out);
+        check(fread(&got[0], 1, got.size(), out) == got.size() && got == expected,
+              "every word is answered once, in input order");
+        fclose(in);
+        fclose(out);
+    }
+}
+
+// ======================= STATISTICS =======================
+
+// what threads counted is kept after they exit; lookups are timed one in
+// METRIC_SAMPLE_RATE
+void testMetrics() {
+    if (!METRICS_ENABLED) return;
+    useDictionary({{"apple", "A fruit.", 0}});
+    MetricsSnapshot before = readMetrics();
+    const int threads = 4, lookups = 1000;
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([] {
+            string meaning;
+            for (int i = 0; i < lookups; i++) searchInTrie(i % 2 ? "apple" : "pear", meaning);
+        });
+    }
+    for (auto &t : pool) t.join();
+    MetricsSnapshot after = readMetrics();
+    check(after.counters[MC_LOOKUPS] - before.counters[MC_LOOKUPS] == threads * lookups &&
+          after.counters[MC_LOOKUP_HITS] - before.counters[MC_LOOKUP_HITS] == threads * lookups / 2,
+          "exited threads' lookups are counted");
+    uint64_t timed = after.count(MH_LOOKUP) - before.count(MH_LOOKUP);
+    check(timed == threads * (lookups / METRIC_SAMPLE_RATE), "one lookup in METRIC_SAMPLE_RATE is timed");
+    string text = formatPrometheusMetrics();
+    check(text.find("dict_lookups_total " + to_string(after.counters[MC_LOOKUPS]) + "\n") != string::npos,
+          "Prometheus text has the counters");
+    check(text.find("dict_lookup_seconds_count " + to_string(after.count(MH_LOOKUP)) + "\n") != string::npos,
+          "Prometheus text has the histograms");
+}
+
+void testWordCount() {
+    useDictionary({{"apple", "A fruit.", 0}, {"banana", "A fruit.", 0}, {"cherry", "A fruit.", 0}});
+    auto words = [] { return totalWords(readGauges()); };
+    check(words() == 3, "three frozen words");
+    updateInTrie("apple", "A red fruit.");
+    check(words() == 3, "updating a frozen word keeps the count");
+    addSense("apple", "A tree.");
+    check(words() == 3, "adding a sense to an updated word keeps the count");
+    addSense("cherry", "A tree.");
+    check(words() == 3, "adding a sense to a frozen word keeps the count");
+    insertIntoTrie("date", "A fruit.");
+    check(words() == 4, "inserting a new word counts it");
+    deleteFromTrie("banana");
+    check(words() == 3, "deleting a frozen word uncounts it");
+    insertIntoTrie("banana", "A fruit again.");
+    check(words() == 4, "inserting a deleted frozen word counts it again");
+    deleteFromTrie("apple");
+    check(words() == 3, "deleting an updated word uncounts it");
+    deleteFromTrie("date");
+    check(words() == 2, "deleting a buffered word uncounts it");
+    freezeTrie();
+    check(words() == 2 && readGauges().frozenWords == 2, "freezing keeps the count");
+}
+
+int main() {
+    testFrozenTrie();
+    testImageRoundTrip();
+    testEmbeddedImage();
+    testHuffmanRoundTrip();
+    testParallelHuffman();
+    testMeaningBlocks();
+    testDamagedMeaningBlock();
+    testSnapshotRoundTrip();
+    testLazySnapshot();
+    testBatchMatchesSingle();
+    testWriteBuffer();
+    testAllocationFreeLookups();
+    testEraseAndFreeze();
+    testBufferCompaction();
+    testBulkLoader();
+    testAutocompleteLookupCounts();
+    testNormalizedKeys();
+    testFuzzySearch();
+    testFuzzyLiveWeights();
+    testFuzzyNonAscii();
+    testReverseLookup();
+    testWordCount();
+    testMetrics();
+    testStreamLookups();
+    testManyReaders();
+    testWalTornTail();
+    testWalSequenceAfterNoOps();
+    testLazyStartAfterCheckpoint();
+    testWalFailure();
+    testCacheRaces();
+    testCacheInvalidation();
+#ifdef __linux__
+    testServerPipelining();
+#endif
+    if (failures) {
+        cout << failures << (failures == 1 ? " check failed.\n" : " checks failed.\n");
+        return 1;
+    }
+    cout << "All checks passed.\n";
+    return 0;
+}